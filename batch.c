@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bisect.h"
+#include "compressed.h"
+#include "precise_time.h"
+
+struct batch_query {
+    int64_t start_ns;
+    int64_t end_ns;
+    size_t from;
+    size_t to;
+};
+
+struct batch_span {
+    size_t from;
+    size_t to;
+};
+
+static int compare_ns(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_spans(const void *a, const void *b) {
+    const struct batch_span *x = a;
+    const struct batch_span *y = b;
+    return (x->from > y->from) - (x->from < y->from);
+}
+
+// Reads one parse_search_range() spec per line. Blank lines and lines
+// starting with '#' are skipped.
+static int read_queries(FILE *in, struct batch_query **queries, size_t *count) {
+    size_t capacity = 64;
+    *queries = malloc(sizeof(**queries) * capacity);
+    *count = 0;
+    if (*queries == NULL) {
+        return -1;
+    }
+
+    char line[MAX_BUFFER_SIZE];
+    size_t line_number = 0;
+    while (fgets(line, sizeof(line), in) != NULL) {
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+
+        struct search_range_t range;
+        if (parse_search_range(line, &range) != 0) {
+            fprintf(stderr, "Error: invalid query on line %zu: '%s'\n", line_number, line);
+            return -1;
+        }
+        if (*count == capacity) {
+            capacity *= 2;
+            struct batch_query *grown = realloc(*queries, sizeof(**queries) * capacity);
+            if (grown == NULL) {
+                return -1;
+            }
+            *queries = grown;
+        }
+        (*queries)[(*count)++] = (struct batch_query){
+            .start_ns = precise_time_to_ns(range.start),
+            .end_ns = precise_time_to_ns(range.end),
+        };
+    }
+    return ferror(in) ? -1 : 0;
+}
+
+// Index of key in the sorted, distinct keys
+static size_t key_index(const int64_t *keys, size_t count, int64_t key) {
+    const int64_t *found = bsearch(&key, keys, count, sizeof(*keys), compare_ns);
+    return found - keys;
+}
+
+// Sets the byte range of every query. The start and end of all queries are
+// searched together, so probes near the top of the search are made once.
+static int locate_queries(const struct log_file *log, struct batch_query *query, size_t count) {
+    size_t key_count = 2 * count;
+    int64_t *keys = malloc(sizeof(int64_t) * (key_count > 0 ? key_count : 1));
+    size_t *offsets = malloc(sizeof(size_t) * (key_count > 0 ? key_count : 1));
+    if (keys == NULL || offsets == NULL) {
+        free(keys);
+        free(offsets);
+        return -1;
+    }
+
+    // An entry after end_ns is one at or after end_ns + 1
+    for (size_t i = 0; i < count; i++) {
+        keys[2 * i] = query[i].start_ns;
+        keys[2 * i + 1] = query[i].end_ns + 1;
+    }
+    qsort(keys, key_count, sizeof(int64_t), compare_ns);
+    size_t distinct = 0;
+    for (size_t i = 0; i < key_count; i++) {
+        if (distinct == 0 || keys[distinct - 1] != keys[i]) {
+            keys[distinct++] = keys[i];
+        }
+    }
+
+    int result = log_seek_many(log, keys, distinct, offsets);
+    for (size_t i = 0; result == 0 && i < count; i++) {
+        query[i].from = offsets[key_index(keys, distinct, query[i].start_ns)];
+        query[i].to = offsets[key_index(keys, distinct, query[i].end_ns + 1)];
+        if (query[i].to < query[i].from) {
+            query[i].to = query[i].from;
+        }
+    }
+
+    free(keys);
+    free(offsets);
+    return result;
+}
+
+// Writes the ranges of all queries in file order, coalescing overlapping and
+// touching ones, so the log is read in a single pass
+static int write_queries(const struct log_file *log, const struct batch_query *query, size_t count) {
+    struct batch_span *spans = malloc(sizeof(struct batch_span) * (count > 0 ? count : 1));
+    if (spans == NULL) {
+        return -1;
+    }
+
+    size_t span_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (query[i].from < query[i].to) {
+            spans[span_count++] = (struct batch_span){query[i].from, query[i].to};
+        }
+    }
+    qsort(spans, span_count, sizeof(struct batch_span), compare_spans);
+    size_t merged = 0;
+    for (size_t i = 0; i < span_count; i++) {
+        if (merged > 0 && spans[i].from <= spans[merged - 1].to) {
+            if (spans[i].to > spans[merged - 1].to) {
+                spans[merged - 1].to = spans[i].to;
+            }
+        } else {
+            spans[merged++] = spans[i];
+        }
+    }
+
+    int result = 0;
+    for (size_t i = 0; i < merged && result == 0; i++) {
+        result = output_range(log, spans[i].from, spans[i].to, STDOUT_FILENO);
+    }
+    free(spans);
+    return result;
+}
+
+// Answers every query read from `queries` against one log. With
+// offsets_only, prints the byte offsets "<from> <to>" of each query in input
+// order; otherwise writes the entries of all queries, each byte once.
+int bisect_queries(const char *filename, FILE *queries, bool offsets_only) {
+    if (detect_compression(filename) != COMPRESSION_NONE) {
+        return -1;
+    }
+
+    struct batch_query *query;
+    size_t count;
+    if (read_queries(queries, &query, &count) < 0) {
+        free(query);
+        return -1;
+    }
+
+    struct log_file log;
+    if (log_open(filename, &log) < 0) {
+        free(query);
+        return -1;
+    }
+
+    int result = locate_queries(&log, query, count);
+    if (result == 0 && offsets_only) {
+        for (size_t i = 0; i < count; i++) {
+            printf("%zu %zu\n", query[i].from, query[i].to);
+        }
+        result = fflush(stdout) == 0 ? 0 : -1;
+    } else if (result == 0) {
+        result = write_queries(&log, query, count);
+    }
+
+    log_close(&log);
+    free(query);
+    return result;
+}
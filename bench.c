@@ -0,0 +1,295 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "bisect.h"
+#include "date_scan.h"
+#include "precise_time.h"
+#include "stats.h"
+
+// Runs random time range queries against a log and prints JSON with the
+// search latency, probes, bytes read and extraction throughput, with a warm
+// and optionally a cold page cache.
+
+struct bench_query {
+    int64_t start_ns;
+    int64_t end_ns;
+};
+
+struct bench_sample {
+    double search_us;
+    size_t probes;
+    size_t bytes_scanned;
+    size_t bytes_read;      // pages brought into the page cache by the search
+    size_t extracted;
+    double extract_seconds;
+    bool failed;
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static size_t resident_bytes(const struct log_file *log, unsigned char *pages, size_t page_size) {
+    if (log->size == 0 || mincore((void *)log->data, log->size, pages) < 0) {
+        return 0;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < (log->size + page_size - 1) / page_size; i++) {
+        count += pages[i] & 1;
+    }
+    return count * page_size;
+}
+
+static void drop_cache(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+// Query times are timestamps read at random offsets of the log itself, so
+// they suit any rate pattern or time zone
+static int pick_queries(const char *filename, struct bench_query *queries, size_t count, int64_t window_ns, unsigned seed) {
+    struct log_file log;
+    if (log_open(filename, &log) < 0 || log.size == 0) {
+        return -1;
+    }
+    srand(seed);
+    for (size_t i = 0; i < count; i++) {
+        size_t offset = (size_t)(((double)rand() / ((double)RAND_MAX + 1)) * (double)log.size);
+        size_t date_offset, date_len;
+        if (!scan_date(log.data + offset, log.size - offset, &date_offset, &date_len)) {
+            // Past the last timestamp: take the first one
+            offset = 0;
+            if (!scan_date(log.data, log.size, &date_offset, &date_len)) {
+                log_close(&log);
+                return -1;
+            }
+        }
+        queries[i].start_ns = parse_date_ns(log.data + offset + date_offset, date_len);
+        queries[i].end_ns = queries[i].start_ns + window_ns;
+    }
+    log_close(&log);
+    return 0;
+}
+
+static int run_query(const char *filename, const struct bench_query *query, bool cold, int out_fd,
+                     unsigned char *pages, size_t page_size, struct bench_sample *sample) {
+    if (cold) {
+        drop_cache(filename);
+    }
+    struct log_file log;
+    if (log_open(filename, &log) < 0) {
+        return -1;
+    }
+    size_t resident = resident_bytes(&log, pages, page_size);
+
+    log_stats = (struct log_stats){0};
+    double start = now_seconds();
+    struct log_entry entry;
+    int found = log_seek(&log, query->start_ns, &entry);
+    size_t from = found > 0 ? line_start(log.data, entry.offset) : log.size;
+    size_t to = found > 0 ? log_upper_bound(&log, from, query->end_ns) : log.size;
+    sample->search_us = (now_seconds() - start) * 1e6;
+    sample->probes = log_stats.probes;
+    sample->bytes_scanned = log_stats.bytes_scanned;
+    size_t now_resident = resident_bytes(&log, pages, page_size);
+    sample->bytes_read = now_resident > resident ? now_resident - resident : 0;
+
+    start = now_seconds();
+    // A search that fails is reported, not fatal
+    sample->failed = found < 0;
+    int result = sample->failed ? 0 : output_range(&log, from, to, out_fd);
+    sample->extract_seconds = now_seconds() - start;
+    sample->extracted = sample->failed ? 0 : to - from;
+
+    log_close(&log);
+    return result;
+}
+
+// Reads and discards what the queries extract, like a consumer at the other
+// end of a shell pipe would
+static void *drain_pipe(void *arg) {
+    int fd = *(int *)arg;
+    char *buf = malloc(1 << 16);
+    while (buf != NULL && read(fd, buf, 1 << 16) > 0) {
+    }
+    free(buf);
+    return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted values
+static double percentile(const double *sorted, size_t count, double p) {
+    size_t rank = (size_t)(p * (double)count + 0.999999);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void report(const char *cache, const struct bench_sample *samples, size_t count, bool last) {
+    double *latencies = malloc(sizeof(double) * count);
+    double probes = 0, scanned = 0, read = 0, extract_seconds = 0;
+    size_t probes_max = 0, extracted = 0, failed = 0;
+    for (size_t i = 0; i < count; i++) {
+        failed += samples[i].failed;
+        latencies[i] = samples[i].search_us;
+        probes += samples[i].probes;
+        probes_max = samples[i].probes > probes_max ? samples[i].probes : probes_max;
+        scanned += samples[i].bytes_scanned;
+        read += samples[i].bytes_read;
+        extracted += samples[i].extracted;
+        extract_seconds += samples[i].extract_seconds;
+    }
+    qsort(latencies, count, sizeof(double), compare_doubles);
+
+    printf("    {\n");
+    printf("      \"cache\": \"%s\",\n", cache);
+    printf("      \"failed_queries\": %zu,\n", failed);
+    printf("      \"search_p50_us\": %.1f,\n", percentile(latencies, count, 0.50));
+    printf("      \"search_p99_us\": %.1f,\n", percentile(latencies, count, 0.99));
+    printf("      \"search_max_us\": %.1f,\n", latencies[count - 1]);
+    printf("      \"probes_mean\": %.2f,\n", probes / count);
+    printf("      \"probes_max\": %zu,\n", probes_max);
+    printf("      \"bytes_scanned_mean\": %.0f,\n", scanned / count);
+    printf("      \"bytes_read_mean\": %.0f,\n", read / count);
+    printf("      \"extracted_bytes\": %zu,\n", extracted);
+    printf("      \"extract_mb_per_s\": %.1f\n", extract_seconds > 0 ? extracted / extract_seconds / (1 << 20) : 0.0);
+    printf("    }%s\n", last ? "" : ",");
+    free(latencies);
+}
+
+static void print_bench_usage(const char *program_name) {
+    printf("Usage: %s [OPTIONS] <filename>\n", program_name);
+    printf("Benchmarks time range queries against a log and prints JSON.\n\n");
+    printf("Options:\n");
+    printf("  -q, --queries N     Number of queries (default: 200)\n");
+    printf("  -w, --window S      Seconds of log extracted per query (default: 60)\n");
+    printf("  -c, --cold          Also run every query with the log dropped from the page cache\n");
+    printf("  -S, --seed N        Random seed for the query times (default: 1)\n");
+    printf("  -h, --help          Show this help message\n");
+}
+
+int main(int argc, char *argv[]) {
+    size_t count = 200;
+    long window = 60;
+    bool cold = false;
+    unsigned seed = 1;
+
+    static struct option long_options[] = {
+        {"queries", required_argument, 0, 'q'},
+        {"window",  required_argument, 0, 'w'},
+        {"cold",    no_argument,       0, 'c'},
+        {"seed",    required_argument, 0, 'S'},
+        {"help",    no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "q:w:cS:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'q':
+                count = (size_t)atol(optarg);
+                break;
+            case 'w':
+                window = atol(optarg);
+                break;
+            case 'c':
+                cold = true;
+                break;
+            case 'S':
+                seed = (unsigned)atol(optarg);
+                break;
+            case 'h':
+                print_bench_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc || count == 0 || window < 0) {
+        fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *filename = argv[optind];
+
+    struct log_file log;
+    if (log_open(filename, &log) < 0) {
+        fprintf(stderr, "Error: could not open '%s'\n", filename);
+        return EXIT_FAILURE;
+    }
+    size_t size = log.size;
+    log_close(&log);
+
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    struct bench_query *queries = malloc(sizeof(*queries) * count);
+    struct bench_sample *samples = malloc(sizeof(*samples) * count);
+    unsigned char *pages = malloc(size / page_size + 1);
+    int pipe_fds[2];
+    pthread_t drain;
+    if (pipe(pipe_fds) < 0 || pthread_create(&drain, NULL, drain_pipe, &pipe_fds[0]) != 0) {
+        fprintf(stderr, "Error: could not create the output pipe\n");
+        return EXIT_FAILURE;
+    }
+    int out_fd = pipe_fds[1];
+    if (queries == NULL || samples == NULL || pages == NULL ||
+        pick_queries(filename, queries, count, window * NS_PER_SECOND, seed) < 0) {
+        fprintf(stderr, "Error: could not prepare queries for '%s'\n", filename);
+        return EXIT_FAILURE;
+    }
+
+    printf("{\n");
+    printf("  \"file\": \"%s\",\n", filename);
+    printf("  \"size\": %zu,\n", size);
+    printf("  \"queries\": %zu,\n", count);
+    printf("  \"window_seconds\": %ld,\n", window);
+    printf("  \"runs\": [\n");
+
+    // The first pass warms the cache for the measured one
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < count; i++) {
+            if (run_query(filename, &queries[i], false, out_fd, pages, page_size, &samples[i]) < 0) {
+                fprintf(stderr, "Error: query %zu failed\n", i);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    report("warm", samples, count, !cold);
+
+    if (cold) {
+        for (size_t i = 0; i < count; i++) {
+            if (run_query(filename, &queries[i], true, out_fd, pages, page_size, &samples[i]) < 0) {
+                fprintf(stderr, "Error: query %zu failed\n", i);
+                return EXIT_FAILURE;
+            }
+        }
+        report("cold", samples, count, true);
+    }
+
+    printf("  ]\n");
+    printf("}\n");
+
+    close(out_fd);
+    pthread_join(drain, NULL);
+    close(pipe_fds[0]);
+    free(queries);
+    free(samples);
+    free(pages);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+// Writes a synthetic log for benchmarks. The same options and seed always
+// produce the same file.
+
+#define GEN_BUFFER_SIZE (4 * 1024 * 1024)
+#define GEN_MAX_LINE (64 * 1024)
+
+enum line_lengths { LINES_FIXED, LINES_UNIFORM, LINES_LONGTAIL };
+enum rate_pattern { RATE_UNIFORM, RATE_BURSTY, RATE_GAPS };
+
+struct generator {
+    uint64_t rng;
+    int64_t ns;
+    int64_t gap_ns;             // mean distance between lines
+    enum rate_pattern rate;
+    enum line_lengths lines;
+    size_t line_length;
+    int fraction_digits;        // 0, 3, 6 or 9
+    size_t burst_left;
+    time_t cached_second;
+    char cached_prefix[32];
+    char payload[GEN_MAX_LINE];
+};
+
+static uint64_t next_random(struct generator *gen) {
+    // xorshift64*
+    gen->rng ^= gen->rng >> 12;
+    gen->rng ^= gen->rng << 25;
+    gen->rng ^= gen->rng >> 27;
+    return gen->rng * 2685821657736338717ULL;
+}
+
+// Uniform in [0, n)
+static uint64_t random_below(struct generator *gen, uint64_t n) {
+    return n > 0 ? next_random(gen) % n : 0;
+}
+
+static int64_t next_gap(struct generator *gen) {
+    int64_t jitter = (int64_t)random_below(gen, (uint64_t)gen->gap_ns) - gen->gap_ns / 2;
+    switch (gen->rate) {
+        case RATE_BURSTY:
+            // Now and then a thousand lines arrive twenty times as fast
+            if (gen->burst_left == 0 && random_below(gen, 2000) == 0) {
+                gen->burst_left = 1000;
+            }
+            if (gen->burst_left > 0) {
+                gen->burst_left--;
+                return gen->gap_ns / 20;
+            }
+            return gen->gap_ns + jitter;
+        case RATE_GAPS:
+            // Rare outages of one to six hours
+            if (random_below(gen, 200000) == 0) {
+                return (int64_t)(1 + random_below(gen, 6)) * 3600 * 1000000000LL;
+            }
+            return gen->gap_ns + jitter;
+        default:
+            return gen->gap_ns + jitter;
+    }
+}
+
+static size_t next_length(struct generator *gen) {
+    size_t n = gen->line_length;
+    switch (gen->lines) {
+        case LINES_UNIFORM:
+            return n / 2 + random_below(gen, n + 1);
+        case LINES_LONGTAIL:
+            // One line in two hundred is a large blob of 16-64 KB
+            if (random_below(gen, 200) == 0) {
+                return 16 * 1024 + random_below(gen, GEN_MAX_LINE - 16 * 1024 - 64);
+            }
+            return n / 2 + random_below(gen, n / 2 + 1);
+        default:
+            return n;
+    }
+}
+
+// Formats the timestamp of the current line. localtime_r() only runs when
+// the second changes.
+static size_t format_time(struct generator *gen, char *out) {
+    time_t second = (time_t)(gen->ns / 1000000000LL);
+    if (second != gen->cached_second) {
+        struct tm tm;
+        localtime_r(&second, &tm);
+        strftime(gen->cached_prefix, sizeof(gen->cached_prefix), "%Y-%m-%d %H:%M:%S", &tm);
+        gen->cached_second = second;
+    }
+    memcpy(out, gen->cached_prefix, 19);
+    size_t len = 19;
+    if (gen->fraction_digits > 0) {
+        long fraction = (long)(gen->ns % 1000000000LL);
+        for (int i = gen->fraction_digits; i < 9; i++) {
+            fraction /= 10;
+        }
+        len += snprintf(out + len, 12, ".%0*ld", gen->fraction_digits, fraction);
+    }
+    return len;
+}
+
+static bool parse_size(const char *str, uint64_t *size) {
+    char *unit;
+    double value = strtod(str, &unit);
+    uint64_t scale = 1;
+    if (*unit == 'K' || *unit == 'k') {
+        scale = 1ULL << 10;
+    } else if (*unit == 'M' || *unit == 'm') {
+        scale = 1ULL << 20;
+    } else if (*unit == 'G' || *unit == 'g') {
+        scale = 1ULL << 30;
+    } else if (*unit != '\0') {
+        return false;
+    }
+    if (value <= 0) {
+        return false;
+    }
+    *size = (uint64_t)(value * (double)scale);
+    return true;
+}
+
+static void print_usage(const char *program_name) {
+    printf("Usage: %s [OPTIONS]\n", program_name);
+    printf("Writes a synthetic log file for benchmarks.\n\n");
+    printf("Options:\n");
+    printf("  -o, --output FILE     File to write (default: bench.log)\n");
+    printf("  -s, --size SIZE       Size of the log, with a K, M or G suffix (default: 1G)\n");
+    printf("  -r, --rate PATTERN    uniform, bursty or gaps (default: uniform)\n");
+    printf("  -l, --lines KIND      Line lengths: fixed, uniform or longtail (default: uniform)\n");
+    printf("  -L, --line-length N   Typical line length in bytes (default: 120)\n");
+    printf("  -p, --per-second N    Lines per second (default: 1000)\n");
+    printf("  -d, --digits N        Fractional digits of the timestamps: 0, 3, 6 or 9 (default: 3)\n");
+    printf("  -S, --seed N          Random seed (default: 1)\n");
+    printf("  -h, --help            Show this help message\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *output = "bench.log";
+    uint64_t size = 1ULL << 30;
+    uint64_t seed = 1;
+    long per_second = 1000;
+    struct generator *gen = calloc(1, sizeof(*gen));
+    if (gen == NULL) {
+        return EXIT_FAILURE;
+    }
+    gen->rate = RATE_UNIFORM;
+    gen->lines = LINES_UNIFORM;
+    gen->line_length = 120;
+    gen->fraction_digits = 3;
+
+    static struct option long_options[] = {
+        {"output",      required_argument, 0, 'o'},
+        {"size",        required_argument, 0, 's'},
+        {"rate",        required_argument, 0, 'r'},
+        {"lines",       required_argument, 0, 'l'},
+        {"line-length", required_argument, 0, 'L'},
+        {"per-second",  required_argument, 0, 'p'},
+        {"digits",      required_argument, 0, 'd'},
+        {"seed",        required_argument, 0, 'S'},
+        {"help",        no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "o:s:r:l:L:p:d:S:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'o':
+                output = optarg;
+                break;
+            case 's':
+                if (!parse_size(optarg, &size)) {
+                    fprintf(stderr, "Error: invalid size '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'r':
+                if (strcmp(optarg, "uniform") == 0) {
+                    gen->rate = RATE_UNIFORM;
+                } else if (strcmp(optarg, "bursty") == 0) {
+                    gen->rate = RATE_BURSTY;
+                } else if (strcmp(optarg, "gaps") == 0) {
+                    gen->rate = RATE_GAPS;
+                } else {
+                    fprintf(stderr, "Error: invalid rate pattern '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'l':
+                if (strcmp(optarg, "fixed") == 0) {
+                    gen->lines = LINES_FIXED;
+                } else if (strcmp(optarg, "uniform") == 0) {
+                    gen->lines = LINES_UNIFORM;
+                } else if (strcmp(optarg, "longtail") == 0) {
+                    gen->lines = LINES_LONGTAIL;
+                } else {
+                    fprintf(stderr, "Error: invalid line length distribution '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'L':
+                gen->line_length = (size_t)atol(optarg);
+                if (gen->line_length < 40 || gen->line_length > GEN_MAX_LINE / 2) {
+                    fprintf(stderr, "Error: invalid line length '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'p':
+                per_second = atol(optarg);
+                if (per_second <= 0) {
+                    fprintf(stderr, "Error: invalid rate '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'd':
+                gen->fraction_digits = atoi(optarg);
+                if (gen->fraction_digits % 3 != 0 || gen->fraction_digits < 0 || gen->fraction_digits > 9) {
+                    fprintf(stderr, "Error: invalid number of digits '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'S':
+                seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    gen->rng = seed * 0x9E3779B97F4A7C15ULL + 1;
+    gen->gap_ns = 1000000000LL / per_second;
+    gen->ns = 1735689600LL * 1000000000LL;  // 2025-01-01 00:00:00 UTC
+    gen->cached_second = -1;
+    for (size_t i = 0; i < GEN_MAX_LINE; i++) {
+        gen->payload[i] = "abcdefghijklmnopqrstuvwxyz0123456789 "[next_random(gen) % 37];
+    }
+
+    int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    char *buf = malloc(GEN_BUFFER_SIZE);
+    if (fd < 0 || buf == NULL) {
+        fprintf(stderr, "Error: could not write '%s'\n", output);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t written = 0;
+    size_t used = 0;
+    uint64_t line = 0;
+    while (written + used < size) {
+        if (used + GEN_MAX_LINE + 64 > GEN_BUFFER_SIZE) {
+            if (write(fd, buf, used) != (ssize_t)used) {
+                fprintf(stderr, "Error: could not write '%s'\n", output);
+                return EXIT_FAILURE;
+            }
+            written += used;
+            used = 0;
+        }
+        size_t start = used;
+        used += format_time(gen, buf + used);
+        used += sprintf(buf + used, " INFO line %llu ", (unsigned long long)line++);
+        size_t length = next_length(gen);
+        if (length > used - start + 1) {
+            size_t fill = length - (used - start) - 1;
+            memcpy(buf + used, gen->payload + random_below(gen, GEN_MAX_LINE - fill), fill);
+            used += fill;
+        }
+        buf[used++] = '\n';
+        gen->ns += next_gap(gen);
+    }
+    if (used > 0 && write(fd, buf, used) != (ssize_t)used) {
+        fprintf(stderr, "Error: could not write '%s'\n", output);
+        return EXIT_FAILURE;
+    }
+
+    close(fd);
+    free(buf);
+    free(gen);
+    return EXIT_SUCCESS;
+}
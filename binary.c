@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "binary.h"
+#include "bisect.h"
+#include "compressed.h"
+#include "precise_time.h"
+#include "stats.h"
+
+// Rendered or reversed records are gathered into a buffer of this size
+// before each write()
+#define BINARY_OUTPUT_SIZE (256 * 1024)
+
+static const struct {
+    const char *name;
+    enum binary_ts ts;
+} ts_names[] = {
+    {"u64ns", BINARY_TS_U64NS},
+    {"u64us", BINARY_TS_U64US},
+    {"u64ms", BINARY_TS_U64MS},
+    {"u64s", BINARY_TS_U64S},
+    {"u32s", BINARY_TS_U32S},
+};
+
+static size_t ts_width(enum binary_ts ts) {
+    return ts == BINARY_TS_U32S ? 4 : 8;
+}
+
+static int parse_size(const char *value, size_t *out) {
+    char *end;
+    unsigned long long n = strtoull(value, &end, 10);
+    if (*value < '0' || *value > '9' || *end != '\0') {
+        return -1;
+    }
+    *out = (size_t)n;
+    return 0;
+}
+
+// Reads a comma-separated list of key=value settings: record (required),
+// ts_offset (default 0), ts (default u64ns) and output (raw or text,
+// default raw). Returns -1 when the spec is invalid or the timestamp does
+// not fit in a record.
+int parse_binary_format(const char *spec, struct binary_format *format) {
+    *format = (struct binary_format){.ts = BINARY_TS_U64NS};
+    char buffer[MAX_BUFFER_SIZE];
+    if (snprintf(buffer, sizeof(buffer), "%s", spec) >= (int)sizeof(buffer)) {
+        return -1;
+    }
+
+    char *saveptr;
+    for (char *item = strtok_r(buffer, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+        char *value = strchr(item, '=');
+        if (value == NULL) {
+            return -1;
+        }
+        *value++ = '\0';
+        if (strcmp(item, "record") == 0) {
+            if (parse_size(value, &format->record) < 0) {
+                return -1;
+            }
+        } else if (strcmp(item, "ts_offset") == 0) {
+            if (parse_size(value, &format->ts_offset) < 0) {
+                return -1;
+            }
+        } else if (strcmp(item, "ts") == 0) {
+            size_t i = 0;
+            while (i < sizeof(ts_names) / sizeof(ts_names[0]) && strcmp(value, ts_names[i].name) != 0) {
+                i++;
+            }
+            if (i == sizeof(ts_names) / sizeof(ts_names[0])) {
+                return -1;
+            }
+            format->ts = ts_names[i].ts;
+        } else if (strcmp(item, "output") == 0 && (strcmp(value, "raw") == 0 || strcmp(value, "text") == 0)) {
+            format->text = strcmp(value, "text") == 0;
+        } else {
+            return -1;
+        }
+    }
+    if (format->record == 0 || format->ts_offset > format->record ||
+        format->record - format->ts_offset < ts_width(format->ts)) {
+        return -1;
+    }
+    return 0;
+}
+
+static uint64_t load_le(const unsigned char *p, size_t width) {
+    uint64_t value = 0;
+    for (size_t i = width; i-- > 0;) {
+        value = value << 8 | p[i];
+    }
+    return value;
+}
+
+// The timestamp of record i in nanoseconds, saturating at INT64_MAX
+static int64_t record_ns(const struct log_file *log, const struct binary_format *format, size_t i) {
+    const unsigned char *p = (const unsigned char *)log->data + i * format->record + format->ts_offset;
+    uint64_t value = load_le(p, ts_width(format->ts));
+    uint64_t scale = 1;
+    switch (format->ts) {
+    case BINARY_TS_U64NS:
+        break;
+    case BINARY_TS_U64US:
+        scale = 1000;
+        break;
+    case BINARY_TS_U64MS:
+        scale = 1000000;
+        break;
+    case BINARY_TS_U64S:
+    case BINARY_TS_U32S:
+        scale = NS_PER_SECOND;
+        break;
+    }
+    return value > (uint64_t)INT64_MAX / scale ? INT64_MAX : (int64_t)(value * scale);
+}
+
+// Finds the first of records [begin, end) whose timestamp is not less than
+// target_ns. Each probe is a single load, placed by the same estimator as
+// the probes of a text search.
+static size_t lower_bound_record(const struct log_file *log, const struct binary_format *format, size_t begin,
+                                 size_t end, int64_t target_ns) {
+    struct probe_estimator e;
+    estimator_init(&e);
+    while (begin < end) {
+        enum probe_kind kind;
+        size_t mid = estimator_next(&e, begin, end, format->record, target_ns, &kind);
+        log_stats.probes++;
+        int64_t ns = record_ns(log, format, mid);
+        bool right = ns < target_ns;
+        if (log_trace_enabled) {
+            char decision[64];
+            snprintf(decision, sizeof(decision), "%s, search %s", probe_kind_name(kind), right ? "right" : "left");
+            log_trace_probe(mid * format->record, ns, target_ns, decision);
+        }
+        size_t before = end - begin;
+        estimator_record(&e, right, true, mid * format->record, ns);
+        if (right) {
+            begin = mid + 1;
+        } else {
+            end = mid;
+        }
+        estimator_narrowed(&e, kind, before, end - begin);
+    }
+    return begin;
+}
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// Renders record i as its local time with nanoseconds and its bytes in hex
+static size_t render_record(const struct log_file *log, const struct binary_format *format, size_t i, char *out,
+                            time_t *cached_seconds, char *cached_prefix) {
+    int64_t ns = record_ns(log, format, i);
+    precise_time_t t = ns_to_precise_time(ns);
+    if (t.seconds != *cached_seconds) {
+        struct tm tm_info;
+        if (localtime_r(&t.seconds, &tm_info) == NULL ||
+            strftime(cached_prefix, 32, "%Y-%m-%d %H:%M:%S", &tm_info) == 0) {
+            snprintf(cached_prefix, 32, "%lld", (long long)t.seconds);
+        }
+        *cached_seconds = t.seconds;
+    }
+    size_t len = (size_t)sprintf(out, "%s.%09ld ", cached_prefix, t.nanoseconds);
+    const unsigned char *p = (const unsigned char *)log->data + i * format->record;
+    for (size_t j = 0; j < format->record; j++) {
+        out[len++] = hex_digits[p[j] >> 4];
+        out[len++] = hex_digits[p[j] & 0xf];
+    }
+    out[len++] = '\n';
+    return len;
+}
+
+// Writes records [first, last), newest first with reverse, raw or rendered.
+// Raw records in order are one range of the file and are copied by the
+// kernel.
+static int output_records(const struct log_file *log, const struct binary_format *format, size_t first, size_t last,
+                          bool reverse) {
+    if (!format->text && !reverse) {
+        return output_range(log, first * format->record, last * format->record, STDOUT_FILENO);
+    }
+
+    size_t line_max = format->text ? 64 + 2 * format->record : format->record;
+    size_t capacity = BINARY_OUTPUT_SIZE > line_max ? BINARY_OUTPUT_SIZE : line_max;
+    char *buf = malloc(capacity);
+    if (buf == NULL) {
+        return -1;
+    }
+    time_t cached_seconds = (time_t)-1;
+    char cached_prefix[32] = "";
+    size_t len = 0;
+    int result = 0;
+    for (size_t n = 0; result == 0 && n < last - first; n++) {
+        size_t i = reverse ? last - 1 - n : first + n;
+        if (capacity - len < line_max) {
+            result = write_all(STDOUT_FILENO, buf, len);
+            len = 0;
+        }
+        if (format->text) {
+            len += render_record(log, format, i, buf + len, &cached_seconds, cached_prefix);
+        } else {
+            memcpy(buf + len, log->data + i * format->record, format->record);
+            len += format->record;
+        }
+    }
+    if (result == 0 && len > 0) {
+        result = write_all(STDOUT_FILENO, buf, len);
+    }
+    free(buf);
+    return result;
+}
+
+// Searches a log of fixed-size binary records sorted by their timestamp
+// field. Both ends of the range are searched on record indices, so no byte
+// is parsed; a partial record at the end, still being written, is left out.
+// The range's limit and direction apply as for text logs.
+int bisect_binary(const char *filename, struct search_range_t range, const struct binary_format *format) {
+    int64_t start_ns = precise_time_to_ns(range.start);
+    int64_t end_ns = precise_time_to_ns(range.end);
+
+    if (detect_compression(filename) != COMPRESSION_NONE) {
+        return -1;
+    }
+    struct log_file log;
+    if (log_open(filename, &log) < 0) {
+        return -1;
+    }
+
+    int64_t started = stats_clock();
+    size_t count = log.size / format->record;
+    size_t first = lower_bound_record(&log, format, 0, count, start_ns);
+    size_t last = end_ns < INT64_MAX ? lower_bound_record(&log, format, first, count, end_ns + 1) : count;
+    stats_elapsed(&log_stats.search_ns, started);
+
+    if (range.limit > 0 && last - first > range.limit) {
+        if (range.reverse) {
+            first = last - range.limit;
+        } else {
+            last = first + range.limit;
+        }
+    }
+    int result = first < last ? output_records(&log, format, first, last, range.reverse) : 0;
+    log_close(&log);
+    return result;
+}
@@ -0,0 +1,32 @@
+#ifndef BINARY_H
+#define BINARY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "search_range.h"
+
+// Type and unit of the timestamp field of a binary record, an unsigned
+// little-endian integer since the epoch
+enum binary_ts {
+    BINARY_TS_U64NS,
+    BINARY_TS_U64US,
+    BINARY_TS_U64MS,
+    BINARY_TS_U64S,
+    BINARY_TS_U32S,
+};
+
+// A log of fixed-size binary records sorted by a timestamp field, as
+// described by --binary "record=64,ts_offset=0,ts=u64ns[,output=text]"
+struct binary_format {
+    size_t record;          // bytes per record
+    size_t ts_offset;       // offset of the timestamp within a record
+    enum binary_ts ts;
+    bool text;              // render records as text rather than write them raw
+};
+
+int parse_binary_format(const char *spec, struct binary_format *format);
+int bisect_binary(const char *filename, struct search_range_t range, const struct binary_format *format);
+
+#endif // BINARY_H
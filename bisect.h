@@ -6,7 +6,9 @@
 #include <string.h>
 #include <stdbool.h>
 #include <time.h>
-#include <regex.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 
 #include "search_range.h"
 
@@ -15,10 +17,95 @@
 #define MAX_PATH_LENGTH 1024
 #define MAX_BUFFER_SIZE 4096
 
-extern regex_t regex_datetime;
-extern char *regex_pattern;
+// A log mapped into memory as a whole. The descriptor stays open for
+// zero-copy output.
+struct log_file {
+    const char *filename;
+    const char *data;
+    size_t size;
+    struct stat st;
+    int fd;
+    struct log_cache *cache;    // NULL unless searched through a bisect handle
+};
 
-void bisect(const char *filename, struct search_range_t range);
+// An entry runs from its timestamp up to the next timestamp in the log
+struct log_entry {
+    size_t offset;
+    size_t date_len;
+    int64_t ns;
+};
+
+// Chooses where a search for the first timestamp at or after a target
+// probes next: the ends of the interval first, then a position interpolated
+// from the timestamps seen just outside it, assuming a steady rate between
+// them. An estimate that does not halve the interval is followed by a
+// bisection step. Positions are byte offsets; the interval is counted in
+// units of unit_size bytes, blocks of text or binary records.
+struct probe_estimator {
+    bool low_known;         // a timestamp before the target was seen at low_pos
+    bool high_known;        // one at or after it was seen at high_pos
+    bool high_probed;       // the search went left at least once
+    bool interpolate;       // false for the bisection step after a poor estimate
+    size_t low_pos, high_pos;
+    int64_t low_ns, high_ns;
+};
+
+enum probe_kind {
+    PROBE_EDGE,
+    PROBE_ESTIMATE,
+    PROBE_BISECT,
+};
+
+void estimator_init(struct probe_estimator *e);
+size_t estimator_next(const struct probe_estimator *e, size_t begin, size_t end, size_t unit_size, int64_t target_ns,
+                      enum probe_kind *kind);
+void estimator_record(struct probe_estimator *e, bool right, bool dated, size_t pos, int64_t ns);
+void estimator_narrowed(struct probe_estimator *e, enum probe_kind kind, size_t before, size_t after);
+const char *probe_kind_name(enum probe_kind kind);
+
+int log_open(const char *filename, struct log_file *log);
+int log_open_fd(const char *filename, int fd, struct log_file *log);
+void log_close(struct log_file *log);
+int log_seek(const struct log_file *log, int64_t start_ns, struct log_entry *entry);
+bool log_next_entry(const struct log_file *log, struct log_entry *entry);
+size_t log_upper_bound(const struct log_file *log, size_t from, int64_t end_ns);
+int log_seek_many(const struct log_file *log, const int64_t *keys, size_t count, size_t *offsets);
+int write_all(int fd, const char *p, size_t len);
+size_t count_newlines(const char *p, size_t len);
+size_t line_start(const char *data, size_t pos);
+int output_range(const struct log_file *log, size_t from, size_t to, int out_fd);
+void advise_sequential(const struct log_file *log, size_t from, size_t to);
+void advise_willneed(const struct log_file *log, size_t from, size_t to);
+int log_cache_init(struct log_file *log);
+
+// Handle-based API for embedding: a handle keeps the log mapped, its sidecar
+// index open and recent probe results cached. It searches with the timestamp
+// format in use when it was opened, whatever the calling thread uses. Every
+// call taking a const handle may run from many threads at once.
+struct bisect_handle;
+
+// Receives the bytes of a range in order; a non-zero return stops the read
+typedef int (*bisect_sink)(void *context, const char *data, size_t len);
+
+int bisect_open(const char *filename, struct bisect_handle **handle);
+size_t bisect_size(const struct bisect_handle *handle);
+size_t bisect_find_lower(const struct bisect_handle *handle, int64_t start_ns);
+size_t bisect_find_upper(const struct bisect_handle *handle, int64_t end_ns);
+int bisect_read_range(const struct bisect_handle *handle, size_t from, size_t to, bisect_sink sink, void *context);
+int bisect_write_range(const struct bisect_handle *handle, size_t from, size_t to, int fd);
+bool bisect_is_current(const struct bisect_handle *handle, const struct stat *st);
+void bisect_close(struct bisect_handle *handle);
+
+int bisect(const char *filename, struct search_range_t range);
+int bisect_follow(const char *filename, struct search_range_t range);
+int bisect_merge(const char **filenames, size_t count, struct search_range_t range, int jobs);
+int bisect_chain(const char **filenames, size_t count, struct search_range_t range, int jobs);
+int bisect_grep(const char *filename, struct search_range_t range, const char *pattern, int jobs);
+int bisect_queries(const char *filename, FILE *queries, bool offsets_only);
+int bisect_serve(const char *socket_path, int jobs);
+int bisect_request(const char *socket_path, const char *time_range, const char *filename, int out_fd);
+int bisect_histogram(const char *filename, struct search_range_t range, int64_t bucket_ns, bool count_lines);
+int bisect_sample(const char *filename, struct search_range_t range, size_t count, bool by_bytes);
 void print_usage(const char *program_name);
 void print_version(void);
 
@@ -6,141 +6,820 @@
 #include <fcntl.h>
 #include <stdint.h>
 #include <string.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
 
+#if defined(_WIN32) || defined(_WIN64)
+#include "win.h"
+#else
+#include <sys/mman.h>
+#endif
+
+#include "bisect.h"
+#include "bsx_index.h"
+#include "compressed.h"
+#include "date_scan.h"
 #include "precise_time.h"
+#include "prefetch.h"
 #include "search_range.h"
+#include "stats.h"
 
 
 static size_t _BLOCK_SIZE = 8192;
 
-void printout(int fd, size_t from, struct search_range_t range);
+// Levels of the search tree read ahead of a bisection step while the dates
+// give nothing to estimate from, and blocks read ahead past an estimate
+#define PREFETCH_LEVELS 2
+#define PREFETCH_NEAR 2
 
+// A search that has narrowed down to this many blocks scans them rather than
+// probing further: the probes left would each fault in a page the scan reads
+// anyway
+#define LINEAR_SCAN_BLOCKS 4
 
-ssize_t lower_bound_block(int fd, size_t file_size, struct search_range_t range, bool (*cmp)(precise_time_t, precise_time_t)) {
-    size_t n_blocks = file_size / _BLOCK_SIZE;
-    size_t begin = 0;
-    size_t end = n_blocks;
+// A range written newest first is read back to front in aligned chunks of
+// this size, and gathered into a buffer of REVERSE_OUTPUT_SIZE before each
+// write()
+#define REVERSE_CHUNK (1024 * 1024)
+#define REVERSE_OUTPUT_SIZE (256 * 1024)
 
-    char buffer[_BLOCK_SIZE];
-    char date_str[64];
-    while (begin < end) {
-        size_t mid = (begin + end) / 2;
+int printout(const struct log_file *log, struct log_entry entry, int64_t end_ns);
+static int printout_disordered(const struct log_file *log, int64_t start_ns, int64_t end_ns, int64_t disorder_ns);
+static int printout_limited(const struct log_file *log, struct log_entry entry, int64_t end_ns, size_t limit);
+static int printout_reverse(const struct log_file *log, int64_t start_ns, int64_t end_ns, size_t limit);
 
-        lseek(fd, mid * _BLOCK_SIZE, SEEK_SET);
-        int bytes_read = read(fd, buffer, sizeof(buffer) - 1);
-        if (bytes_read < 0) {
-            return -1;
-        }
 
-        buffer[bytes_read] = '\0';
-        int date_offset_in_buf = find_date_in_buffer(buffer);
-        if (date_offset_in_buf < 0) {
-            return -1;
+static bool key_less(int64_t a, int64_t b) {
+    return a < b;
+}
+
+// State a bisect handle shares between the threads searching its log: the
+// sidecar index, opened once, and the first date of recently probed blocks.
+//
+// A probe slot is guarded by a sequence number that is odd while a writer
+// fills it. A reader that sees it change treats the slot as a miss and a
+// writer that finds it taken skips the update, so no thread ever waits.
+#define PROBE_CACHE_SLOTS 4096
+
+struct probe_slot {
+    atomic_uint_fast64_t seq;
+    atomic_uint_fast64_t block;     // block + 1, so that 0 marks an empty slot
+    atomic_uint_fast64_t line_pos;
+    atomic_int_fast64_t ns;
+};
+
+struct log_cache {
+    struct bsx_index index;
+    bool indexed;
+    struct probe_slot slots[PROBE_CACHE_SLOTS];
+};
+
+static bool probe_cache_get(struct log_cache *cache, size_t block, size_t *line_pos, int64_t *ns) {
+    struct probe_slot *slot = &cache->slots[block % PROBE_CACHE_SLOTS];
+    uint_fast64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if (seq & 1) {
+        return false;
+    }
+    bool hit = atomic_load_explicit(&slot->block, memory_order_relaxed) == block + 1;
+    *line_pos = atomic_load_explicit(&slot->line_pos, memory_order_relaxed);
+    *ns = atomic_load_explicit(&slot->ns, memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    return hit && atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq;
+}
+
+static void probe_cache_put(struct log_cache *cache, size_t block, size_t line_pos, int64_t ns) {
+    struct probe_slot *slot = &cache->slots[block % PROBE_CACHE_SLOTS];
+    uint_fast64_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    if ((seq & 1) || !atomic_compare_exchange_strong_explicit(&slot->seq, &seq, seq + 1, memory_order_relaxed,
+                                                              memory_order_relaxed)) {
+        return;
+    }
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&slot->block, block + 1, memory_order_relaxed);
+    atomic_store_explicit(&slot->line_pos, line_pos, memory_order_relaxed);
+    atomic_store_explicit(&slot->ns, ns, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
+
+// Keeps the sidecar index open and probe results for later searches of log,
+// from any thread
+int log_cache_init(struct log_file *log) {
+    log->cache = calloc(1, sizeof(*log->cache));
+    if (log->cache == NULL) {
+        return -1;
+    }
+    log->cache->indexed = log->size > 0 && bsx_open(log->filename, log->data, &log->st, &log->cache->index) == 0;
+    return 0;
+}
+
+static void log_cache_free(struct log_file *log) {
+    if (log->cache != NULL && log->cache->indexed) {
+        bsx_close(&log->cache->index);
+    }
+    free(log->cache);
+    log->cache = NULL;
+}
+
+// Opens the sidecar index of log, or borrows the one its cache keeps open
+static bool index_open(const struct log_file *log, struct bsx_index *index) {
+    if (log->cache != NULL) {
+        *index = log->cache->index;
+        return log->cache->indexed;
+    }
+    return log->size > 0 && bsx_open(log->filename, log->data, &log->st, index) == 0;
+}
+
+static void index_close(const struct log_file *log, struct bsx_index *index) {
+    if (log->cache == NULL) {
+        bsx_close(index);
+    }
+}
+
+// Reads the first timestamp on the lines starting at or after block, up to
+// byte limit. A probe landing inside a long entry skips the rest of it, over
+// as many blocks as that takes, and one landing on a line without a
+// timestamp goes on to the next. Stores the start of the timestamp's line in
+// *line_pos. Returns false when there is none; *line_pos is then where the
+// scan began, and no line from there up to limit carries a timestamp.
+static bool probe_block(const struct log_file *log, size_t block, size_t limit, size_t *line_pos, int64_t *ns) {
+    if (log->cache != NULL && probe_cache_get(log->cache, block, line_pos, ns)) {
+        return true;
+    }
+
+    size_t offset = block * _BLOCK_SIZE;
+    size_t pos = offset < limit ? offset : limit;
+    if (pos > 0 && pos < limit) {
+        const char *newline = memchr(log->data + pos - 1, '\n', limit - pos + 1);
+        pos = newline != NULL ? (size_t)(newline - log->data) + 1 : limit;
+    }
+
+    log_stats.probes++;
+    size_t date_offset, date_len;
+    if (pos >= limit || !scan_date(log->data + pos, limit - pos, &date_offset, &date_len)) {
+        log_stats.bytes_scanned += limit > offset ? limit - offset : 0;
+        *line_pos = pos;
+        return false;
+    }
+    log_stats.bytes_scanned += pos - offset + date_offset + date_len;
+    size_t date_pos = pos + date_offset;
+    *line_pos = line_start(log->data, date_pos);
+    *ns = parse_date_ns(log->data + date_pos, date_len);
+    if (log->cache != NULL) {
+        probe_cache_put(log->cache, block, *line_pos, *ns);
+    }
+    return true;
+}
+
+// The first block past a probe of block mid that found a timestamp on the
+// line at line_pos: the blocks in between lead to the same one
+static size_t block_after(size_t mid, size_t line_pos) {
+    size_t block = line_pos / _BLOCK_SIZE;
+    return block > mid ? block + 1 : mid + 1;
+}
+
+// The unit of [begin, end) the dates seen on either side put target_ns in,
+// assuming a steady write rate between them
+static size_t estimate_unit(size_t low_pos, int64_t low_ns, size_t high_pos, int64_t high_ns, int64_t target_ns,
+                            size_t unit_size, size_t begin, size_t end) {
+    double fraction = (double)(target_ns - low_ns) / (double)(high_ns - low_ns);
+    double pos = (double)low_pos + fraction * (double)(high_pos - low_pos);
+    size_t guess = (size_t)(pos / (double)unit_size);
+    return guess < begin ? begin : guess >= end ? end - 1 : guess;
+}
+
+void estimator_init(struct probe_estimator *e) {
+    *e = (struct probe_estimator){.interpolate = true};
+}
+
+// The unit of [begin, end) to probe next for target_ns, and how it was chosen
+size_t estimator_next(const struct probe_estimator *e, size_t begin, size_t end, size_t unit_size, int64_t target_ns,
+                      enum probe_kind *kind) {
+    *kind = PROBE_EDGE;
+    if (e->interpolate && !e->low_known) {
+        return begin;
+    }
+    if (e->interpolate && !e->high_probed) {
+        return end - 1;
+    }
+    if (e->interpolate && e->high_known && e->high_ns > e->low_ns) {
+        *kind = PROBE_ESTIMATE;
+        return estimate_unit(e->low_pos, e->low_ns, e->high_pos, e->high_ns, target_ns, unit_size, begin, end);
+    }
+    *kind = PROBE_BISECT;
+    return (begin + end) / 2;
+}
+
+// Records what a probe found at pos: a timestamp before the target sends the
+// search right; one at or after it, or none at all, sends it left
+void estimator_record(struct probe_estimator *e, bool right, bool dated, size_t pos, int64_t ns) {
+    e->high_probed |= !right;
+    if (right) {
+        e->low_known = true;
+        e->low_pos = pos;
+        e->low_ns = ns;
+    } else if (dated) {
+        e->high_known = true;
+        e->high_pos = pos;
+        e->high_ns = ns;
+    }
+}
+
+// Takes a bisection step next when an estimate left more than half of the
+// `before` units
+void estimator_narrowed(struct probe_estimator *e, enum probe_kind kind, size_t before, size_t after) {
+    e->interpolate = kind != PROBE_ESTIMATE || after <= before / 2;
+}
+
+const char *probe_kind_name(enum probe_kind kind) {
+    return kind == PROBE_EDGE ? "edge" : kind == PROBE_ESTIMATE ? "interpolated" : "bisected";
+}
+
+static void prefetch_block(const struct log_file *log, struct prefetcher *p, size_t block) {
+    size_t offset = block * _BLOCK_SIZE;
+    prefetch_add(p, offset, log->size - offset < _BLOCK_SIZE ? log->size - offset : _BLOCK_SIZE);
+}
+
+// Reads ahead the midpoints of [begin, end) and of its halves, levels deep
+static void prefetch_bisection(const struct log_file *log, struct prefetcher *p, size_t begin, size_t end, int levels) {
+    if (levels == 0 || begin >= end) {
+        return;
+    }
+    size_t mid = (begin + end) / 2;
+    prefetch_block(log, p, mid);
+    prefetch_bisection(log, p, begin, mid, levels - 1);
+    prefetch_bisection(log, p, mid + 1, end, levels - 1);
+}
+
+// Reads ahead what the step after an estimate at mid probes when the
+// search continues in [begin, end): the neighbours of the estimate when that
+// halves the interval, and its bisection otherwise
+static void prefetch_after_estimate(const struct log_file *log, struct prefetcher *p, size_t begin, size_t end,
+                                    size_t before, bool left) {
+    if (begin >= end) {
+        return;
+    }
+    if (end - begin > before / 2) {
+        prefetch_block(log, p, (begin + end) / 2);
+        return;
+    }
+    for (size_t i = 0; i < PREFETCH_NEAR && i < end - begin; i++) {
+        prefetch_block(log, p, left ? end - 1 - i : begin + i);
+    }
+}
+
+// Searches blocks [begin, end) and returns a block to scan forward from for
+// the first date not cmp-less than target_ns: the block before the first one
+// whose probe finds such a date, or one at most LINEAR_SCAN_BLOCKS before it,
+// but never less than begin.
+//
+// Logs are written at a fairly steady rate, so the next block to probe is
+// estimated by a probe_estimator from the (offset, time) pairs of the dates
+// seen just outside the interval. The first two probes read the ends of the
+// interval to get them. An estimate that does not halve the interval is
+// followed by a bisection step, so the search never takes more than about
+// twice as many probes as plain bisection.
+//
+// When the ends of the interval are not in the page cache, the blocks the
+// next step may probe are read while this one waits for its own, so that
+// slow storage serves the search two levels at a time: the far end with the
+// near one, both outcomes of an estimate, the estimate that follows a
+// bisection step, and further bisection levels while the dates at both ends
+// are equal.
+static size_t lower_bound_block(const struct log_file *log, size_t begin, size_t end, int64_t target_ns,
+                                bool (*cmp)(int64_t, int64_t)) {
+    size_t first = begin;
+    size_t limit = log->size;   // no line from here on carries a timestamp
+    struct probe_estimator e;
+    estimator_init(&e);
+
+    // Probes are timed until one shows the storage slow enough to read
+    // ahead of; from then on searches that start out of the page cache do
+    struct prefetcher prefetcher;
+    int slow_probes = 0;
+    bool prefetching = begin < end && prefetch_worthwhile() &&
+                       (prefetch_wanted(log, begin * _BLOCK_SIZE) || prefetch_wanted(log, (end - 1) * _BLOCK_SIZE));
+    if (prefetching) {
+        prefetch_start(log, &prefetcher);
+    }
+
+    while (end - begin > LINEAR_SCAN_BLOCKS) {
+        enum probe_kind kind;
+        size_t mid = estimator_next(&e, begin, end, _BLOCK_SIZE, target_ns, &kind);
+
+        if (prefetching) {
+            // The probed block is read whole, so that scanning past its
+            // first page does not wait for storage again
+            prefetch_block(log, &prefetcher, mid);
+            if (!e.low_known && !e.high_known && mid == begin && end - 1 > begin) {
+                prefetch_block(log, &prefetcher, end - 1);
+            } else if (kind == PROBE_ESTIMATE) {
+                prefetch_after_estimate(log, &prefetcher, begin, mid, end - begin, true);
+                prefetch_after_estimate(log, &prefetcher, mid + 1, end, end - begin, false);
+            } else if (e.low_known && e.high_known && e.high_ns > e.low_ns) {
+                size_t guess = estimate_unit(e.low_pos, e.low_ns, e.high_pos, e.high_ns, target_ns, _BLOCK_SIZE,
+                                             begin, end);
+                if (guess != mid) {
+                    prefetch_block(log, &prefetcher, guess);
+                }
+            } else if (e.low_known && e.high_known) {
+                prefetch_bisection(log, &prefetcher, begin, mid, PREFETCH_LEVELS);
+                prefetch_bisection(log, &prefetcher, mid + 1, end, PREFETCH_LEVELS);
+            }
+            prefetch_submit(&prefetcher);
         }
 
-        int date_len = extract_date_string(buffer, date_offset_in_buf, date_str, sizeof(date_str));
-        if (date_len < 0) {
-            end = mid;
-            continue;
+        size_t line_pos;
+        int64_t found_ns = 0;
+        int64_t probe_started = prefetching ? 0 : stats_now_ns();
+        bool dated = probe_block(log, mid, limit, &line_pos, &found_ns);
+        if (!prefetching && prefetch_observe(stats_now_ns() - probe_started, &slow_probes)) {
+            prefetch_start(log, &prefetcher);
+            prefetching = true;
         }
-        
-        precise_time_t found_time = string_to_precise_time(date_str);
 
-        if (cmp(found_time, range.start)) {
-            begin = mid + 1;
+        size_t before = end - begin;
+        // Past the last timestamp the search goes left, like past the target
+        bool right = dated && cmp(found_ns, target_ns);
+        if (log_trace_enabled) {
+            char decision[64];
+            snprintf(decision, sizeof(decision), "%s, search %s", probe_kind_name(kind), right ? "right" : "left");
+            log_trace_probe(line_pos, dated ? found_ns : INT64_MAX, target_ns, decision);
+        }
+        estimator_record(&e, right, dated, line_pos, found_ns);
+        if (right) {
+            begin = block_after(mid, line_pos) < end ? block_after(mid, line_pos) : end;
         } else {
             end = mid;
+            if (!dated) {
+                limit = line_pos;
+            }
+        }
+        estimator_narrowed(&e, kind, before, end - begin);
+    }
+    if (prefetching) {
+        // The scan that takes over reads the blocks left
+        for (size_t block = begin > first ? begin - 1 : first; block < end; block++) {
+            prefetch_block(log, &prefetcher, block);
         }
+        prefetch_submit(&prefetcher);
     }
-    if (begin > 0)
+    if (begin > first)
         --begin;
     return begin;
 }
 
 
-int bisect(const char *filename, struct search_range_t range) {
-    int fd = open(filename, O_RDONLY);
-    if (fd < 0) {
+// Maps the whole log read-only. The descriptor is kept so that ranges can
+// be copied to the output without passing through user space.
+int log_open(const char *filename, struct log_file *log) {
+    log_stats.syscalls++;
+    return log_open_fd(filename, open(filename, O_RDONLY), log);
+}
+
+// Maps the log already open on fd, which the log owns from then on, failure
+// included. filename only locates the sidecar index.
+int log_open_fd(const char *filename, int fd, struct log_file *log) {
+    memset(log, 0, sizeof(*log));
+    log->filename = filename;
+
+    log->fd = fd;
+    if (log->fd < 0) {
+        return -1;
+    }
+    log_stats.syscalls++;
+    if (fstat(log->fd, &log->st) < 0) {
+        log_close(log);
         return -1;
     }
-    size_t file_size = lseek(fd, 0, SEEK_END);
-    lseek(fd, 0, SEEK_SET);
+    log->size = log->st.st_size;
+    if (log->size == 0) {
+        return 0;
+    }
 
-    size_t first_block_with_date = lower_bound_block(fd, file_size, range, precise_less);
-    if (first_block_with_date < 0) {
-        close(fd);
+    log_stats.syscalls += 2;
+    log->data = mmap(NULL, log->size, PROT_READ, MAP_PRIVATE, log->fd, 0);
+    if (log->data == MAP_FAILED) {
+        log->data = NULL;
+        log_close(log);
         return -1;
     }
+    posix_madvise((void *)log->data, log->size, POSIX_MADV_RANDOM);
+    return 0;
+}
+
+void log_close(struct log_file *log) {
+    log_cache_free(log);
+    if (log->data) {
+        log_stats.syscalls++;
+        munmap((void *)log->data, log->size);
+        log->data = NULL;
+    }
+    if (log->fd >= 0) {
+        log_stats.syscalls++;
+        close(log->fd);
+        log->fd = -1;
+    }
+}
+
+// Moves entry to the first timestamp on a later line; a second one on its
+// own line is part of the message. Returns false at the end of the file,
+// where the current entry runs up to the last byte.
+bool log_next_entry(const struct log_file *log, struct log_entry *entry) {
+    size_t date_end = entry->offset + entry->date_len;
+    const char *newline = memchr(log->data + date_end, '\n', log->size - date_end);
+    if (newline == NULL) {
+        return false;
+    }
+    size_t next_from = (size_t)(newline - log->data) + 1;
+    size_t date_offset, date_len;
+    if (!scan_date(log->data + next_from, log->size - next_from, &date_offset, &date_len)) {
+        return false;
+    }
+    entry->offset = next_from + date_offset;
+    entry->date_len = date_len;
+    entry->ns = parse_date_ns(log->data + entry->offset, date_len);
+    return true;
+}
+
+// Scans from pos for the first entry at or after start_ns, however long the
+// entries on the way. Returns 1 when found and 0 when there is none.
+static int scan_forward(const struct log_file *log, size_t pos, int64_t start_ns, struct log_entry *entry) {
+    while (pos < log->size) {
+        size_t date_offset, date_len;
+        if (!scan_date(log->data + pos, log->size - pos, &date_offset, &date_len)) {
+            log_stats.bytes_scanned += log->size - pos;
+            return 0;
+        }
+        log_stats.bytes_scanned += date_offset + date_len;
+        pos += date_offset;
+        int64_t ns = parse_date_ns(log->data + pos, date_len);
+        if (ns >= start_ns) {
+            entry->offset = pos;
+            entry->date_len = date_len;
+            entry->ns = ns;
+            return 1;
+        }
+        pos += date_len;
+    }
+    return 0;
+}
 
-    if (first_block_with_date * _BLOCK_SIZE >= file_size) {
-        close(fd);
+// Finds the first entry at or after start_ns, searching from byte offset
+// from on. Returns 1 when found and 0 when there is none.
+static int seek_from(const struct log_file *log, size_t from, int64_t start_ns, struct log_entry *entry) {
+    if (from >= log->size) {
         return 0;
     }
 
-    printout(fd, first_block_with_date * _BLOCK_SIZE, range);
-    close(fd);
+    // A valid sidecar index narrows the search to the span between two
+    // checkpoints; only that span of the log is read.
+    int64_t started = stats_clock();
+    size_t lo = 0;
+    size_t hi = log->size;
+    struct bsx_index index;
+    if (index_open(log, &index)) {
+        bsx_find(&index, start_ns, log->size, &lo, &hi);
+        index_close(log, &index);
+    }
+    if (lo < from) {
+        lo = from;
+    }
+
+    size_t pos = lo;
+    if (hi == log->size) {
+        pos = lower_bound_block(log, lo / _BLOCK_SIZE, log->size / _BLOCK_SIZE, start_ns, key_less) * _BLOCK_SIZE;
+        if (pos < from) {
+            pos = from;
+        }
+    }
+    stats_elapsed(&log_stats.search_ns, started);
+
+    started = stats_clock();
+    int found = scan_forward(log, pos, start_ns, entry);
+    stats_elapsed(&log_stats.align_ns, started);
+    return found;
+}
+
+int log_seek(const struct log_file *log, int64_t start_ns, struct log_entry *entry) {
+    return seek_from(log, 0, start_ns, entry);
+}
+
+// Returns the offset of the line of the first entry after end_ns at or
+// after byte offset from, or the size of the log when there is none.
+size_t log_upper_bound(const struct log_file *log, size_t from, int64_t end_ns) {
+    struct log_entry entry;
+    return seek_from(log, from, end_ns + 1, &entry) > 0 ? line_start(log->data, entry.offset) : log->size;
+}
+
+// Finds the block to scan from for each of count sorted keys within blocks
+// [begin, end), as lower_bound_block() does for one. Each probe is shared by
+// all the keys whose search reaches it. *limit is where the lines without a
+// timestamp at the end of the log start.
+static void bisect_keys(const struct log_file *log, const int64_t *keys, size_t count, size_t begin, size_t end,
+                        size_t *limit, size_t *blocks) {
+    while (count > 0 && end - begin > LINEAR_SCAN_BLOCKS) {
+        size_t mid = (begin + end) / 2;
+        size_t line_pos;
+        int64_t found_ns;
+        bool dated = probe_block(log, mid, *limit, &line_pos, &found_ns);
+        if (!dated) {
+            *limit = line_pos;
+        }
+
+        // Keys up to found_ns continue left of mid, the rest right of it
+        size_t split = 0;
+        while (split < count && (!dated || !key_less(found_ns, keys[split]))) {
+            split++;
+        }
+        if (log_trace_enabled) {
+            char decision[64];
+            snprintf(decision, sizeof(decision), "shared, %zu keys left, %zu right", split, count - split);
+            log_trace_probe(line_pos, dated ? found_ns : INT64_MAX, keys[0], decision);
+        }
+        bisect_keys(log, keys, split, begin, mid, limit, blocks);
+        keys += split;
+        blocks += split;
+        count -= split;
+        begin = block_after(mid, line_pos) < end ? block_after(mid, line_pos) : end;
+    }
+    for (size_t i = 0; i < count; i++) {
+        blocks[i] = begin > 0 ? begin - 1 : 0;
+    }
+}
+
+// Finds the first entry at or after each of count sorted, distinct keys and
+// stores the offset of its line, or the size of the log when there is none.
+int log_seek_many(const struct log_file *log, const int64_t *keys, size_t count, size_t *offsets) {
+    size_t *blocks = malloc(sizeof(size_t) * (count > 0 ? count : 1));
+    if (blocks == NULL) {
+        return -1;
+    }
+
+    struct bsx_index index;
+    bool indexed = index_open(log, &index);
+    size_t limit = log->size;
+    if (!indexed) {
+        bisect_keys(log, keys, count, 0, log->size / _BLOCK_SIZE, &limit, blocks);
+    }
+
+    size_t from = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct log_entry entry;
+        size_t pos;
+        if (indexed) {
+            size_t lo, hi;
+            bsx_find(&index, keys[i], log->size, &lo, &hi);
+            pos = lo;
+        } else {
+            pos = blocks[i] * _BLOCK_SIZE;
+        }
+        // The keys are sorted, so no entry before the last one found can match
+        if (pos < from) {
+            pos = from;
+        }
+        from = scan_forward(log, pos, keys[i], &entry) > 0 ? line_start(log->data, entry.offset) : log->size;
+        offsets[i] = from;
+    }
+
+    if (indexed) {
+        index_close(log, &index);
+    }
+    free(blocks);
     return 0;
 }
 
-void printout(int fd, size_t from, struct search_range_t range) {
-    char buf[_BLOCK_SIZE+1];
-    lseek(fd, from, SEEK_SET);
-    size_t rd = read(fd, buf, _BLOCK_SIZE);
-    buf[rd] = '\0';
+int bisect(const char *filename, struct search_range_t range) {
+    int64_t start_ns = precise_time_to_ns(range.start);
+    int64_t end_ns = precise_time_to_ns(range.end);
 
-    int dt_offset = 0;
-    char date_str[64];
-    int date_len = 0;
-    precise_time_t date;
+    enum compression format = detect_compression(filename);
+    if (format != COMPRESSION_NONE) {
+        // A compressed log can only be read forward
+        return range.reverse ? -1 : compressed_bisect(filename, format, start_ns, end_ns, range.limit);
+    }
 
-    // Do not read more than 2 blocks to find the first date
-    unsigned int blocks_read = 1;
+    struct log_file log;
+    if (log_open(filename, &log) < 0) {
+        return -1;
+    }
 
-    do {
-        int new_dt_offset_rel = find_date_in_buffer(buf + dt_offset + date_len);
-        if (new_dt_offset_rel < 0) {
-            if (blocks_read++ > 1) {
-                return;
-            }
-            size_t remainder_size = sizeof(buf) - 1 - dt_offset;
-            memcpy(buf, buf + dt_offset, remainder_size);
-            int rd = read(fd, buf + remainder_size, sizeof(buf) - remainder_size - 1);
-            if (rd == 0) {
-                return;
-            }
-            buf[remainder_size + rd] = '\0';
-            dt_offset = 0;
-            new_dt_offset_rel = 0;
+    int found;
+    if (range.disorder_ns > 0) {
+        found = printout_disordered(&log, start_ns, end_ns, range.disorder_ns);
+    } else if (range.reverse) {
+        found = printout_reverse(&log, start_ns, end_ns, range.limit);
+    } else {
+        struct log_entry entry;
+        found = log_seek(&log, start_ns, &entry);
+        if (found > 0 && range.limit > 0) {
+            found = printout_limited(&log, entry, end_ns, range.limit) < 0 ? -1 : found;
+        } else if (found > 0 && printout(&log, entry, end_ns) < 0) {
+            found = -1;
+        }
+    }
+
+    log_close(&log);
+    return found < 0 ? -1 : 0;
+}
+
+// Writes the entries from entry up to end_ns as one range of bytes. Only
+// the two boundaries are parsed.
+int printout(const struct log_file *log, struct log_entry entry, int64_t end_ns) {
+    if (entry.ns > end_ns) {
+        return 0;
+    }
+
+    size_t end = log_upper_bound(log, entry.offset, end_ns);
+    return output_range(log, line_start(log->data, entry.offset), end, STDOUT_FILENO);
+}
+
+// Writes at most limit entries from entry on, up to end_ns. The entries are
+// walked rather than the end bisected, so the cost follows the limit and
+// not the size of the range.
+static int printout_limited(const struct log_file *log, struct log_entry entry, int64_t end_ns, size_t limit) {
+    if (entry.ns > end_ns) {
+        return 0;
+    }
+
+    size_t from = line_start(log->data, entry.offset);
+    size_t to = log->size;
+    for (size_t count = 1; log_next_entry(log, &entry); count++) {
+        if (count == limit || entry.ns > end_ns) {
+            to = line_start(log->data, entry.offset);
+            break;
+        }
+    }
+    log_stats.bytes_scanned += to - from;
+    return output_range(log, from, to, STDOUT_FILENO);
+}
+
+// Appends the offsets of the lines of the entries starting within
+// [chunk_from, to) to *starts, in order. chunk_from need not be a line start.
+static int entry_starts(const struct log_file *log, size_t chunk_from, size_t to, size_t **starts, size_t *count,
+                        size_t *capacity) {
+    size_t pos = chunk_from;
+    if (pos > 0 && log->data[pos - 1] != '\n') {
+        const char *newline = memchr(log->data + pos, '\n', to - pos);
+        pos = newline != NULL ? (size_t)(newline - log->data) + 1 : to;
+    }
+    log_stats.bytes_scanned += to - pos;
+    size_t date_offset, date_len;
+    while (pos < to && scan_date(log->data + pos, to - pos, &date_offset, &date_len)) {
+        size_t line = line_start(log->data, pos + date_offset);
+        pos += date_offset + date_len;
+        // A second timestamp on a line starts no entry of its own
+        if (*count > 0 && (*starts)[*count - 1] == line) {
             continue;
         }
-        dt_offset += date_len + new_dt_offset_rel;
-        date_len = extract_date_string(buf, dt_offset, date_str, sizeof(date_str));
-        date = string_to_precise_time(date_str);
-    } while (precise_less(date, range.start));
+        if (*count == *capacity) {
+            *capacity = *capacity > 0 ? *capacity * 2 : 1024;
+            size_t *grown = realloc(*starts, sizeof(size_t) * *capacity);
+            if (grown == NULL) {
+                return -1;
+            }
+            *starts = grown;
+        }
+        (*starts)[(*count)++] = line;
+    }
+    return 0;
+}
 
-    if (dt_offset < 0)
-        return;
+// Writes the entries of [from, to) newest first, at most limit of them (all
+// of them for 0), each with its lines in order; from is the line of an entry.
+// The range is read back to front in aligned chunks: the entries starting in
+// a chunk are found with a forward scan of it and written from the last one
+// back. A chunk holding no entry start is widened.
+static int output_reverse(const struct log_file *log, size_t from, size_t to, size_t limit) {
+    char *buf = malloc(REVERSE_OUTPUT_SIZE);
+    if (buf == NULL) {
+        return -1;
+    }
+    size_t *starts = NULL;
+    size_t capacity = 0;
 
-    while (precise_less_equal(date, range.end)) {
-        int new_dt_offset_rel = find_date_in_buffer(buf + dt_offset + date_len);
-        if (new_dt_offset_rel >= 0) {
-            int new_dt_offset = new_dt_offset_rel + dt_offset + date_len;
-            date_len = extract_date_string(buf, new_dt_offset, date_str, sizeof(date_str));
-            date = string_to_precise_time(date_str);
-            write(STDOUT_FILENO, buf + dt_offset, new_dt_offset - dt_offset);
-            dt_offset = new_dt_offset;
-        } else {
-            size_t remainder_size = sizeof(buf) - 1 - dt_offset;
-            memcpy(buf, buf + dt_offset, remainder_size);
-            int rd = read(fd, buf + remainder_size, sizeof(buf) - remainder_size - 1);
-            buf[remainder_size + rd] = '\0';
-            dt_offset = find_date_in_buffer(buf + date_len);
-            if (dt_offset < 0 ) {
+    size_t len = 0;
+    size_t written = 0;
+    size_t end = to;    // the entries from here on are written
+    int result = 0;
+    while (result == 0 && end > from && (limit == 0 || written < limit)) {
+        size_t count = 0;
+        size_t chunk = REVERSE_CHUNK;
+        for (;;) {
+            size_t chunk_from = (end - 1) / chunk * chunk;
+            chunk_from = chunk_from > from ? chunk_from : from;
+            advise_willneed(log, chunk_from, end);
+            if (entry_starts(log, chunk_from, end, &starts, &count, &capacity) < 0) {
+                result = -1;
+                break;
+            }
+            if (count > 0 || chunk_from == from) {
                 break;
             }
-            date_len = extract_date_string(buf, dt_offset, date_str, sizeof(date_str));
-            date = string_to_precise_time(date_str);
-            write(STDOUT_FILENO, buf, dt_offset);
+            chunk *= 2;
         }
+
+        for (size_t i = count; result == 0 && i-- > 0 && (limit == 0 || written < limit);) {
+            size_t entry_len = end - starts[i];
+            if (len > 0 && len + entry_len > REVERSE_OUTPUT_SIZE) {
+                result = write_all(STDOUT_FILENO, buf, len);
+                len = 0;
+            }
+            if (result == 0 && entry_len > REVERSE_OUTPUT_SIZE) {
+                result = write_all(STDOUT_FILENO, log->data + starts[i], entry_len);
+            } else if (result == 0) {
+                memcpy(buf + len, log->data + starts[i], entry_len);
+                len += entry_len;
+            }
+            written++;
+            end = starts[i];
+        }
+        // Lines before the first timestamp of the log belong to no entry
+        if (count == 0) {
+            break;
+        }
+    }
+    if (result == 0 && len > 0) {
+        result = write_all(STDOUT_FILENO, buf, len);
+    }
+    free(starts);
+    free(buf);
+    return result;
+}
+
+// Writes the range newest first, at most limit entries of it. Both ends are
+// bisected; the walk back from the end then stops after limit entries, so
+// the cost follows the limit and not the size of the range. Returns 1 when
+// something was searched, 0 when the range is past the end and -1 on error.
+static int printout_reverse(const struct log_file *log, int64_t start_ns, int64_t end_ns, size_t limit) {
+    struct log_entry entry;
+    int found = log_seek(log, start_ns, &entry);
+    if (found <= 0 || entry.ns > end_ns) {
+        return found;
+    }
+    size_t from = line_start(log->data, entry.offset);
+    size_t to = log_upper_bound(log, from, end_ns);
+    return output_reverse(log, from, to, limit) < 0 ? -1 : 1;
+}
+
+// Writes the entries of [from, to) whose own timestamp is within [start_ns,
+// end_ns]; from is the offset of an entry. Runs of such entries are written
+// as one range.
+static int output_matching(const struct log_file *log, size_t from, size_t to, int64_t start_ns, int64_t end_ns) {
+    struct log_entry entry;
+    size_t date_offset;
+    if (from >= to || !scan_date(log->data + from, to - from, &date_offset, &entry.date_len)) {
+        return 0;
+    }
+    entry.offset = from + date_offset;
+    entry.ns = parse_date_ns(log->data + entry.offset, entry.date_len);
+    log_stats.bytes_scanned += to - from;
+
+    size_t run = SIZE_MAX;  // start of the matching entries not written yet
+    bool more = true;
+    while (more) {
+        size_t pos = line_start(log->data, entry.offset);
+        bool match = entry.ns >= start_ns && entry.ns <= end_ns;
+        more = log_next_entry(log, &entry) && entry.offset < to;
+        if (match && run == SIZE_MAX) {
+            run = pos;
+        } else if (!match && run != SIZE_MAX) {
+            if (output_range(log, run, pos, STDOUT_FILENO) < 0) {
+                return -1;
+            }
+            run = SIZE_MAX;
+        }
+    }
+    return run != SIZE_MAX ? output_range(log, run, to, STDOUT_FILENO) : 0;
+}
+
+// Writes the range from a log whose timestamps may run up to disorder_ns
+// behind those of earlier lines. Bisection still holds with the keys widened
+// by the tolerance: nothing before the first entry at or after
+// start - disorder can be in the range, nor anything from the first entry
+// after end + disorder on. Between the first entry at or after
+// start + disorder and the first one after end - disorder every entry is in
+// the range, so that span is written in bulk and only the two edges are
+// filtered entry by entry. Returns 1 when something was searched, 0 when the
+// range is past the end and -1 on error.
+static int printout_disordered(const struct log_file *log, int64_t start_ns, int64_t end_ns, int64_t disorder_ns) {
+    struct log_entry entry;
+    int found = log_seek(log, start_ns - disorder_ns, &entry);
+    if (found <= 0) {
+        return found;
+    }
+    size_t first = line_start(log->data, entry.offset);
+    size_t last = log_upper_bound(log, first, end_ns + disorder_ns);
+
+    // Clamped, since out-of-order probes need not agree with each other
+    size_t bulk_from = log_upper_bound(log, first, start_ns + disorder_ns - 1);
+    bulk_from = bulk_from < last ? bulk_from : last;
+    size_t bulk_to = log_upper_bound(log, bulk_from, end_ns - disorder_ns);
+    bulk_to = bulk_to < last ? bulk_to : last;
+
+    if (output_matching(log, first, bulk_from, start_ns, end_ns) < 0 ||
+        output_range(log, bulk_from, bulk_to, STDOUT_FILENO) < 0 ||
+        output_matching(log, bulk_to, last, start_ns, end_ns) < 0) {
+        return -1;
     }
+    return 1;
 }
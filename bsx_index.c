@@ -0,0 +1,387 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include "win.h"
+#else
+#include <sys/mman.h>
+#endif
+
+#include "bisect.h"
+#include "bsx_index.h"
+#include "date_scan.h"
+#include "precise_time.h"
+
+#define BSX_MAGIC "BSX1"
+#define BSX_VERSION 3
+// Two varints of at most 10 bytes each
+#define BSX_MAX_ENTRY_SIZE 20
+// A lookup binary searches the restart points, then decodes at most this
+// many checkpoints
+#define BSX_RESTART_EVERY 64
+
+
+static void bsx_path(const char *log_path, char *path, size_t len) {
+    snprintf(path, len, "%s%s", log_path, BSX_SUFFIX);
+}
+
+static int64_t mtime_ns(const struct stat *st) {
+#if defined(_WIN32) || defined(_WIN64)
+    return (int64_t)st->st_mtime * NS_PER_SECOND;
+#else
+    return (int64_t)st->st_mtim.tv_sec * NS_PER_SECOND + st->st_mtim.tv_nsec;
+#endif
+}
+
+static size_t put_varint(uint8_t *out, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+static const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint64_t *value) {
+    uint64_t result = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t byte = *p++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Timestamp deltas may be negative when a log is slightly out of order
+static uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// A checkpoint still holds if the log has the same timestamp at its offset
+static bool checkpoint_holds(const char *log_data, size_t log_size, uint64_t offset, int64_t ns) {
+    if (log_data == NULL || offset >= log_size) {
+        return false;
+    }
+    size_t len = match_date(log_data + offset, log_size - offset);
+    return len > 0 && parse_date_ns(log_data + offset, len) == ns;
+}
+
+// Records how the timestamps of the log are parsed now
+static void header_format(struct bsx_header *header) {
+    header->format = date_format_get();
+    snprintf(header->json_field, sizeof(header->json_field), "%s", date_format_json_field());
+    local_zone_describe(header->zone, sizeof(header->zone));
+}
+
+// Whether the checkpoints in the header still describe a prefix of the log,
+// as its timestamps are parsed now
+static bool header_covers(const struct bsx_header *header, const char *log_data, const struct stat *log_st) {
+    if (memcmp(header->magic, BSX_MAGIC, sizeof(header->magic)) != 0 || header->version != BSX_VERSION) {
+        return false;
+    }
+    struct bsx_header expected = {0};
+    header_format(&expected);
+    if (header->format != expected.format ||
+        strncmp(header->json_field, expected.json_field, sizeof(header->json_field)) != 0 ||
+        strncmp(header->zone, expected.zone, sizeof(header->zone)) != 0) {
+        return false;
+    }
+    if (header->inode != (uint64_t)log_st->st_ino || header->log_size > (uint64_t)log_st->st_size) {
+        return false;
+    }
+    if (header->log_size == (uint64_t)log_st->st_size && header->log_mtime_ns == mtime_ns(log_st)) {
+        return true;
+    }
+    // The log was modified since: trust the index only if it has just grown
+    return header->count == 0 ||
+           checkpoint_holds(log_data, log_st->st_size, header->last_offset, header->last_ns);
+}
+
+static uint64_t restart_count(uint64_t count) {
+    return (count + BSX_RESTART_EVERY - 1) / BSX_RESTART_EVERY;
+}
+
+// The checkpoints of an index being built, kept in memory until the whole
+// index is written out
+struct bsx_table {
+    struct bsx_header header;
+    struct bsx_restart *restarts;
+    size_t restart_capacity;
+    uint8_t *deltas;
+    size_t delta_capacity;
+};
+
+static void *grow(void *items, size_t *capacity, size_t needed, size_t item_size) {
+    if (needed <= *capacity) {
+        return items;
+    }
+    size_t capacity_new = *capacity > 0 ? *capacity * 2 : 256;
+    while (capacity_new < needed) {
+        capacity_new *= 2;
+    }
+    void *items_new = realloc(items, capacity_new * item_size);
+    if (items_new != NULL) {
+        *capacity = capacity_new;
+    }
+    return items_new;
+}
+
+static int table_add(struct bsx_table *table, uint64_t offset, int64_t ns) {
+    struct bsx_header *header = &table->header;
+    if (header->count % BSX_RESTART_EVERY == 0) {
+        size_t n = restart_count(header->count);
+        struct bsx_restart *restarts = grow(table->restarts, &table->restart_capacity, n + 1, sizeof(*restarts));
+        if (restarts == NULL) {
+            return -1;
+        }
+        table->restarts = restarts;
+        restarts[n] = (struct bsx_restart){offset, ns, header->delta_size};
+    } else {
+        uint8_t *deltas = grow(table->deltas, &table->delta_capacity, header->delta_size + BSX_MAX_ENTRY_SIZE, 1);
+        if (deltas == NULL) {
+            return -1;
+        }
+        table->deltas = deltas;
+        uint8_t *entry = deltas + header->delta_size;
+        size_t n = put_varint(entry, offset - header->last_offset);
+        n += put_varint(entry + n, zigzag(ns - header->last_ns));
+        header->delta_size += n;
+    }
+    header->count++;
+    header->last_offset = offset;
+    header->last_ns = ns;
+    return 0;
+}
+
+// Starts the table from the existing index of log_path when it still covers
+// a prefix of the log at the same interval, so only the rest is scanned
+static int table_load(struct bsx_table *table, const char *log_path, const char *log_data,
+                      const struct stat *log_st, size_t interval) {
+    struct bsx_index index;
+    if (bsx_open(log_path, log_data, log_st, &index) < 0) {
+        return 0;
+    }
+    int result = 0;
+    if (index.header->interval == interval) {
+        size_t restarts = restart_count(index.header->count);
+        table->restarts = grow(NULL, &table->restart_capacity, restarts + 1, sizeof(struct bsx_restart));
+        table->deltas = grow(NULL, &table->delta_capacity, index.header->delta_size + BSX_MAX_ENTRY_SIZE, 1);
+        if (table->restarts == NULL || table->deltas == NULL) {
+            result = -1;
+        } else {
+            table->header = *index.header;
+            memcpy(table->restarts, index.restarts, restarts * sizeof(struct bsx_restart));
+            memcpy(table->deltas, index.deltas, index.header->delta_size);
+        }
+    }
+    bsx_close(&index);
+    return result;
+}
+
+// Writes the index for log_path, or extends the existing one when the log
+// has only grown since it was built. Either way the index is written whole
+// to a temporary file and renamed over the old one, so an interrupted build
+// leaves the previous index intact and readers never see it change.
+int bsx_build(const char *log_path, size_t interval) {
+    int fd = open(log_path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    size_t log_size = st.st_size;
+    const char *log_data = NULL;
+    if (log_size > 0) {
+        log_data = mmap(NULL, log_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (log_data == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        // Only a page or two around every checkpoint is read
+        posix_madvise((void *)log_data, log_size, POSIX_MADV_RANDOM);
+    }
+    close(fd);
+
+    char path[MAX_PATH_LENGTH];
+    char tmp_path[MAX_PATH_LENGTH + 4];
+    bsx_path(log_path, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    struct bsx_table table = {0};
+    int result = log_data != NULL ? table_load(&table, log_path, log_data, &st, interval) : 0;
+    struct bsx_header *header = &table.header;
+    if (header->count == 0) {
+        memset(header, 0, sizeof(*header));
+        memcpy(header->magic, BSX_MAGIC, sizeof(header->magic));
+        header->version = BSX_VERSION;
+        header->interval = interval;
+        header_format(header);
+    }
+
+    size_t pos = header->count > 0 ? header->last_offset + interval : 0;
+    while (result == 0 && pos < log_size) {
+        size_t limit = log_size - pos < interval ? log_size - pos : interval;
+        size_t date_offset, date_len;
+        if (!scan_date(log_data + pos, limit, &date_offset, &date_len)) {
+            pos += interval;
+            continue;
+        }
+        size_t offset = pos + date_offset;
+        // The last line may still be in the middle of being written
+        if (offset + date_len >= log_size) {
+            break;
+        }
+        int64_t ns = parse_date_ns(log_data + offset, date_len);
+        if (ns == PRECISE_NS_INVALID) {
+            pos = offset + date_len;
+            continue;
+        }
+        result = table_add(&table, offset, ns);
+        pos = offset + interval;
+    }
+
+    header->inode = st.st_ino;
+    header->log_size = log_size;
+    header->log_mtime_ns = mtime_ns(&st);
+
+    FILE *out = result == 0 ? fopen(tmp_path, "wb") : NULL;
+    if (out != NULL) {
+        fwrite(header, sizeof(*header), 1, out);
+        fwrite(table.restarts, sizeof(struct bsx_restart), restart_count(header->count), out);
+        fwrite(table.deltas, 1, header->delta_size, out);
+        result = ferror(out) ? -1 : 0;
+        if (fclose(out) != 0) {
+            result = -1;
+        }
+        if (result == 0 && rename(tmp_path, path) != 0) {
+            result = -1;
+        }
+        if (result != 0) {
+            unlink(tmp_path);
+        }
+    } else {
+        result = -1;
+    }
+
+    free(table.restarts);
+    free(table.deltas);
+    if (log_data) {
+        munmap((void *)log_data, log_size);
+    }
+    return result;
+}
+
+// Maps the index next to the log. Returns -1 when there is none, when it no
+// longer matches the log's inode, size and mtime or the way its timestamps
+// are parsed, or when it is cut short.
+int bsx_open(const char *log_path, const char *log_data, const struct stat *log_st, struct bsx_index *index) {
+    char path[MAX_PATH_LENGTH];
+    bsx_path(log_path, path, sizeof(path));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct bsx_header)) {
+        close(fd);
+        return -1;
+    }
+    index->size = st.st_size;
+    index->data = mmap(NULL, index->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (index->data == MAP_FAILED) {
+        return -1;
+    }
+    index->header = (const struct bsx_header *)index->data;
+
+    if (!header_covers(index->header, log_data, log_st)) {
+        bsx_close(index);
+        return -1;
+    }
+    size_t body = index->size - sizeof(struct bsx_header);
+    uint64_t restarts = restart_count(index->header->count);
+    if (restarts > body / sizeof(struct bsx_restart) ||
+        index->header->delta_size != body - restarts * sizeof(struct bsx_restart)) {
+        bsx_close(index);
+        return -1;
+    }
+    index->restarts = (const struct bsx_restart *)(index->data + sizeof(struct bsx_header));
+    index->deltas = (const uint8_t *)(index->restarts + restarts);
+    return 0;
+}
+
+// Narrows the search for target_ns to [lo, hi): lo is the offset of the last
+// checkpoint before the target and hi that of the first one at or after it.
+// Past the last checkpoint hi is the end of the log.
+void bsx_find(const struct bsx_index *index, int64_t target_ns, size_t log_size, size_t *lo, size_t *hi) {
+    *lo = 0;
+    *hi = log_size;
+
+    // The first restart point at or after the target
+    const struct bsx_header *header = index->header;
+    size_t restarts = restart_count(header->count);
+    size_t low = 0, high = restarts;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (index->restarts[mid].ns < target_ns) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low < restarts) {
+        *hi = index->restarts[low].offset;
+    }
+    if (low == 0) {
+        return;
+    }
+
+    // The checkpoints after the restart point before it narrow the interval
+    const struct bsx_restart *restart = &index->restarts[low - 1];
+    *lo = restart->offset;
+    if (restart->delta_pos > header->delta_size) {
+        return;
+    }
+    const uint8_t *p = index->deltas + restart->delta_pos;
+    const uint8_t *end = index->deltas + header->delta_size;
+    uint64_t offset = restart->offset;
+    int64_t ns = restart->ns;
+    uint64_t first = (low - 1) * (uint64_t)BSX_RESTART_EVERY;
+    uint64_t last = first + BSX_RESTART_EVERY < header->count ? first + BSX_RESTART_EVERY : header->count;
+    for (uint64_t i = first + 1; i < last; i++) {
+        uint64_t offset_delta, ns_delta;
+        if ((p = get_varint(p, end, &offset_delta)) == NULL ||
+            (p = get_varint(p, end, &ns_delta)) == NULL) {
+            return;
+        }
+        offset += offset_delta;
+        ns += unzigzag(ns_delta);
+        if (ns >= target_ns) {
+            *hi = offset;
+            return;
+        }
+        *lo = offset;
+    }
+}
+
+void bsx_close(struct bsx_index *index) {
+    munmap((void *)index->data, index->size);
+    index->data = NULL;
+    index->header = NULL;
+}
@@ -0,0 +1,56 @@
+#ifndef BSX_INDEX_H
+#define BSX_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#include "date_scan.h"
+
+#define BSX_SUFFIX ".bsx"
+#define BSX_DEFAULT_INTERVAL (64 * 1024)
+#define BSX_ZONE_SIZE 64
+
+// Sidecar index next to a log: sorted (byte offset, timestamp) checkpoints,
+// taken every `interval` bytes. Every BSX_RESTART_EVERY-th checkpoint is a
+// restart point stored whole after the header; the checkpoints between them
+// follow as varint deltas. The timestamps depend on the format, JSON field
+// and local time rules they were parsed with, so an index built under others
+// is stale.
+struct bsx_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t interval;
+    uint64_t inode;
+    uint64_t log_size;      // bytes of the log covered by the checkpoints
+    int64_t log_mtime_ns;
+    uint64_t count;
+    uint64_t last_offset;   // last checkpoint, so appends continue the delta chain
+    int64_t last_ns;
+    uint64_t delta_size;    // bytes of deltas after the restart points
+    uint32_t format;
+    char json_field[JSON_FIELD_MAX + 1];
+    char zone[BSX_ZONE_SIZE];   // from local_zone_describe()
+};
+
+struct bsx_restart {
+    uint64_t offset;
+    int64_t ns;
+    uint64_t delta_pos;     // where the deltas of the checkpoints after it start
+};
+
+struct bsx_index {
+    const uint8_t *data;
+    size_t size;
+    const struct bsx_header *header;
+    const struct bsx_restart *restarts;
+    const uint8_t *deltas;
+};
+
+int bsx_build(const char *log_path, size_t interval);
+int bsx_open(const char *log_path, const char *log_data, const struct stat *log_st, struct bsx_index *index);
+void bsx_find(const struct bsx_index *index, int64_t target_ns, size_t log_size, size_t *lo, size_t *hi);
+void bsx_close(struct bsx_index *index);
+
+#endif // BSX_INDEX_H
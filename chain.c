@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include "win.h"
+#endif
+
+#include "bisect.h"
+#include "bsx_index.h"
+#include "compressed.h"
+#include "date_scan.h"
+#include "precise_time.h"
+
+// Bounds of the files of a chain, kept next to its shortest name
+#define CHAIN_SUFFIX ".bsc"
+#define CHAIN_MAGIC "BSC1"
+// Bytes at the end of a file scanned first for its last timestamp
+#define CHAIN_TAIL_WINDOW 4096
+
+struct chain_file {
+    const char *path;
+    struct stat st;
+    int64_t first_ns;
+    int64_t last_ns;
+    bool known;     // bounds read or taken from the cache
+    bool dated;     // holds a timestamp at all
+};
+
+// A file's bounds stay valid while its inode, size and mtime do, which
+// survives the renames of a rotation
+struct chain_entry {
+    uint64_t dev;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t first_ns;
+    int64_t last_ns;
+};
+
+struct chain_header {
+    char magic[4];
+    uint32_t format;
+    char json_field[JSON_FIELD_MAX + 1];
+    uint64_t count;
+};
+
+static int64_t mtime_ns(const struct stat *st) {
+#if defined(_WIN32) || defined(_WIN64)
+    return (int64_t)st->st_mtime * NS_PER_SECOND;
+#else
+    return (int64_t)st->st_mtim.tv_sec * NS_PER_SECOND + st->st_mtim.tv_nsec;
+#endif
+}
+
+static bool entry_matches(const struct chain_entry *entry, const struct stat *st) {
+    return entry->dev == (uint64_t)st->st_dev && entry->inode == (uint64_t)st->st_ino &&
+           entry->size == (uint64_t)st->st_size && entry->mtime_ns == mtime_ns(st);
+}
+
+static int compare_files(const void *a, const void *b) {
+    const struct chain_file *x = a;
+    const struct chain_file *y = b;
+    if (x->first_ns != y->first_ns) {
+        return (x->first_ns > y->first_ns) - (x->first_ns < y->first_ns);
+    }
+    return (x->last_ns > y->last_ns) - (x->last_ns < y->last_ns);
+}
+
+// Whether name is base itself or a rotation of it: base followed by '.' or
+// '-' and digits (a number or a date), then optionally ".gz" or ".zst"
+static bool is_rotation(const char *name, const char *base) {
+    size_t base_len = strlen(base);
+    if (strncmp(name, base, base_len) != 0) {
+        return false;
+    }
+    const char *p = name + base_len;
+    if (*p == '\0') {
+        return true;
+    }
+    if (*p != '.' && *p != '-') {
+        return false;
+    }
+    const char *digits = ++p;
+    while (*p >= '0' && *p <= '9') {
+        p++;
+    }
+    return p > digits && (*p == '\0' || strcmp(p, ".gz") == 0 || strcmp(p, ".zst") == 0);
+}
+
+static bool has_suffix(const char *name, const char *suffix) {
+    size_t len = strlen(name);
+    size_t suffix_len = strlen(suffix);
+    return len >= suffix_len && strcmp(name + len - suffix_len, suffix) == 0;
+}
+
+// Sidecar files a glob over a chain picks up along with the logs
+static bool is_sidecar(const char *name) {
+    return has_suffix(name, CHAIN_SUFFIX) || has_suffix(name, BSX_SUFFIX) || has_suffix(name, GZX_SUFFIX) ||
+           has_suffix(name, ".tmp");
+}
+
+// Lists base and its rotations in base's directory
+static int expand_chain(const char *base, char ***paths, size_t *count) {
+    char dir[PATH_MAX];
+    const char *slash = strrchr(base, '/');
+    size_t dir_len = slash != NULL ? (size_t)(slash - base) : 0;
+    snprintf(dir, sizeof(dir), "%.*s", (int)dir_len, base);
+    const char *name = slash != NULL ? slash + 1 : base;
+
+    DIR *d = opendir(slash != NULL ? (dir_len > 0 ? dir : "/") : ".");
+    if (d == NULL) {
+        return -1;
+    }
+    size_t capacity = 16;
+    *paths = malloc(sizeof(char *) * capacity);
+    *count = 0;
+    int result = *paths != NULL ? 0 : -1;
+    struct dirent *de;
+    while (result == 0 && (de = readdir(d)) != NULL) {
+        if (!is_rotation(de->d_name, name)) {
+            continue;
+        }
+        if (*count == capacity) {
+            capacity *= 2;
+            char **grown = realloc(*paths, sizeof(char *) * capacity);
+            if (grown == NULL) {
+                result = -1;
+                break;
+            }
+            *paths = grown;
+        }
+        size_t len = dir_len + 1 + strlen(de->d_name) + 1;
+        char *path = malloc(len);
+        if (path == NULL) {
+            result = -1;
+            break;
+        }
+        snprintf(path, len, "%.*s%s%s", (int)dir_len, base, slash != NULL ? "/" : "", de->d_name);
+        (*paths)[(*count)++] = path;
+    }
+    closedir(d);
+    return result;
+}
+
+// The first and last timestamps of an uncompressed log: a scan of its head,
+// then of ever larger windows of its tail. Returns 1 when found, 0 when the
+// log holds no timestamp and -1 when it cannot be read.
+static int plain_bounds(const char *path, int64_t *first_ns, int64_t *last_ns) {
+    struct log_file log;
+    if (log_open(path, &log) < 0) {
+        return -1;
+    }
+    size_t offset, date_len;
+    int found = 0;
+    if (log.size > 0 && scan_date(log.data, log.size, &offset, &date_len)) {
+        *first_ns = parse_date_ns(log.data + offset, date_len);
+        size_t first = offset;
+        // The window reaches the first timestamp at the latest
+        for (size_t window = CHAIN_TAIL_WINDOW; !found; window *= 2) {
+            size_t pos = log.size > window && log.size - window > first ? log.size - window : first;
+            size_t last = 0;
+            size_t last_len = 0;
+            while (scan_date(log.data + pos, log.size - pos, &offset, &date_len)) {
+                last = pos + offset;
+                last_len = date_len;
+                pos = last + date_len;
+                found = 1;
+            }
+            if (found) {
+                *last_ns = parse_date_ns(log.data + last, last_len);
+            }
+        }
+    }
+    log_close(&log);
+    return found;
+}
+
+static int file_bounds(struct chain_file *file) {
+    file->known = true;
+    enum compression format = detect_compression(file->path);
+    if (format == COMPRESSION_NONE) {
+        int found = plain_bounds(file->path, &file->first_ns, &file->last_ns);
+        file->dated = found > 0;
+        return found < 0 ? -1 : 0;
+    }
+    file->dated = compressed_bounds(file->path, format, &file->first_ns, &file->last_ns) == 0;
+    return 0;
+}
+
+static void cache_path(const struct chain_file *files, size_t count, char *path, size_t len) {
+    const char *shortest = files[0].path;
+    for (size_t i = 1; i < count; i++) {
+        if (strlen(files[i].path) < strlen(shortest) ||
+            (strlen(files[i].path) == strlen(shortest) && strcmp(files[i].path, shortest) < 0)) {
+            shortest = files[i].path;
+        }
+    }
+    snprintf(path, len, "%s%s", shortest, CHAIN_SUFFIX);
+}
+
+static void cache_header(struct chain_header *header, size_t count) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, CHAIN_MAGIC, sizeof(header->magic));
+    header->format = date_format_get();
+    snprintf(header->json_field, sizeof(header->json_field), "%s", date_format_json_field());
+    header->count = count;
+}
+
+// Takes the bounds of every file the cache holds, unchanged, for the
+// current timestamp format
+static void cache_load(const char *path, struct chain_file *files, size_t count) {
+    FILE *in = fopen(path, "rb");
+    if (in == NULL) {
+        return;
+    }
+    struct chain_header header, expected;
+    cache_header(&expected, 0);
+    if (fread(&header, sizeof(header), 1, in) == 1 && memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0 &&
+        header.format == expected.format &&
+        memcmp(header.json_field, expected.json_field, sizeof(header.json_field)) == 0) {
+        struct chain_entry entry;
+        for (uint64_t i = 0; i < header.count && fread(&entry, sizeof(entry), 1, in) == 1; i++) {
+            for (size_t j = 0; j < count; j++) {
+                if (entry_matches(&entry, &files[j].st)) {
+                    files[j].first_ns = entry.first_ns;
+                    files[j].last_ns = entry.last_ns;
+                    files[j].dated = entry.first_ns != PRECISE_NS_INVALID;
+                    files[j].known = true;
+                }
+            }
+        }
+    }
+    fclose(in);
+}
+
+// The cache only saves reads: failing to write it is not an error
+static void cache_save(const char *path, const struct chain_file *files, size_t count) {
+    char tmp_path[PATH_MAX + 4];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *out = fopen(tmp_path, "wb");
+    if (out == NULL) {
+        return;
+    }
+    struct chain_header header;
+    cache_header(&header, count);
+    fwrite(&header, sizeof(header), 1, out);
+    for (size_t i = 0; i < count; i++) {
+        struct chain_entry entry = {
+            .dev = files[i].st.st_dev,
+            .inode = files[i].st.st_ino,
+            .size = files[i].st.st_size,
+            .mtime_ns = mtime_ns(&files[i].st),
+            .first_ns = files[i].dated ? files[i].first_ns : PRECISE_NS_INVALID,
+            .last_ns = files[i].dated ? files[i].last_ns : PRECISE_NS_INVALID,
+        };
+        fwrite(&entry, sizeof(entry), 1, out);
+    }
+    bool failed = ferror(out);
+    if (fclose(out) != 0 || failed || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+    }
+}
+
+// Reads the bounds of every file, from the cache where it is current, and
+// sorts the files with a timestamp by them
+static int chain_bounds(struct chain_file *files, size_t *count) {
+    for (size_t i = 0; i < *count; i++) {
+        if (stat(files[i].path, &files[i].st) < 0) {
+            return -1;
+        }
+    }
+    char path[PATH_MAX];
+    cache_path(files, *count, path, sizeof(path));
+    cache_load(path, files, *count);
+
+    bool changed = false;
+    for (size_t i = 0; i < *count; i++) {
+        if (files[i].known) {
+            continue;
+        }
+        if (file_bounds(&files[i]) < 0) {
+            fprintf(stderr, "Error: could not read '%s'\n", files[i].path);
+            return -1;
+        }
+        changed = true;
+    }
+    if (changed) {
+        cache_save(path, files, *count);
+    }
+
+    size_t dated = 0;
+    for (size_t i = 0; i < *count; i++) {
+        if (files[i].dated) {
+            files[dated++] = files[i];
+        }
+    }
+    *count = dated;
+    qsort(files, dated, sizeof(struct chain_file), compare_files);
+    return 0;
+}
+
+// Searches a chain of rotated logs as one log. A single name stands for
+// itself and its rotations next to it (app.log, app.log.1, app.log.2.gz,
+// app.log-20250601). The files are ordered by their first and last
+// timestamps, which are cached, and binary searched for the first and last
+// one the range touches; only those are opened, and their entries are
+// written in order. Files overlapping in time are merged instead. Sidecar
+// files among the names, as a glob over the chain lists them, are skipped.
+int bisect_chain(const char **filenames, size_t count, struct search_range_t range, int jobs) {
+    int64_t start_ns = precise_time_to_ns(range.start);
+    int64_t end_ns = precise_time_to_ns(range.end);
+
+    char **expanded = NULL;
+    size_t expanded_count = 0;
+    if (count == 1) {
+        if (expand_chain(filenames[0], &expanded, &expanded_count) < 0) {
+            for (size_t i = 0; i < expanded_count; i++) {
+                free(expanded[i]);
+            }
+            free(expanded);
+            return -1;
+        }
+        filenames = (const char **)expanded;
+        count = expanded_count;
+    }
+
+    struct chain_file *files = calloc(count > 0 ? count : 1, sizeof(struct chain_file));
+    int result = files != NULL ? 0 : -1;
+    size_t dated = 0;
+    for (size_t i = 0; result == 0 && i < count; i++) {
+        if (!is_sidecar(filenames[i])) {
+            files[dated++].path = filenames[i];
+        }
+    }
+    if (result == 0 && dated > 0) {
+        result = chain_bounds(files, &dated);
+    }
+
+    bool overlapping = false;
+    for (size_t i = 1; result == 0 && i < dated; i++) {
+        overlapping |= files[i - 1].last_ns > files[i].first_ns;
+    }
+    if (result == 0 && overlapping) {
+        const char **paths = malloc(sizeof(char *) * dated);
+        result = paths != NULL ? 0 : -1;
+        for (size_t i = 0; result == 0 && i < dated; i++) {
+            paths[i] = files[i].path;
+        }
+        if (result == 0) {
+            result = bisect_merge(paths, dated, range, jobs);
+        }
+        free(paths);
+    } else if (result == 0) {
+        // The first file ending at or after start_ns, then the first one
+        // starting after end_ns
+        size_t begin = 0;
+        size_t end = dated;
+        while (begin < end) {
+            size_t mid = (begin + end) / 2;
+            if (files[mid].last_ns < start_ns) {
+                begin = mid + 1;
+            } else {
+                end = mid;
+            }
+        }
+        end = dated;
+        for (size_t low = begin; low < end;) {
+            size_t mid = (low + end) / 2;
+            if (files[mid].first_ns <= end_ns) {
+                low = mid + 1;
+            } else {
+                end = mid;
+            }
+        }
+        for (size_t i = begin; result == 0 && i < end; i++) {
+            result = bisect(files[i].path, range);
+        }
+    }
+
+    free(files);
+    for (size_t i = 0; i < expanded_count; i++) {
+        free(expanded[i]);
+    }
+    free(expanded);
+    return result;
+}
@@ -0,0 +1,921 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#if defined(_WIN32) || defined(_WIN64)
+#include "win.h"
+#endif
+
+#include "bisect.h"
+#include "compressed.h"
+#include "date_scan.h"
+#include "precise_time.h"
+
+// Decompressed bytes read in one step, and at most per probe while looking
+// for the first timestamp after an access point.
+#define STREAM_CHUNK (256 * 1024)
+#define PROBE_STEP (16 * 1024)
+#define PROBE_LIMIT (1024 * 1024)
+
+// gzip: a new access point every GZ_SPAN decompressed bytes, each carrying
+// the 32 KB of history deflate needs to resume there.
+#define GZ_SPAN (1024 * 1024)
+#define GZ_WINDOW_SIZE 32768
+#define GZX_MAGIC "BGZ1"
+
+// Seekable zstd: the seek table is a skippable frame ending in this footer
+#define ZSTD_SEEKABLE_MAGIC 0x8F92EAB1u
+#define ZSTD_SEEKABLE_FOOTER_SIZE 9
+
+// A position from which decompression can start without the data before it
+struct access_point {
+    uint64_t out;            // offset in the decompressed stream
+    uint64_t in;             // offset of the first compressed byte to read
+    int bits;                // gzip: bits of the byte before `in` that belong to the point
+    unsigned char *window;   // gzip: deflated history, NULL at the start of the file
+    size_t window_len;
+};
+
+struct compressed_log {
+    int fd;
+    enum compression format;
+    struct stat st;
+    struct access_point *points;
+    size_t count;
+};
+
+// Sequential decompression starting at one access point
+struct cstream {
+    const struct compressed_log *log;
+    uint64_t in;
+    unsigned char *input;
+#ifdef HAVE_ZLIB
+    z_stream z;
+    bool raw;        // inflating raw deflate data that started at an access point
+    size_t skip;     // bytes of a gzip trailer still to skip
+    bool ended;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx *dctx;
+    ZSTD_inBuffer zin;
+#endif
+};
+
+// Entries in range are filtered out of the decompressed stream as it arrives
+struct range_filter {
+    char *buf;
+    size_t len;
+    size_t capacity;
+    size_t cur;          // offset of the current entry's line, SIZE_MAX before the first one
+    int64_t cur_ns;
+    size_t scanned;      // no timestamp starts before this offset after cur
+    bool in_line;        // scanned is within a line whose entry is already known
+    bool emitting;
+    bool done;
+    int64_t start_ns;
+    int64_t end_ns;
+    size_t limit;        // entries still to write, 0 for all of them
+    size_t pending_from; // entries in range not written yet: [pending_from, pending_to)
+    size_t pending_to;
+};
+
+
+enum compression detect_compression(const char *filename) {
+    unsigned char magic[4];
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return COMPRESSION_NONE;
+    }
+    ssize_t n = read(fd, magic, sizeof(magic));
+    close(fd);
+
+    if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        return COMPRESSION_GZIP;
+    }
+    if (n == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+        return COMPRESSION_ZSTD;
+    }
+    return COMPRESSION_NONE;
+}
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+static int add_point(struct compressed_log *log, size_t *capacity, struct access_point point) {
+    if (log->count == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 64;
+        struct access_point *points = realloc(log->points, new_capacity * sizeof(*points));
+        if (points == NULL) {
+            return -1;
+        }
+        log->points = points;
+        *capacity = new_capacity;
+    }
+    log->points[log->count++] = point;
+    return 0;
+}
+
+#endif
+
+#ifdef HAVE_ZLIB
+
+static int64_t mtime_ns(const struct stat *st) {
+#if defined(_WIN32) || defined(_WIN64)
+    return (int64_t)st->st_mtime * NS_PER_SECOND;
+#else
+    return (int64_t)st->st_mtim.tv_sec * NS_PER_SECOND + st->st_mtim.tv_nsec;
+#endif
+}
+
+struct gzx_header {
+    char magic[4];
+    uint32_t span;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t count;
+};
+
+struct gzx_point {
+    uint64_t out;
+    uint64_t in;
+    uint32_t bits;
+    uint32_t window_len;
+};
+
+static int gz_save_point(struct compressed_log *log, size_t *capacity, int bits, uint64_t in, uint64_t out,
+                         const unsigned char *window, size_t left) {
+    // The output buffer is circular: `left` bytes at its end are the oldest
+    unsigned char history[GZ_WINDOW_SIZE];
+    if (left) {
+        memcpy(history, window + GZ_WINDOW_SIZE - left, left);
+    }
+    if (left < GZ_WINDOW_SIZE) {
+        memcpy(history + left, window, GZ_WINDOW_SIZE - left);
+    }
+
+    uLongf window_len = compressBound(GZ_WINDOW_SIZE);
+    struct access_point point = {.out = out, .in = in, .bits = bits, .window = malloc(window_len)};
+    if (point.window == NULL || compress2(point.window, &window_len, history, GZ_WINDOW_SIZE, Z_BEST_SPEED) != Z_OK) {
+        free(point.window);
+        return -1;
+    }
+    point.window_len = window_len;
+    if (add_point(log, capacity, point) < 0) {
+        free(point.window);
+        return -1;
+    }
+    return 0;
+}
+
+// One pass over the whole file, zran-style: stop at deflate block boundaries
+// every GZ_SPAN output bytes and keep the history needed to resume there.
+static int gz_build_points(struct compressed_log *log) {
+    size_t capacity = 0;
+    struct access_point start = {0};
+    if (add_point(log, &capacity, start) < 0) {
+        return -1;
+    }
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit2(&strm, 47) != Z_OK) {
+        return -1;
+    }
+    unsigned char *input = malloc(STREAM_CHUNK);
+    unsigned char *window = malloc(GZ_WINDOW_SIZE);
+    int result = input && window ? 0 : -1;
+
+    uint64_t totin = 0, totout = 0, last = 0, pos = 0;
+    bool member_done = false;
+    strm.avail_out = 0;
+    while (result == 0) {
+        ssize_t n = pread(log->fd, input, STREAM_CHUNK, pos);
+        if (n <= 0) {
+            result = n < 0 ? -1 : 0;
+            break;
+        }
+        pos += n;
+        strm.next_in = input;
+        strm.avail_in = n;
+        do {
+            if (strm.avail_out == 0) {
+                strm.avail_out = GZ_WINDOW_SIZE;
+                strm.next_out = window;
+            }
+            totin += strm.avail_in;
+            totout += strm.avail_out;
+            int ret = inflate(&strm, Z_BLOCK);
+            totin -= strm.avail_in;
+            totout -= strm.avail_out;
+
+            if (ret == Z_STREAM_END) {
+                // Another gzip member may follow
+                member_done = true;
+                inflateReset(&strm);
+                continue;
+            }
+            if (ret == Z_DATA_ERROR && member_done) {
+                // Trailing garbage after a complete member
+                strm.avail_in = 0;
+                pos = log->st.st_size;
+                break;
+            }
+            if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                result = -1;
+                break;
+            }
+            member_done = false;
+            if ((strm.data_type & 128) && !(strm.data_type & 64) && totout - last > GZ_SPAN) {
+                if (gz_save_point(log, &capacity, strm.data_type & 7, totin, totout, window, strm.avail_out) < 0) {
+                    result = -1;
+                    break;
+                }
+                last = totout;
+            }
+        } while (strm.avail_in != 0);
+    }
+
+    inflateEnd(&strm);
+    free(input);
+    free(window);
+    return result;
+}
+
+static void gzx_path(const char *filename, char *path, size_t len) {
+    snprintf(path, len, "%s%s", filename, GZX_SUFFIX);
+}
+
+static int gz_load_points(struct compressed_log *log, const char *filename) {
+    char path[MAX_PATH_LENGTH];
+    gzx_path(filename, path, sizeof(path));
+    FILE *in = fopen(path, "rb");
+    if (in == NULL) {
+        return -1;
+    }
+
+    struct gzx_header header;
+    size_t capacity = 0;
+    int result = 0;
+    if (fread(&header, sizeof(header), 1, in) != 1 ||
+        memcmp(header.magic, GZX_MAGIC, sizeof(header.magic)) != 0 ||
+        header.span != GZ_SPAN ||
+        header.inode != (uint64_t)log->st.st_ino ||
+        header.size != (uint64_t)log->st.st_size ||
+        header.mtime_ns != mtime_ns(&log->st)) {
+        result = -1;
+    }
+    for (uint64_t i = 0; result == 0 && i < header.count; i++) {
+        struct gzx_point stored;
+        if (fread(&stored, sizeof(stored), 1, in) != 1) {
+            result = -1;
+            break;
+        }
+        struct access_point point = {.out = stored.out, .in = stored.in, .bits = stored.bits};
+        if (stored.window_len > 0) {
+            point.window = malloc(stored.window_len);
+            point.window_len = stored.window_len;
+            if (point.window == NULL || fread(point.window, 1, point.window_len, in) != point.window_len) {
+                free(point.window);
+                result = -1;
+                break;
+            }
+        }
+        if (add_point(log, &capacity, point) < 0) {
+            free(point.window);
+            result = -1;
+        }
+    }
+    fclose(in);
+    return result;
+}
+
+// The index is only a cache: failing to write it is not an error
+static void gz_save_index(const struct compressed_log *log, const char *filename) {
+    char path[MAX_PATH_LENGTH];
+    char tmp_path[MAX_PATH_LENGTH + 4];
+    gzx_path(filename, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *out = fopen(tmp_path, "wb");
+    if (out == NULL) {
+        return;
+    }
+
+    struct gzx_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GZX_MAGIC, sizeof(header.magic));
+    header.span = GZ_SPAN;
+    header.inode = log->st.st_ino;
+    header.size = log->st.st_size;
+    header.mtime_ns = mtime_ns(&log->st);
+    header.count = log->count;
+    fwrite(&header, sizeof(header), 1, out);
+    for (size_t i = 0; i < log->count; i++) {
+        const struct access_point *point = &log->points[i];
+        struct gzx_point stored = {point->out, point->in, (uint32_t)point->bits, (uint32_t)point->window_len};
+        fwrite(&stored, sizeof(stored), 1, out);
+        fwrite(point->window, 1, point->window_len, out);
+    }
+    bool failed = ferror(out);
+    if (fclose(out) != 0 || failed || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+    }
+}
+
+static int gz_open_at(struct cstream *s, const struct access_point *point) {
+    memset(&s->z, 0, sizeof(s->z));
+    s->skip = 0;
+    s->ended = false;
+    if (point->window == NULL) {
+        s->raw = false;
+        s->in = 0;
+        return inflateInit2(&s->z, 47) == Z_OK ? 0 : -1;
+    }
+
+    s->raw = true;
+    if (inflateInit2(&s->z, -15) != Z_OK) {
+        return -1;
+    }
+    s->in = point->in;
+    if (point->bits) {
+        unsigned char byte;
+        if (pread(s->log->fd, &byte, 1, point->in - 1) != 1) {
+            return -1;
+        }
+        inflatePrime(&s->z, point->bits, byte >> (8 - point->bits));
+    }
+
+    unsigned char history[GZ_WINDOW_SIZE];
+    uLongf history_len = sizeof(history);
+    if (uncompress(history, &history_len, point->window, point->window_len) != Z_OK) {
+        return -1;
+    }
+    return inflateSetDictionary(&s->z, history, history_len) == Z_OK ? 0 : -1;
+}
+
+static ssize_t gz_read(struct cstream *s, unsigned char *buf, size_t len) {
+    s->z.next_out = buf;
+    s->z.avail_out = len;
+    while (s->z.avail_out > 0 && !s->ended) {
+        if (s->z.avail_in == 0) {
+            ssize_t n = pread(s->log->fd, s->input, STREAM_CHUNK, s->in);
+            if (n < 0) {
+                return -1;
+            }
+            if (n == 0) {
+                break;
+            }
+            s->in += n;
+            s->z.next_in = s->input;
+            s->z.avail_in = n;
+        }
+        if (s->skip > 0) {
+            size_t skipped = s->skip < s->z.avail_in ? s->skip : s->z.avail_in;
+            s->z.next_in += skipped;
+            s->z.avail_in -= skipped;
+            s->skip -= skipped;
+            continue;
+        }
+
+        int ret = inflate(&s->z, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            // A raw stream leaves the member's trailer to us; the next
+            // member, if any, starts with a regular gzip header.
+            if (s->raw) {
+                s->skip = 8;
+                s->raw = false;
+                inflateReset2(&s->z, 47);
+            } else {
+                inflateReset(&s->z);
+            }
+            continue;
+        }
+        if (ret == Z_DATA_ERROR && !s->raw && s->z.total_in == 0) {
+            // Trailing garbage after the last member
+            s->ended = true;
+            break;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            return -1;
+        }
+    }
+    return len - s->z.avail_out;
+}
+
+#endif // HAVE_ZLIB
+
+#ifdef HAVE_ZSTD
+
+static uint32_t read_le32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// Every frame listed in the seek table is an access point. Without a seek
+// table the file is streamed from its start.
+static int zstd_read_points(struct compressed_log *log) {
+    size_t capacity = 0;
+    struct access_point start = {0};
+    if (add_point(log, &capacity, start) < 0) {
+        return -1;
+    }
+
+    unsigned char footer[ZSTD_SEEKABLE_FOOTER_SIZE];
+    off_t size = log->st.st_size;
+    if (size < ZSTD_SEEKABLE_FOOTER_SIZE ||
+        pread(log->fd, footer, sizeof(footer), size - ZSTD_SEEKABLE_FOOTER_SIZE) != (ssize_t)sizeof(footer) ||
+        read_le32(footer + 5) != ZSTD_SEEKABLE_MAGIC) {
+        return 0;
+    }
+
+    uint32_t frames = read_le32(footer);
+    size_t entry_size = (footer[4] & 0x80) ? 12 : 8;
+    size_t table_size = (size_t)frames * entry_size;
+    if (table_size + ZSTD_SEEKABLE_FOOTER_SIZE > (size_t)size) {
+        return 0;
+    }
+    unsigned char *table = malloc(table_size ? table_size : 1);
+    if (table == NULL) {
+        return -1;
+    }
+    if (pread(log->fd, table, table_size, size - ZSTD_SEEKABLE_FOOTER_SIZE - table_size) != (ssize_t)table_size) {
+        free(table);
+        return 0;
+    }
+
+    uint64_t in = 0, out = 0;
+    for (uint32_t i = 0; i < frames; i++) {
+        const unsigned char *entry = table + i * entry_size;
+        if (i > 0) {
+            struct access_point point = {.out = out, .in = in};
+            if (add_point(log, &capacity, point) < 0) {
+                free(table);
+                return -1;
+            }
+        }
+        in += read_le32(entry);
+        out += read_le32(entry + 4);
+    }
+    free(table);
+    return 0;
+}
+
+static int zstd_open_at(struct cstream *s, const struct access_point *point) {
+    s->dctx = ZSTD_createDCtx();
+    s->in = point->in;
+    s->zin.src = s->input;
+    s->zin.size = 0;
+    s->zin.pos = 0;
+    return s->dctx ? 0 : -1;
+}
+
+// The skippable frame holding the seek table produces no output
+static ssize_t zstd_read(struct cstream *s, unsigned char *buf, size_t len) {
+    ZSTD_outBuffer out = {buf, len, 0};
+    while (out.pos < out.size) {
+        if (s->zin.pos == s->zin.size) {
+            ssize_t n = pread(s->log->fd, s->input, STREAM_CHUNK, s->in);
+            if (n < 0) {
+                return -1;
+            }
+            if (n == 0) {
+                break;
+            }
+            s->in += n;
+            s->zin.size = n;
+            s->zin.pos = 0;
+        }
+        size_t ret = ZSTD_decompressStream(s->dctx, &out, &s->zin);
+        if (ZSTD_isError(ret)) {
+            return -1;
+        }
+    }
+    return out.pos;
+}
+
+#endif // HAVE_ZSTD
+
+static int cstream_open(struct cstream *s, const struct compressed_log *log, size_t point) {
+    memset(s, 0, sizeof(*s));
+    s->log = log;
+    s->input = malloc(STREAM_CHUNK);
+    if (s->input == NULL) {
+        return -1;
+    }
+    switch (log->format) {
+#ifdef HAVE_ZLIB
+    case COMPRESSION_GZIP:
+        return gz_open_at(s, &log->points[point]);
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESSION_ZSTD:
+        return zstd_open_at(s, &log->points[point]);
+#endif
+    default:
+        (void)point;
+        return -1;
+    }
+}
+
+static ssize_t cstream_read(struct cstream *s, void *buf, size_t len) {
+    switch (s->log->format) {
+#ifdef HAVE_ZLIB
+    case COMPRESSION_GZIP:
+        return gz_read(s, buf, len);
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESSION_ZSTD:
+        return zstd_read(s, buf, len);
+#endif
+    default:
+        (void)buf;
+        (void)len;
+        return -1;
+    }
+}
+
+static void cstream_close(struct cstream *s) {
+    switch (s->log->format) {
+#ifdef HAVE_ZLIB
+    case COMPRESSION_GZIP:
+        inflateEnd(&s->z);
+        break;
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESSION_ZSTD:
+        ZSTD_freeDCtx(s->dctx);
+        break;
+#endif
+    default:
+        break;
+    }
+    free(s->input);
+}
+
+static int compressed_open(struct compressed_log *log, const char *filename, enum compression format) {
+    memset(log, 0, sizeof(*log));
+    log->format = format;
+    log->fd = open(filename, O_RDONLY);
+    if (log->fd < 0) {
+        return -1;
+    }
+    if (fstat(log->fd, &log->st) < 0) {
+        close(log->fd);
+        log->fd = -1;
+        return -1;
+    }
+
+    int result = -1;
+    switch (format) {
+#ifdef HAVE_ZLIB
+    case COMPRESSION_GZIP:
+        result = gz_load_points(log, filename);
+        if (result < 0) {
+            for (size_t i = 0; i < log->count; i++) {
+                free(log->points[i].window);
+            }
+            log->count = 0;
+            result = gz_build_points(log);
+            if (result == 0) {
+                gz_save_index(log, filename);
+            }
+        }
+        break;
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESSION_ZSTD:
+        result = zstd_read_points(log);
+        break;
+#endif
+    default:
+        break;
+    }
+    return result;
+}
+
+static void compressed_close(struct compressed_log *log) {
+    for (size_t i = 0; i < log->count; i++) {
+        free(log->points[i].window);
+    }
+    free(log->points);
+    close(log->fd);
+}
+
+// Timestamp of the first entry after an access point, or PRECISE_NS_INVALID
+// when there is none within PROBE_LIMIT decompressed bytes. A point is
+// usually mid-line, so the scan starts at the next line, where a date inside
+// a message cannot be taken for the entry's.
+static int64_t probe_point(const struct compressed_log *log, size_t point, char *buf) {
+    struct cstream s;
+    int64_t ns = PRECISE_NS_INVALID;
+    if (cstream_open(&s, log, point) < 0) {
+        cstream_close(&s);
+        return ns;
+    }
+
+    size_t have = 0;
+    size_t line = log->points[point].out > 0 ? SIZE_MAX : 0;  // first line start, SIZE_MAX until found
+    while (have < PROBE_LIMIT) {
+        size_t step = PROBE_LIMIT - have < PROBE_STEP ? PROBE_LIMIT - have : PROBE_STEP;
+        ssize_t n = cstream_read(&s, buf + have, step);
+        if (n <= 0) {
+            break;
+        }
+        have += n;
+        if (line == SIZE_MAX) {
+            const char *newline = memchr(buf + have - n, '\n', n);
+            if (newline == NULL) {
+                continue;
+            }
+            line = (size_t)(newline - buf) + 1;
+        }
+
+        size_t offset, date_len;
+        size_t from = scan_resume_point(buf, have - n);
+        from = from > line ? from : line;
+        // A fraction cut off at the end of the buffer may still continue
+        if (scan_date(buf + from, have - from, &offset, &date_len) && from + offset + MAX_DATE_LENGTH < have) {
+            ns = parse_date_ns(buf + from + offset, date_len);
+            break;
+        }
+    }
+    cstream_close(&s);
+    return ns;
+}
+
+// Entries in range follow each other in the buffer, so they are gathered
+// into one span and written once per decompressed window
+static void filter_emit(struct range_filter *f, size_t from, size_t to) {
+    if (f->pending_from == f->pending_to) {
+        f->pending_from = from;
+    }
+    f->pending_to = to;
+}
+
+static int filter_flush(struct range_filter *f) {
+    size_t from = f->pending_from;
+    size_t to = f->pending_to;
+    f->pending_from = f->pending_to = 0;
+    if (to > from && write_all(STDOUT_FILENO, f->buf + from, to - from) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Handles the entry that ends at `next`, the start of the following one
+static int filter_entry(struct range_filter *f, size_t next) {
+    if (!f->emitting && f->cur_ns >= f->start_ns) {
+        f->emitting = true;
+    }
+    if (f->emitting && f->cur_ns > f->end_ns) {
+        f->done = true;
+        return 0;
+    }
+    if (!f->emitting) {
+        return 0;
+    }
+    if (f->limit > 0 && --f->limit == 0) {
+        f->done = true;
+    }
+    filter_emit(f, f->cur, next);
+    return 0;
+}
+
+// Consumes the buffer up to the last timestamp found in it. Only the first
+// timestamp of a line starts an entry; later ones belong to its message.
+static int filter_process(struct range_filter *f, bool at_end) {
+    while (!f->done) {
+        size_t from = f->scanned;
+        if (f->in_line) {
+            const char *newline = memchr(f->buf + from, '\n', f->len - from);
+            if (newline == NULL) {
+                f->scanned = f->len;
+                return at_end && f->cur != SIZE_MAX ? filter_entry(f, f->len) : 0;
+            }
+            from = (size_t)(newline - f->buf) + 1;
+            f->in_line = false;
+        }
+        size_t offset, date_len;
+        bool found = scan_date(f->buf + from, f->len - from, &offset, &date_len);
+        if (found && !at_end && from + offset + MAX_DATE_LENGTH >= f->len) {
+            found = false;
+        }
+        if (!found) {
+            size_t resume = scan_resume_point(f->buf, f->len);
+            f->scanned = resume > from ? resume : from;
+            if (at_end && f->cur != SIZE_MAX) {
+                return filter_entry(f, f->len);
+            }
+            return 0;
+        }
+
+        size_t date = from + offset;
+        size_t next = line_start(f->buf, date);
+        if (f->cur != SIZE_MAX && filter_entry(f, next) < 0) {
+            return -1;
+        }
+        f->cur = next;
+        f->cur_ns = parse_date_ns(f->buf + date, date_len);
+        f->scanned = date + date_len;
+        f->in_line = true;
+    }
+    return 0;
+}
+
+// Drops what is already handled so the buffer only holds the current entry
+static int filter_compact(struct range_filter *f) {
+    size_t keep_from = f->cur == SIZE_MAX ? f->scanned : f->cur;
+    memmove(f->buf, f->buf + keep_from, f->len - keep_from);
+    f->len -= keep_from;
+    f->scanned -= keep_from;
+    if (f->cur != SIZE_MAX) {
+        f->cur = 0;
+    }
+
+    if (f->capacity - f->len < STREAM_CHUNK) {
+        size_t capacity = f->capacity * 2;
+        char *buf = realloc(f->buf, capacity);
+        if (buf == NULL) {
+            return -1;
+        }
+        f->buf = buf;
+        f->capacity = capacity;
+    }
+    return 0;
+}
+
+static int stream_range(const struct compressed_log *log, size_t point, int64_t start_ns, int64_t end_ns,
+                        size_t limit) {
+    struct cstream s;
+    struct range_filter f = {
+        .capacity = 2 * STREAM_CHUNK,
+        .cur = SIZE_MAX,
+        // The line cut by the access point belongs to an entry before it
+        .in_line = log->points[point].out > 0,
+        .start_ns = start_ns,
+        .end_ns = end_ns,
+        .limit = limit,
+    };
+    f.buf = malloc(f.capacity);
+    if (f.buf == NULL) {
+        return -1;
+    }
+    if (cstream_open(&s, log, point) < 0) {
+        cstream_close(&s);
+        free(f.buf);
+        return -1;
+    }
+
+    int result = 0;
+    while (!f.done) {
+        ssize_t n = cstream_read(&s, f.buf + f.len, f.capacity - f.len);
+        if (n < 0) {
+            result = -1;
+            break;
+        }
+        f.len += n;
+        if (filter_process(&f, n == 0) < 0 || filter_flush(&f) < 0) {
+            result = -1;
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        if (filter_compact(&f) < 0) {
+            result = -1;
+            break;
+        }
+    }
+
+    cstream_close(&s);
+    free(f.buf);
+    return result;
+}
+
+// Bisects over the access points by the first timestamp after each, then
+// decompresses forward from the last one before start_ns. With a limit, stops
+// after that many entries.
+int compressed_bisect(const char *filename, enum compression format, int64_t start_ns, int64_t end_ns,
+                      size_t limit) {
+    struct compressed_log log;
+    if (compressed_open(&log, filename, format) < 0) {
+        if (log.fd >= 0) {
+            compressed_close(&log);
+        }
+        return -1;
+    }
+
+    char *probe_buf = malloc(PROBE_LIMIT);
+    if (probe_buf == NULL) {
+        compressed_close(&log);
+        return -1;
+    }
+    size_t begin = 0;
+    size_t end = log.count;
+    while (begin < end) {
+        size_t mid = (begin + end) / 2;
+        int64_t found_ns = probe_point(&log, mid, probe_buf);
+        if (found_ns != PRECISE_NS_INVALID && found_ns < start_ns) {
+            begin = mid + 1;
+        } else {
+            end = mid;
+        }
+    }
+    free(probe_buf);
+
+    int result = stream_range(&log, begin > 0 ? begin - 1 : 0, start_ns, end_ns, limit);
+    compressed_close(&log);
+    return result;
+}
+
+// Timestamp of the last entry after an access point, or PRECISE_NS_INVALID
+// when there is none. Decompresses up to the end of the log.
+static int64_t last_after_point(const struct compressed_log *log, size_t point, char *buf) {
+    struct cstream s;
+    int64_t ns = PRECISE_NS_INVALID;
+    if (cstream_open(&s, log, point) < 0) {
+        cstream_close(&s);
+        return ns;
+    }
+
+    size_t have = 0;
+    bool cut = log->points[point].out > 0;  // still within the line cut by the point
+    for (;;) {
+        ssize_t n = cstream_read(&s, buf + have, PROBE_LIMIT - have);
+        if (n < 0) {
+            ns = PRECISE_NS_INVALID;
+            break;
+        }
+        have += n;
+        // The line cut off at keep is scanned again with the next read, so
+        // that only the first timestamp of each line is taken
+        size_t keep = have;
+        while (n > 0 && keep > 0 && buf[keep - 1] != '\n') {
+            keep--;
+        }
+        keep = keep > 0 ? keep : have;
+        size_t pos = 0;
+        if (cut) {
+            const char *newline = memchr(buf, '\n', keep);
+            pos = newline != NULL ? (size_t)(newline - buf) + 1 : keep;
+            cut = newline == NULL;
+        }
+        size_t last = SIZE_MAX;
+        size_t last_len = 0;
+        size_t offset, date_len;
+        while (pos < keep && scan_date(buf + pos, keep - pos, &offset, &date_len)) {
+            last = pos + offset;
+            last_len = date_len;
+            const char *newline = memchr(buf + last + date_len, '\n', keep - last - date_len);
+            if (newline == NULL) {
+                break;
+            }
+            pos = (size_t)(newline - buf) + 1;
+        }
+        if (last != SIZE_MAX) {
+            ns = parse_date_ns(buf + last, last_len);
+        }
+        if (n == 0) {
+            break;
+        }
+        memmove(buf, buf + keep, have - keep);
+        have -= keep;
+    }
+    cstream_close(&s);
+    return ns;
+}
+
+// Finds the first and last timestamps of a compressed log, decompressing
+// from its first and its last access points. Returns 0, or -1 when the log
+// cannot be read or holds no timestamp.
+int compressed_bounds(const char *filename, enum compression format, int64_t *first_ns, int64_t *last_ns) {
+    struct compressed_log log;
+    if (compressed_open(&log, filename, format) < 0) {
+        if (log.fd >= 0) {
+            compressed_close(&log);
+        }
+        return -1;
+    }
+
+    char *buf = malloc(PROBE_LIMIT);
+    if (buf == NULL) {
+        compressed_close(&log);
+        return -1;
+    }
+    *first_ns = log.count > 0 ? probe_point(&log, 0, buf) : PRECISE_NS_INVALID;
+    *last_ns = PRECISE_NS_INVALID;
+    // The tail after the last point may only hold lines without a timestamp
+    for (size_t point = log.count; point-- > 0 && *last_ns == PRECISE_NS_INVALID;) {
+        *last_ns = last_after_point(&log, point, buf);
+    }
+    free(buf);
+    compressed_close(&log);
+    return *first_ns != PRECISE_NS_INVALID && *last_ns != PRECISE_NS_INVALID ? 0 : -1;
+}
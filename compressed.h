@@ -0,0 +1,21 @@
+#ifndef COMPRESSED_H
+#define COMPRESSED_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Access-point index kept next to a gzip log, built on its first query
+#define GZX_SUFFIX ".gzx"
+
+enum compression {
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_ZSTD,
+};
+
+enum compression detect_compression(const char *filename);
+int compressed_bisect(const char *filename, enum compression format, int64_t start_ns, int64_t end_ns,
+                      size_t limit);
+int compressed_bounds(const char *filename, enum compression format, int64_t *first_ns, int64_t *last_ns);
+
+#endif // COMPRESSED_H
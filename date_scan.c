@@ -0,0 +1,731 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "date_scan.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define DATE_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+// Fixed part of a timestamp: "YYYY-MM-DD HH:MM:SS"
+#define DATE_BASE_LENGTH 19
+// Fixed part of the other formats: "Jun  2 11:55:34", "02/Jun/2025:11:55:34 +0000"
+#define SYSLOG_LENGTH 15
+#define CLF_LENGTH 26
+#define EPOCH_DIGITS 10
+#define EPOCH_MS_DIGITS 13
+
+typedef bool (*scan_fn)(const char *buffer, size_t len, size_t *offset, size_t *date_len);
+typedef size_t (*match_fn)(const char *p, size_t len);
+
+static const char month_names[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+
+static inline bool is_digit(char c) {
+    return (unsigned char)(c - '0') < 10;
+}
+
+// Matches YYYY-MM-DD HH:MM:SS[.,]fraction at p, where the fraction has up to
+// 9 digits. Returns the match length, or 0 if there is no timestamp at p.
+size_t match_date_at(const char *p, size_t len) {
+    static const char shape[] = "DDDD-DD-DD DD:DD:DD";
+    if (len < DATE_BASE_LENGTH) {
+        return 0;
+    }
+    for (size_t i = 0; i < DATE_BASE_LENGTH; i++) {
+        if (shape[i] == 'D' ? !is_digit(p[i]) : p[i] != shape[i]) {
+            return 0;
+        }
+    }
+
+    size_t n = DATE_BASE_LENGTH;
+    if (n + 1 < len && (p[n] == '.' || p[n] == ',') && is_digit(p[n + 1])) {
+        size_t frac_end = n + 1;
+        while (frac_end < len && frac_end < DATE_BASE_LENGTH + 10 && is_digit(p[frac_end])) {
+            frac_end++;
+        }
+        n = frac_end;
+    }
+    return n;
+}
+
+static inline bool all_digits(const char *p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (!is_digit(p[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Index 0-11 of a three-letter month name at p, or -1
+int month_index(const char *p) {
+    for (int i = 0; i < 12; i++) {
+        if (memcmp(p, month_names + 3 * i, 3) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// YYYY-MM-DDTHH:MM:SS[.,fraction][Z|+hh:mm|+hhmm|-hh:mm|-hhmm]
+static size_t match_iso_at(const char *p, size_t len) {
+    static const char shape[] = "DDDD-DD-DDTDD:DD:DD";
+    if (len < DATE_BASE_LENGTH) {
+        return 0;
+    }
+    for (size_t i = 0; i < DATE_BASE_LENGTH; i++) {
+        if (shape[i] == 'D' ? !is_digit(p[i]) : p[i] != shape[i]) {
+            return 0;
+        }
+    }
+
+    size_t n = DATE_BASE_LENGTH;
+    if (n + 1 < len && (p[n] == '.' || p[n] == ',') && is_digit(p[n + 1])) {
+        n++;
+        while (n < len && n < DATE_BASE_LENGTH + 10 && is_digit(p[n])) {
+            n++;
+        }
+    }
+    if (n < len && p[n] == 'Z') {
+        return n + 1;
+    }
+    if (n + 5 <= len && (p[n] == '+' || p[n] == '-') && all_digits(p + n + 1, 2)) {
+        if (n + 6 <= len && p[n + 3] == ':' && all_digits(p + n + 4, 2)) {
+            return n + 6;
+        }
+        if (all_digits(p + n + 3, 2)) {
+            return n + 5;
+        }
+    }
+    return n;
+}
+
+// Mmm dd HH:MM:SS, the day padded with a space
+static size_t match_syslog_at(const char *p, size_t len) {
+    if (len < SYSLOG_LENGTH || p[3] != ' ' || p[6] != ' ' || p[9] != ':' || p[12] != ':') {
+        return 0;
+    }
+    if ((p[4] != ' ' && !is_digit(p[4])) || !is_digit(p[5]) || !all_digits(p + 7, 2) ||
+        !all_digits(p + 10, 2) || !all_digits(p + 13, 2) || month_index(p) < 0) {
+        return 0;
+    }
+    return SYSLOG_LENGTH;
+}
+
+// dd/Mmm/YYYY:HH:MM:SS +hhmm, the Common Log Format of nginx and Apache
+static size_t match_clf_at(const char *p, size_t len) {
+    static const char shape[] = "DD/___/DDDD:DD:DD:DD _DDDD";
+    if (len < CLF_LENGTH) {
+        return 0;
+    }
+    for (size_t i = 0; i < CLF_LENGTH; i++) {
+        if (shape[i] == 'D' ? !is_digit(p[i]) : shape[i] != '_' && p[i] != shape[i]) {
+            return 0;
+        }
+    }
+    return (p[21] == '+' || p[21] == '-') && month_index(p + 3) >= 0 ? CLF_LENGTH : 0;
+}
+
+// Exactly `digits` digits not followed by another one. Seconds may carry a
+// fraction.
+static inline size_t match_epoch_digits(const char *p, size_t len, size_t digits, bool fraction) {
+    if (len < digits || p[0] == '0' || !all_digits(p, digits) || (len > digits && is_digit(p[digits]))) {
+        return 0;
+    }
+    size_t n = digits;
+    if (fraction && n + 1 < len && p[n] == '.' && is_digit(p[n + 1])) {
+        n++;
+        while (n < len && n < digits + 10 && is_digit(p[n])) {
+            n++;
+        }
+    }
+    return n;
+}
+
+static size_t match_epoch_at(const char *p, size_t len) {
+    return match_epoch_digits(p, len, EPOCH_DIGITS, true);
+}
+
+static size_t match_epoch_ms_at(const char *p, size_t len) {
+    return match_epoch_digits(p, len, EPOCH_MS_DIGITS, false);
+}
+
+// Candidates are found by a separator at a fixed position of the format;
+// the rest is checked only there
+static inline bool scan_anchored(const char *buffer, size_t len, char anchor, size_t anchor_pos, size_t min_len,
+                                 match_fn match, size_t *offset, size_t *date_len) {
+    if (len < min_len) {
+        return false;
+    }
+    const char *p = buffer + anchor_pos;
+    const char *last = buffer + len - min_len + anchor_pos;
+    while (p <= last) {
+        p = memchr(p, anchor, last - p + 1);
+        if (p == NULL) {
+            return false;
+        }
+        size_t start = p - anchor_pos - buffer;
+        size_t n = match(buffer + start, len - start);
+        if (n > 0) {
+            *offset = start;
+            *date_len = n;
+            return true;
+        }
+        p++;
+    }
+    return false;
+}
+
+static bool scan_date_portable(const char *buffer, size_t len, size_t *offset, size_t *date_len) {
+    return scan_anchored(buffer, len, '-', 4, DATE_BASE_LENGTH, match_date_at, offset, date_len);
+}
+
+static bool scan_iso_portable(const char *buffer, size_t len, size_t *offset, size_t *date_len) {
+    return scan_anchored(buffer, len, '-', 4, DATE_BASE_LENGTH, match_iso_at, offset, date_len);
+}
+
+static bool scan_syslog(const char *buffer, size_t len, size_t *offset, size_t *date_len) {
+    return scan_anchored(buffer, len, ':', 9, SYSLOG_LENGTH, match_syslog_at, offset, date_len);
+}
+
+static bool scan_clf(const char *buffer, size_t len, size_t *offset, size_t *date_len) {
+    return scan_anchored(buffer, len, '/', 2, CLF_LENGTH, match_clf_at, offset, date_len);
+}
+
+// A number is only taken for a timestamp at the start of a line, or of the
+// buffer, so that other numbers in a line are not mistaken for one
+static inline bool scan_line_start(const char *buffer, size_t len, match_fn match, size_t *offset, size_t *date_len) {
+    const char *p = buffer;
+    const char *end = buffer + len;
+    while (p < end) {
+        size_t n = match(p, end - p);
+        if (n > 0) {
+            *offset = p - buffer;
+            *date_len = n;
+            return true;
+        }
+        p = memchr(p, '\n', end - p);
+        if (p == NULL) {
+            return false;
+        }
+        p++;
+    }
+    return false;
+}
+
+static bool scan_epoch(const char *buffer, size_t len, size_t *offset, size_t *date_len) {
+    return scan_line_start(buffer, len, match_epoch_at, offset, date_len);
+}
+
+static bool scan_epoch_ms(const char *buffer, size_t len, size_t *offset, size_t *date_len) {
+    return scan_line_start(buffer, len, match_epoch_ms_at, offset, date_len);
+}
+
+// The key of JSON lines whose value is their timestamp
+static char json_field[JSON_FIELD_MAX + 1] = "ts";
+static size_t json_field_len = 2;
+
+// A format used by this thread alone in place of the process-wide one, as
+// while searching through a handle, with its scanner
+static _Thread_local const struct log_format *thread_format = NULL;
+static _Thread_local scan_fn thread_impl = NULL;
+
+// A timestamp held by a JSON value: an ISO-8601 or default-format string, or
+// a number of seconds, with an optional fraction, milliseconds, microseconds
+// or nanoseconds since the epoch. The unit of a number follows from its
+// digits.
+static size_t match_json_at(const char *p, size_t len) {
+    size_t n = match_iso_at(p, len);
+    n = n > 0 ? n : match_date_at(p, len);
+    if (n > 0) {
+        return n;
+    }
+    size_t digits = 0;
+    while (digits < len && digits < 20 && is_digit(p[digits])) {
+        digits++;
+    }
+    if (digits == 0 || digits == 20 || p[0] == '0') {
+        return 0;
+    }
+    if (digits <= EPOCH_DIGITS + 1) {
+        return match_epoch_digits(p, len, digits, true);
+    }
+    return digits;
+}
+
+// Bit masks of the characters of 64 bytes that make up the structure of JSON
+// lines, bit i standing for the byte at i
+struct json_block {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t open;      // '{' and '['
+    uint64_t close;     // '}' and ']'
+    uint64_t newline;
+};
+
+#ifdef DATE_SCAN_X86
+
+// ORing in 0x20 folds '[' onto '{' and ']' onto '}'
+__attribute__((target("sse2")))
+static void json_classify(const char *p, struct json_block *b) {
+    const __m128i fold = _mm_set1_epi8(0x20);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i open = _mm_set1_epi8('{');
+    const __m128i close = _mm_set1_epi8('}');
+    const __m128i newline = _mm_set1_epi8('\n');
+    memset(b, 0, sizeof(*b));
+    for (int i = 0; i < 64; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i folded = _mm_or_si128(chunk, fold);
+        b->quote |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, quote)) << i;
+        b->backslash |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, backslash)) << i;
+        b->open |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(folded, open)) << i;
+        b->close |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(folded, close)) << i;
+        b->newline |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)) << i;
+    }
+}
+
+#else
+
+static void json_classify(const char *p, struct json_block *b) {
+    memset(b, 0, sizeof(*b));
+    for (int i = 0; i < 64; i++) {
+        uint64_t bit = 1ULL << i;
+        char c = p[i];
+        b->quote |= c == '"' ? bit : 0;
+        b->backslash |= c == '\\' ? bit : 0;
+        b->open |= (c | 0x20) == '{' ? bit : 0;
+        b->close |= (c | 0x20) == '}' ? bit : 0;
+        b->newline |= c == '\n' ? bit : 0;
+    }
+}
+
+#endif // DATE_SCAN_X86
+
+// Classifies the 64 bytes at p, padding with spaces past the end
+static void json_block_at(const char *p, const char *end, struct json_block *b) {
+    if (end - p >= 64) {
+        json_classify(p, b);
+        return;
+    }
+    char tail[64];
+    memset(tail, ' ', sizeof(tail));
+    memcpy(tail, p, end - p);
+    json_classify(tail, b);
+}
+
+// Sets bit i when bit i or any below it is set an odd number of times: the
+// bytes from an opening quote up to its closing one
+static inline uint64_t prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+// The bytes escaped by a backslash. *carry holds the escape of the first byte
+// by the last one of the block before.
+static uint64_t json_escaped(uint64_t backslash, uint64_t *carry) {
+    uint64_t escaped = *carry;
+    *carry = 0;
+    for (; backslash; backslash &= backslash - 1) {
+        int i = __builtin_ctzll(backslash);
+        if (escaped >> i & 1) {
+            continue;
+        }
+        if (i == 63) {
+            *carry = 1;
+        } else {
+            escaped |= 1ULL << (i + 1);
+        }
+    }
+    return escaped;
+}
+
+static const char *skip_space(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+    return p;
+}
+
+// The value of json_field, when the string whose contents start at key is
+// that key
+static const char *json_field_value(const char *key, const char *end) {
+    const char *field = thread_format != NULL ? thread_format->json_field : json_field;
+    size_t field_len = thread_format != NULL ? thread_format->json_field_len : json_field_len;
+    if ((size_t)(end - key) <= field_len || key[field_len] != '"' || memcmp(key, field, field_len) != 0) {
+        return NULL;
+    }
+    const char *p = skip_space(key + field_len + 1, end);
+    if (p == end || *p != ':') {
+        return NULL;
+    }
+    return skip_space(p + 1, end);
+}
+
+// The length of the timestamp held by the value at p, set to where it starts.
+// A string value has to hold the timestamp and nothing else.
+static size_t json_value_date(const char **p, const char *end) {
+    bool quoted = *p < end && **p == '"';
+    const char *value = *p + quoted;
+    size_t n = match_json_at(value, end - value);
+    const char *after = value + n;
+    if (n == 0 || (quoted ? after == end || *after != '"' : after < end && is_digit(*after))) {
+        return 0;
+    }
+    *p = value;
+    return n;
+}
+
+// Finds the timestamp of a JSON line: the value of json_field among the keys
+// of its outer object. The lines are not parsed. As in simdjson, each 64
+// bytes turn into bit masks of quotes, brackets and newlines; a prefix XOR of
+// the unescaped quotes marks the bytes inside strings, and only the brackets
+// outside strings and the opening quotes are visited, to follow the depth and
+// check the keys of the outer object.
+//
+// JSON lines are only read from their start, where the structure is known:
+// a scan starting in the middle of a line goes on at the next one.
+static bool scan_json(const char *buffer, size_t len, size_t *offset, size_t *date_len) {
+    const char *end = buffer + len;
+    const char *base = buffer;
+    if (base < end && *base != '{') {
+        base = memchr(base, '\n', end - base);
+        base = base != NULL ? base + 1 : end;
+    }
+
+    int depth = 0;
+    bool skip = false;          // the rest of the line has no timestamp
+    uint64_t in_string = 0;     // all ones when the block starts inside a string
+    uint64_t escape = 0;
+    while (base < end) {
+        struct json_block b;
+        json_block_at(base, end, &b);
+        uint64_t quote = b.quote;
+        if ((b.backslash | escape) != 0) {
+            quote &= ~json_escaped(b.backslash, &escape);
+        }
+        uint64_t inside = prefix_xor(quote) ^ in_string;
+        in_string = (uint64_t)((int64_t)inside >> 63);
+
+        const char *next = base + 64;
+        uint64_t events = ((b.open | b.close) & ~inside) | (quote & inside) | b.newline;
+        for (; events; events &= events - 1) {
+            int i = __builtin_ctzll(events);
+            const char *p = base + i;
+            if (*p == '\n') {
+                depth = 0;
+                skip = false;
+                if (inside >> i & 1) {
+                    // A string cut off by the newline: start over after it
+                    next = p + 1;
+                    in_string = 0;
+                    escape = 0;
+                    break;
+                }
+                continue;
+            }
+            if (skip) {
+                continue;
+            }
+            if (*p != '"') {
+                depth += (*p | 0x20) == '{' ? 1 : -1;
+                continue;
+            }
+            const char *value;
+            if (depth != 1 || (value = json_field_value(p + 1, end)) == NULL) {
+                continue;
+            }
+            size_t n = json_value_date(&value, end);
+            if (n > 0) {
+                *offset = value - buffer;
+                *date_len = n;
+                return true;
+            }
+            skip = true;
+        }
+        base = next;
+    }
+    return false;
+}
+
+static const match_fn matchers[DATE_FORMAT_COUNT] = {
+    match_date_at, match_iso_at, match_syslog_at, match_clf_at, match_epoch_at, match_epoch_ms_at, match_json_at,
+};
+
+static scan_fn portable_scanner(enum date_format format) {
+    static const scan_fn scanners[DATE_FORMAT_COUNT] = {
+        scan_date_portable, scan_iso_portable, scan_syslog, scan_clf, scan_epoch, scan_epoch_ms, scan_json,
+    };
+    return scanners[format];
+}
+
+#ifdef DATE_SCAN_X86
+
+// Checks the candidates set in mask (bit i = start at base + i) in order
+static inline bool check_candidates(const char *buffer, size_t len, size_t base, uint32_t mask, match_fn match,
+                                    size_t *offset, size_t *date_len) {
+    while (mask) {
+        size_t start = base + __builtin_ctz(mask);
+        size_t n = match(buffer + start, len - start);
+        if (n > 0) {
+            *offset = start;
+            *date_len = n;
+            return true;
+        }
+        mask &= mask - 1;
+    }
+    return false;
+}
+
+// Every lane tests one candidate start: all five separators are compared at
+// once, so only positions with the full "-  -   :  :" layout reach the
+// matcher. sep is the character between the date and the time.
+__attribute__((target("sse2"), always_inline))
+static inline bool scan_dashed_sse2(const char *buffer, size_t len, char sep, match_fn match,
+                                    size_t *offset, size_t *date_len) {
+    const __m128i dash = _mm_set1_epi8('-');
+    const __m128i middle = _mm_set1_epi8(sep);
+    const __m128i colon = _mm_set1_epi8(':');
+
+    size_t base = 0;
+    // The last load of a step reads bytes [base + 16, base + 32)
+    for (; base + 16 + DATE_BASE_LENGTH <= len; base += 16) {
+        const char *p = buffer + base;
+        __m128i m = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 4)), dash);
+        m = _mm_and_si128(m, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 7)), dash));
+        m = _mm_and_si128(m, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 10)), middle));
+        m = _mm_and_si128(m, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 13)), colon));
+        m = _mm_and_si128(m, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 16)), colon));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(m);
+        if (mask && check_candidates(buffer, len, base, mask, match, offset, date_len)) {
+            return true;
+        }
+    }
+
+    if (scan_anchored(buffer + base, len - base, '-', 4, DATE_BASE_LENGTH, match, offset, date_len)) {
+        *offset += base;
+        return true;
+    }
+    return false;
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline bool scan_dashed_avx2(const char *buffer, size_t len, char sep, match_fn match,
+                                    size_t *offset, size_t *date_len) {
+    const __m256i dash = _mm256_set1_epi8('-');
+    const __m256i middle = _mm256_set1_epi8(sep);
+    const __m256i colon = _mm256_set1_epi8(':');
+
+    size_t base = 0;
+    for (; base + 32 + DATE_BASE_LENGTH <= len; base += 32) {
+        const char *p = buffer + base;
+        __m256i m = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 4)), dash);
+        m = _mm256_and_si256(m, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 7)), dash));
+        m = _mm256_and_si256(m, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 10)), middle));
+        m = _mm256_and_si256(m, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 13)), colon));
+        m = _mm256_and_si256(m, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 16)), colon));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(m);
+        if (mask && check_candidates(buffer, len, base, mask, match, offset, date_len)) {
+            return true;
+        }
+    }
+
+    if (scan_dashed_sse2(buffer + base, len - base, sep, match, offset, date_len)) {
+        *offset += base;
+        return true;
+    }
+    return false;
+}
+
+// One copy of each vector loop per format, with its separator and matcher
+// inlined
+__attribute__((target("sse2")))
+static bool scan_date_sse2(const char *buffer, size_t len, size_t *offset, size_t *date_len) {
+    return scan_dashed_sse2(buffer, len, ' ', match_date_at, offset, date_len);
+}
+
+__attribute__((target("avx2")))
+static bool scan_date_avx2(const char *buffer, size_t len, size_t *offset, size_t *date_len) {
+    return scan_dashed_avx2(buffer, len, ' ', match_date_at, offset, date_len);
+}
+
+__attribute__((target("sse2")))
+static bool scan_iso_sse2(const char *buffer, size_t len, size_t *offset, size_t *date_len) {
+    return scan_dashed_sse2(buffer, len, 'T', match_iso_at, offset, date_len);
+}
+
+__attribute__((target("avx2")))
+static bool scan_iso_avx2(const char *buffer, size_t len, size_t *offset, size_t *date_len) {
+    return scan_dashed_avx2(buffer, len, 'T', match_iso_at, offset, date_len);
+}
+
+static scan_fn select_scanner(enum date_format format) {
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2");
+    switch (format) {
+        case DATE_FORMAT_DEFAULT:
+            return avx2 ? scan_date_avx2 : scan_date_sse2;
+        case DATE_FORMAT_ISO8601:
+            return avx2 ? scan_iso_avx2 : scan_iso_sse2;
+        default:
+            return portable_scanner(format);
+    }
+}
+
+#else
+
+static scan_fn select_scanner(enum date_format format) {
+    return portable_scanner(format);
+}
+
+#endif // DATE_SCAN_X86
+
+static _Atomic(enum date_format) current_format = DATE_FORMAT_DEFAULT;
+// Scanner of the current format, picked on first use from the CPU
+static _Atomic(scan_fn) impl = NULL;
+
+// Selects the format of the timestamps in the logs searched by this process
+void date_format_set(enum date_format format) {
+    atomic_store_explicit(&current_format, format, memory_order_relaxed);
+    atomic_store_explicit(&impl, select_scanner(format), memory_order_relaxed);
+}
+
+enum date_format date_format_get(void) {
+    if (thread_format != NULL) {
+        return thread_format->format;
+    }
+    return atomic_load_explicit(&current_format, memory_order_relaxed);
+}
+
+// Format names as given to --format, in enum order
+static const char *const format_names[DATE_FORMAT_COUNT] = {
+    "default", "iso8601", "syslog", "nginx", "epoch", "epoch-ms", "json",
+};
+
+int date_format_from_name(const char *name) {
+    for (int i = 0; i < DATE_FORMAT_COUNT; i++) {
+        if (strcmp(name, format_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *date_format_name(enum date_format format) {
+    return format_names[format];
+}
+
+// Length of a JSON key name that can be searched for, or 0
+static size_t json_field_valid(const char *name) {
+    size_t len = strlen(name);
+    return len > JSON_FIELD_MAX || strpbrk(name, "\"\\\n") != NULL ? 0 : len;
+}
+
+// Names the key DATE_FORMAT_JSON reads the timestamp from, "ts" unless set.
+// Returns -1 for a name that is empty or too long.
+int date_format_set_json_field(const char *name) {
+    size_t len = json_field_valid(name);
+    if (len == 0) {
+        return -1;
+    }
+    memcpy(json_field, name, len + 1);
+    json_field_len = len;
+    return 0;
+}
+
+const char *date_format_json_field(void) {
+    return thread_format != NULL ? thread_format->json_field : json_field;
+}
+
+// Sets format to date_format with JSON key json_field. Returns -1 for a key
+// date_format_set_json_field() would refuse.
+int log_format_init(struct log_format *format, enum date_format date_format, const char *json_field) {
+    size_t len = json_field_valid(json_field);
+    if (date_format >= DATE_FORMAT_COUNT || len == 0) {
+        return -1;
+    }
+    format->format = date_format;
+    memcpy(format->json_field, json_field, len + 1);
+    format->json_field_len = len;
+    return 0;
+}
+
+// The format the calling thread searches with
+void date_format_current(struct log_format *format) {
+    log_format_init(format, date_format_get(), date_format_json_field());
+}
+
+// Makes the calling thread search with format, which has to outlive its use,
+// or with the process-wide format again for NULL. Returns the format used
+// before, to be restored.
+const struct log_format *date_format_use(const struct log_format *format) {
+    const struct log_format *previous = thread_format;
+    thread_format = format;
+    thread_impl = format != NULL ? select_scanner(format->format) : NULL;
+    return previous;
+}
+
+// Finds the first timestamp in buffer[0, len). The buffer need not be
+// NUL-terminated.
+bool scan_date(const char *buffer, size_t len, size_t *offset, size_t *date_len) {
+    if (thread_impl != NULL) {
+        return thread_impl(buffer, len, offset, date_len);
+    }
+    scan_fn fn = atomic_load_explicit(&impl, memory_order_relaxed);
+    if (fn == NULL) {
+        fn = select_scanner(date_format_get());
+        atomic_store_explicit(&impl, fn, memory_order_relaxed);
+    }
+    return fn(buffer, len, offset, date_len);
+}
+
+// Where to go on scanning a buffer that will grow past len, so that a
+// timestamp cut off at its end is found whole. JSON lines are only read from
+// their start, so for them that is the start of the last line.
+size_t scan_resume_point(const char *buffer, size_t len) {
+    if (date_format_get() != DATE_FORMAT_JSON) {
+        return len > MAX_DATE_LENGTH ? len - MAX_DATE_LENGTH : 0;
+    }
+    while (len > 0 && buffer[len - 1] != '\n') {
+        len--;
+    }
+    return len;
+}
+
+// Length of the timestamp of the current format at p, or 0
+size_t match_date(const char *p, size_t len) {
+    return matchers[date_format_get()](p, len);
+}
+
+bool scan_date_as(enum date_format format, const char *buffer, size_t len, size_t *offset, size_t *date_len) {
+    return select_scanner(format)(buffer, len, offset, date_len);
+}
+
+// Picks the format whose first timestamp in buffer comes earliest, which is
+// the one the lines start with. Formats are tried in enum order, so the
+// default wins ties and is returned when nothing matches. JSON lines with
+// the timestamp field come first: other dates may appear anywhere in them.
+enum date_format date_format_detect(const char *buffer, size_t len) {
+    size_t offset, date_len;
+    if (scan_date_as(DATE_FORMAT_JSON, buffer, len, &offset, &date_len)) {
+        return DATE_FORMAT_JSON;
+    }
+    enum date_format best = DATE_FORMAT_DEFAULT;
+    size_t best_offset = SIZE_MAX;
+    for (int format = 0; format < DATE_FORMAT_JSON; format++) {
+        if (scan_date_as(format, buffer, len, &offset, &date_len) && offset < best_offset) {
+            best = format;
+            best_offset = offset;
+        }
+    }
+    return best;
+}
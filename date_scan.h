@@ -0,0 +1,50 @@
+#ifndef DATE_SCAN_H
+#define DATE_SCAN_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Longest timestamp the scanners match: "YYYY-MM-DDTHH:MM:SS.fffffffff+hh:mm"
+#define MAX_DATE_LENGTH 35
+
+// Timestamp formats a log can use. Each has its own scanner and parser.
+enum date_format {
+    DATE_FORMAT_DEFAULT,    // 2025-06-02 11:55:34[.frac], local time
+    DATE_FORMAT_ISO8601,    // 2025-06-02T11:55:34[.frac][Z|+hh:mm], local time without a zone
+    DATE_FORMAT_SYSLOG,     // Jun  2 11:55:34, local time in the current year
+    DATE_FORMAT_CLF,        // 02/Jun/2025:11:55:34 +0000, as nginx and Apache write
+    DATE_FORMAT_EPOCH,      // 1748865334[.frac], seconds since the epoch
+    DATE_FORMAT_EPOCH_MS,   // 1748865334123, milliseconds since the epoch
+    DATE_FORMAT_JSON,       // {"ts": "2025-06-02T11:55:34.123Z", ...}, a top-level field of JSON lines
+    DATE_FORMAT_COUNT,
+};
+
+// Longest key name of DATE_FORMAT_JSON
+#define JSON_FIELD_MAX 64
+
+// A format with its parameters, as one log is searched with
+struct log_format {
+    enum date_format format;
+    char json_field[JSON_FIELD_MAX + 1];    // key of DATE_FORMAT_JSON
+    size_t json_field_len;
+};
+
+size_t match_date_at(const char *p, size_t len);
+size_t match_date(const char *p, size_t len);
+bool scan_date(const char *buffer, size_t len, size_t *offset, size_t *date_len);
+bool scan_date_as(enum date_format format, const char *buffer, size_t len, size_t *offset, size_t *date_len);
+int month_index(const char *p);
+
+void date_format_set(enum date_format format);
+enum date_format date_format_get(void);
+int date_format_set_json_field(const char *name);
+const char *date_format_json_field(void);
+int log_format_init(struct log_format *format, enum date_format date_format, const char *json_field);
+void date_format_current(struct log_format *format);
+const struct log_format *date_format_use(const struct log_format *format);
+size_t scan_resume_point(const char *buffer, size_t len);
+int date_format_from_name(const char *name);
+const char *date_format_name(enum date_format format);
+enum date_format date_format_detect(const char *buffer, size_t len);
+
+#endif // DATE_SCAN_H
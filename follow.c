@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "bisect.h"
+#include "precise_time.h"
+
+#define FOLLOW_BUFFER_SIZE (64 * 1024)
+
+#ifdef __linux__
+
+#define FOLLOW_FILE_EVENTS (IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF)
+#define FOLLOW_DIR_EVENTS (IN_CREATE | IN_MOVED_TO)
+
+struct follow_state {
+    int inotify_fd;
+    int file_wd;
+    int fd;
+    off_t offset;
+    const char *filename;
+    char base[MAX_PATH_LENGTH];
+    bool rotated;       // the path no longer refers to the open file
+    bool reappeared;    // a file was created or moved in under the path
+    char *buf;
+};
+
+// Copies everything from the current offset to the end of the file. A file
+// shorter than the offset was truncated and is read again from its start.
+static int follow_drain(struct follow_state *state) {
+    struct stat st;
+    if (fstat(state->fd, &st) == 0 && st.st_size < state->offset) {
+        state->offset = 0;
+    }
+    for (;;) {
+        ssize_t n = pread(state->fd, state->buf, FOLLOW_BUFFER_SIZE, state->offset);
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        if (write_all(STDOUT_FILENO, state->buf, n) < 0) {
+            return -1;
+        }
+        state->offset += n;
+    }
+}
+
+static int follow_open(struct follow_state *state) {
+    state->fd = open(state->filename, O_RDONLY);
+    if (state->fd < 0) {
+        return -1;
+    }
+    state->file_wd = inotify_add_watch(state->inotify_fd, state->filename, FOLLOW_FILE_EVENTS);
+    state->offset = 0;
+    state->rotated = false;
+    state->reappeared = false;
+    return 0;
+}
+
+// Finishes the rotated file, then moves on to the one now under the path
+static int follow_reopen(struct follow_state *state) {
+    if (follow_drain(state) < 0) {
+        return -1;
+    }
+    inotify_rm_watch(state->inotify_fd, state->file_wd);
+    close(state->fd);
+    state->fd = -1;
+    if (follow_open(state) < 0) {
+        // Not there yet: wait for the directory to report it
+        state->rotated = true;
+        state->reappeared = false;
+    }
+    return 0;
+}
+
+static int follow_wait(struct follow_state *state) {
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n = read(state->inotify_fd, events, sizeof(events));
+    if (n <= 0) {
+        return -1;
+    }
+    for (char *p = events; p < events + n;) {
+        const struct inotify_event *event = (const struct inotify_event *)p;
+        if (event->wd == state->file_wd && (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF))) {
+            state->rotated = true;
+        }
+        if (event->wd != state->file_wd && event->len > 0 && strcmp(event->name, state->base) == 0) {
+            state->rotated = true;
+            state->reappeared = true;
+        }
+        p += sizeof(struct inotify_event) + event->len;
+    }
+    return 0;
+}
+
+// Streams the log from the first entry at or after the start of the range,
+// then keeps streaming appends as inotify reports them. The end of the range
+// is not applied. Rotation by rename or delete and truncation are followed.
+int bisect_follow(const char *filename, struct search_range_t range) {
+    struct follow_state state = {
+        .inotify_fd = inotify_init1(IN_CLOEXEC),
+        .fd = -1,
+        .filename = filename,
+    };
+    if (state.inotify_fd < 0) {
+        return -1;
+    }
+
+    char path[MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s", filename);
+    snprintf(state.base, sizeof(state.base), "%s", basename(path));
+    snprintf(path, sizeof(path), "%s", filename);
+    inotify_add_watch(state.inotify_fd, dirname(path), FOLLOW_DIR_EVENTS);
+
+    // Watch before searching, so no append is missed in between
+    state.buf = malloc(FOLLOW_BUFFER_SIZE);
+    if (state.buf == NULL || follow_open(&state) < 0) {
+        free(state.buf);
+        close(state.inotify_fd);
+        return -1;
+    }
+
+    // The start is searched in the file being watched, not in whatever the
+    // path names by now
+    struct log_file log;
+    struct log_entry entry;
+    int found = -1;
+    if (log_open_fd(filename, dup(state.fd), &log) == 0) {
+        found = log_seek(&log, precise_time_to_ns(range.start), &entry);
+        state.offset = found > 0 ? (off_t)line_start(log.data, entry.offset) : (off_t)log.size;
+        log_close(&log);
+    }
+
+    int result = found < 0 ? -1 : 0;
+    while (result == 0) {
+        if (state.fd >= 0 && follow_drain(&state) < 0) {
+            result = -1;
+            break;
+        }
+        if (state.rotated && (state.fd >= 0 || state.reappeared)) {
+            if (state.fd < 0) {
+                if (follow_open(&state) < 0) {
+                    state.reappeared = false;
+                }
+            } else if (follow_reopen(&state) < 0) {
+                result = -1;
+            }
+            continue;
+        }
+        if (follow_wait(&state) < 0) {
+            result = -1;
+        }
+    }
+
+    if (state.fd >= 0) {
+        close(state.fd);
+    }
+    close(state.inotify_fd);
+    free(state.buf);
+    return result;
+}
+
+#else
+
+int bisect_follow(const char *filename, struct search_range_t range) {
+    (void)filename;
+    (void)range;
+    return -1;
+}
+
+#endif // __linux__
@@ -0,0 +1,328 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <regex.h>
+#include <pthread.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include "win.h"
+#endif
+
+#include "bisect.h"
+#include "compressed.h"
+#include "precise_time.h"
+#include "stats.h"
+
+// The range is cut into chunks of about this size, ending at a newline
+#define GREP_CHUNK_SIZE (1024 * 1024)
+// Chunks scanned ahead of the one being written; bounds the memory used
+#define GREP_WINDOW 64
+
+struct grep_chunk {
+    char *buf;
+    size_t len;
+    size_t cap;
+    bool done;
+};
+
+struct grep_pool {
+    const char *data;
+    size_t from;
+    size_t to;
+    size_t count;
+    const char *pattern;
+    // A string every matching line contains, or NULL when there is none
+    char literal[MAX_BUFFER_SIZE];
+    size_t literal_len;
+    bool literal_only;  // the pattern is the literal itself
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t next;        // next chunk to scan
+    size_t written;     // chunks written so far
+    bool failed;
+    struct grep_chunk slots[GREP_WINDOW];
+};
+
+// Finds the longest run of plain characters the pattern requires, so that
+// lines without it are skipped without running the regex. Alternation makes
+// every run optional, and so do groups, brackets and the run's last
+// character when a quantifier follows it.
+static void find_literal(struct grep_pool *pool) {
+    const char *p = pool->pattern;
+    pool->literal_len = 0;
+    pool->literal_only = strpbrk(p, ".[]()*+?{}|^$\\") == NULL;
+    if (pool->literal_only) {
+        pool->literal_len = strlen(p) < sizeof(pool->literal) ? strlen(p) : 0;
+        memcpy(pool->literal, p, pool->literal_len);
+        pool->literal_only = pool->literal_len > 0;
+        return;
+    }
+    if (strchr(p, '|') != NULL) {
+        return;
+    }
+
+    int depth = 0;
+    const char *run = NULL;
+    for (const char *c = p;; c++) {
+        bool plain = *c != '\0' && depth == 0 && strchr(".[]()*+?{}^$\\", *c) == NULL;
+        if (plain) {
+            run = run ? run : c;
+            continue;
+        }
+        if (run != NULL) {
+            size_t len = c - run;
+            if (*c == '*' || *c == '?' || *c == '{') {
+                len--;
+            }
+            if (len > pool->literal_len && len < sizeof(pool->literal)) {
+                memcpy(pool->literal, run, len);
+                pool->literal_len = len;
+            }
+            run = NULL;
+        }
+        if (*c == '\0') {
+            break;
+        }
+        if (*c == '\\' && c[1] != '\0') {
+            c++;
+        } else if (*c == '[') {
+            // A ']' right at the start of a bracket expression is a member
+            c += c[1] == '^' ? 1 : 0;
+            c += c[1] == ']' ? 1 : 0;
+            depth++;
+        } else if (*c == '(' || *c == '{') {
+            depth++;
+        } else if ((*c == ')' || *c == ']' || *c == '}') && depth > 0) {
+            depth--;
+        }
+    }
+}
+
+// Chunk boundaries fall just after the first newline at or past a multiple
+// of the chunk size, so every worker computes the same ones
+static size_t chunk_boundary(const struct grep_pool *pool, size_t i) {
+    if (i == 0) {
+        return pool->from;
+    }
+    size_t pos = pool->from + i * GREP_CHUNK_SIZE;
+    if (pos >= pool->to) {
+        return pool->to;
+    }
+    const char *newline = memchr(pool->data + pos - 1, '\n', pool->to - pos + 1);
+    return newline ? (size_t)(newline - pool->data) + 1 : pool->to;
+}
+
+static bool append(struct grep_chunk *chunk, const char *p, size_t len) {
+    if (chunk->len + len > chunk->cap) {
+        size_t cap = chunk->cap ? chunk->cap : 4096;
+        while (cap < chunk->len + len) {
+            cap *= 2;
+        }
+        char *buf = realloc(chunk->buf, cap);
+        if (buf == NULL) {
+            return false;
+        }
+        chunk->buf = buf;
+        chunk->cap = cap;
+    }
+    memcpy(chunk->buf + chunk->len, p, len);
+    chunk->len += len;
+    return true;
+}
+
+struct grep_matcher {
+    regex_t regex;
+    char *line;         // NUL-terminated copy of the line for regexec()
+    size_t line_cap;
+};
+
+static bool line_matches(const struct grep_pool *pool, struct grep_matcher *matcher, const char *start, size_t len) {
+    if (pool->literal_only) {
+        return true;
+    }
+    if (len + 1 > matcher->line_cap) {
+        char *line = realloc(matcher->line, len + 1);
+        if (line == NULL) {
+            return false;
+        }
+        matcher->line = line;
+        matcher->line_cap = len + 1;
+    }
+    memcpy(matcher->line, start, len);
+    matcher->line[len] = '\0';
+    return regexec(&matcher->regex, matcher->line, 0, NULL, 0) == 0;
+}
+
+// Appends the matching lines of [start, end) to chunk
+static bool scan_chunk(const struct grep_pool *pool, struct grep_matcher *matcher, const char *start, const char *end, struct grep_chunk *chunk) {
+    const char *p = start;
+    while (p < end) {
+        // Jump to the next line holding the literal, if there is one
+        if (pool->literal_len > 0) {
+            const char *hit = memmem(p, end - p, pool->literal, pool->literal_len);
+            if (hit == NULL) {
+                break;
+            }
+            while (hit > p && hit[-1] != '\n') {
+                hit--;
+            }
+            p = hit;
+        }
+        const char *newline = memchr(p, '\n', end - p);
+        const char *line_end = newline ? newline + 1 : end;
+        if (line_matches(pool, matcher, p, (newline ? newline : end) - p)) {
+            if (!append(chunk, p, line_end - p)) {
+                return false;
+            }
+            if (newline == NULL && !append(chunk, "\n", 1)) {
+                return false;
+            }
+        }
+        p = line_end;
+    }
+    return true;
+}
+
+static void *grep_worker(void *arg) {
+    struct grep_pool *pool = arg;
+    struct grep_matcher matcher = {0};
+    // Each thread has its own compiled pattern: regexec() locks a shared one
+    bool compiled = !pool->literal_only && regcomp(&matcher.regex, pool->pattern, REG_EXTENDED | REG_NOSUB) == 0;
+
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->literal_only && !compiled) {
+        pool->failed = true;
+        pthread_cond_broadcast(&pool->cond);
+    }
+    for (;;) {
+        while (!pool->failed && pool->next < pool->count && pool->next >= pool->written + GREP_WINDOW) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        if (pool->failed || pool->next >= pool->count) {
+            break;
+        }
+        size_t i = pool->next++;
+        struct grep_chunk *chunk = &pool->slots[i % GREP_WINDOW];
+        pthread_mutex_unlock(&pool->lock);
+
+        chunk->len = 0;
+        bool ok = scan_chunk(pool, &matcher, pool->data + chunk_boundary(pool, i), pool->data + chunk_boundary(pool, i + 1), chunk);
+
+        pthread_mutex_lock(&pool->lock);
+        chunk->done = true;
+        pool->failed |= !ok;
+        pthread_cond_broadcast(&pool->cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (compiled) {
+        regfree(&matcher.regex);
+    }
+    free(matcher.line);
+    log_stats_collect();
+    return NULL;
+}
+
+// Writes the lines of [from, to) that match pattern, an extended regular
+// expression, in their original order. Chunks are scanned by `jobs` threads
+// while this one writes the finished chunks in order.
+static int grep_range(const struct log_file *log, size_t from, size_t to, const char *pattern, int jobs) {
+    struct grep_pool *pool = calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        return -1;
+    }
+    pool->data = log->data;
+    pool->from = from;
+    pool->to = to;
+    pool->count = (to - from + GREP_CHUNK_SIZE - 1) / GREP_CHUNK_SIZE;
+    pool->pattern = pattern;
+    find_literal(pool);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    pthread_t *threads = malloc(sizeof(pthread_t) * jobs);
+    int started = 0;
+    for (int i = 0; threads && i < jobs; i++) {
+        if (pthread_create(&threads[started], NULL, grep_worker, pool) != 0) {
+            break;
+        }
+        started++;
+    }
+
+    int64_t output_started = stats_clock();
+    pthread_mutex_lock(&pool->lock);
+    pool->failed |= started == 0;
+    while (!pool->failed && pool->written < pool->count) {
+        struct grep_chunk *chunk = &pool->slots[pool->written % GREP_WINDOW];
+        if (!chunk->done) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        int result = write_all(STDOUT_FILENO, chunk->buf, chunk->len);
+        pthread_mutex_lock(&pool->lock);
+        chunk->done = false;
+        pool->written++;
+        pool->failed |= result < 0;
+        pthread_cond_broadcast(&pool->cond);
+    }
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    stats_elapsed(&log_stats.output_ns, output_started);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    int result = pool->failed ? -1 : 0;
+    for (size_t i = 0; i < GREP_WINDOW; i++) {
+        free(pool->slots[i].buf);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->cond);
+    free(threads);
+    free(pool);
+    return result;
+}
+
+// Finds the range like bisect(), then writes only its lines that match
+// pattern
+int bisect_grep(const char *filename, struct search_range_t range, const char *pattern, int jobs) {
+    int64_t start_ns = precise_time_to_ns(range.start);
+    int64_t end_ns = precise_time_to_ns(range.end);
+
+    // Reject a bad pattern before searching
+    regex_t regex;
+    if (regcomp(&regex, pattern, REG_EXTENDED | REG_NOSUB) != 0) {
+        return -1;
+    }
+    regfree(&regex);
+
+    if (detect_compression(filename) != COMPRESSION_NONE) {
+        return -1;
+    }
+    struct log_file log;
+    if (log_open(filename, &log) < 0) {
+        return -1;
+    }
+
+    struct log_entry entry;
+    int found = log_seek(&log, start_ns, &entry);
+    if (found > 0 && entry.ns <= end_ns) {
+        size_t from = line_start(log.data, entry.offset);
+        size_t end = log_upper_bound(&log, entry.offset, end_ns);
+        advise_sequential(&log, from, end);
+        if (grep_range(&log, from, end, pattern, jobs) < 0) {
+            found = -1;
+        }
+    }
+
+    log_close(&log);
+    return found < 0 ? -1 : 0;
+}
@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bisect.h"
+#include "compressed.h"
+#include "date_scan.h"
+
+// Bytes handed to the sink per call, so a slow consumer sees the range
+// arrive in pieces and page faults are spread over them
+#define HANDLE_READ_SIZE (1024 * 1024)
+
+struct bisect_handle {
+    struct log_file log;
+    char *filename;
+    struct log_format format;   // searched with on whichever thread calls
+};
+
+// Maps an uncompressed log for any number of searches, with the timestamp
+// format the calling thread uses now. Returns -1 when the file cannot be
+// opened or is compressed.
+int bisect_open(const char *filename, struct bisect_handle **handle) {
+    *handle = NULL;
+    if (detect_compression(filename) != COMPRESSION_NONE) {
+        return -1;
+    }
+    struct bisect_handle *h = calloc(1, sizeof(*h));
+    if (h == NULL) {
+        return -1;
+    }
+    date_format_current(&h->format);
+    h->filename = strdup(filename);
+    if (h->filename == NULL || log_open(h->filename, &h->log) < 0) {
+        free(h->filename);
+        free(h);
+        return -1;
+    }
+    if (log_cache_init(&h->log) < 0) {
+        bisect_close(h);
+        return -1;
+    }
+    *handle = h;
+    return 0;
+}
+
+size_t bisect_size(const struct bisect_handle *handle) {
+    return handle->log.size;
+}
+
+// Returns the offset of the first entry at or after start_ns, or the size of
+// the log when there is none
+size_t bisect_find_lower(const struct bisect_handle *handle, int64_t start_ns) {
+    return bisect_find_upper(handle, start_ns - 1);
+}
+
+// Returns the offset of the first entry after end_ns, or the size of the log
+// when there is none
+size_t bisect_find_upper(const struct bisect_handle *handle, int64_t end_ns) {
+    const struct log_format *previous = date_format_use(&handle->format);
+    size_t pos = log_upper_bound(&handle->log, 0, end_ns);
+    date_format_use(previous);
+    return pos;
+}
+
+// Passes bytes [from, to) of the log to sink straight from the mapping.
+// Returns -1 when the range is not within the log or the sink stops early.
+int bisect_read_range(const struct bisect_handle *handle, size_t from, size_t to, bisect_sink sink, void *context) {
+    const struct log_file *log = &handle->log;
+    if (from > to || to > log->size) {
+        return -1;
+    }
+    if (from < to) {
+        advise_sequential(log, from, to);
+    }
+    while (from < to) {
+        size_t len = to - from < HANDLE_READ_SIZE ? to - from : HANDLE_READ_SIZE;
+        if (sink(context, log->data + from, len) != 0) {
+            return -1;
+        }
+        from += len;
+    }
+    return 0;
+}
+
+// Writes bytes [from, to) of the log to fd, copied by the kernel where it
+// can, like the command line does
+int bisect_write_range(const struct bisect_handle *handle, size_t from, size_t to, int fd) {
+    if (from > to || to > handle->log.size) {
+        return -1;
+    }
+    return output_range(&handle->log, from, to, fd);
+}
+
+// Tells whether st, from a fresh stat() of the path, is still the file the
+// handle mapped: same inode, size and modification time, to the nanosecond
+// where the platform records it
+bool bisect_is_current(const struct bisect_handle *handle, const struct stat *st) {
+    const struct stat *mapped = &handle->log.st;
+#if defined(_WIN32) || defined(_WIN64)
+    bool same_mtime = st->st_mtime == mapped->st_mtime;
+#else
+    bool same_mtime = st->st_mtim.tv_sec == mapped->st_mtim.tv_sec && st->st_mtim.tv_nsec == mapped->st_mtim.tv_nsec;
+#endif
+    return st->st_dev == mapped->st_dev && st->st_ino == mapped->st_ino && st->st_size == mapped->st_size &&
+           same_mtime;
+}
+
+void bisect_close(struct bisect_handle *handle) {
+    if (handle == NULL) {
+        return;
+    }
+    log_close(&handle->log);
+    free(handle->filename);
+    free(handle);
+}
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bisect.h"
+#include "compressed.h"
+#include "precise_time.h"
+
+// Prints one line per bucket of bucket_ns from the start of the range on:
+// the bucket's start time, the bytes of the entries in it and, with
+// count_lines, their lines. Bucket boundaries are bisected, so only the
+// lines that are counted are ever read.
+int bisect_histogram(const char *filename, struct search_range_t range, int64_t bucket_ns, bool count_lines) {
+    int64_t start_ns = precise_time_to_ns(range.start);
+    int64_t end_ns = precise_time_to_ns(range.end);
+
+    if (detect_compression(filename) != COMPRESSION_NONE) {
+        return -1;
+    }
+    struct log_file log;
+    if (log_open(filename, &log) < 0) {
+        return -1;
+    }
+
+    struct log_entry entry;
+    int found = log_seek(&log, start_ns, &entry);
+    if (found < 0) {
+        log_close(&log);
+        return -1;
+    }
+
+    size_t from = found > 0 ? line_start(log.data, entry.offset) : log.size;
+    int result = 0;
+    for (int64_t bucket = start_ns; bucket <= end_ns; bucket += bucket_ns) {
+        int64_t last_ns = bucket_ns - 1 > end_ns - bucket ? end_ns : bucket + bucket_ns - 1;
+        size_t to = log_upper_bound(&log, from, last_ns);
+
+        char *label = precise_time_to_string(ns_to_precise_time(bucket));
+        if (label == NULL) {
+            result = -1;
+            break;
+        }
+        if (count_lines) {
+            printf("%s %zu %zu\n", label, to - from, count_newlines(log.data + from, to - from));
+        } else {
+            printf("%s %zu\n", label, to - from);
+        }
+        free(label);
+        from = to;
+
+        if (bucket > INT64_MAX - bucket_ns) {
+            break;
+        }
+    }
+
+    log_close(&log);
+    if (fflush(stdout) != 0) {
+        return -1;
+    }
+    return result;
+}
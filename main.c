@@ -5,49 +5,180 @@
 #include <getopt.h>
 #include <unistd.h>
 #include <time.h>
-#include <regex.h>
+#include <fcntl.h>
+#include "binary.h"
 #include "bisect.h"
+#include "bsx_index.h"
+#include "compressed.h"
+#include "date_scan.h"
+#include "stats.h"
 
 #if defined(_WIN32) || defined(_WIN64)
 #include "win.h"
 #endif
 
 void print_usage(const char *program_name) {
-    printf("Usage: %s [OPTIONS] <filename>\n", program_name);
+    printf("Usage: %s [OPTIONS] <filename>...\n", program_name);
     printf("A command line utility.\n\n");
     printf("Arguments:\n");
-    printf("  filename       Input file to process\n\n");
+    printf("  filename       Input file to process; entries of several files are merged by time\n\n");
     printf("Options:\n");
     printf("  -h, --help     Show this help message\n");
     printf("  -v, --version  Show version information\n");
     printf("  -t, --time     Target time range (YYYY-MM-DD HH:MM:SS[+|-|~]<number><unit>)\n");
     printf("  -V, --verbose  Enable verbose output\n");
+    printf("  -j, --jobs N   Threads used to search several files (default: CPU count)\n");
+    printf("  -f, --follow   Stream from the start time on, then keep streaming appends\n");
+    printf("  -o, --output FILE       Write the entries to FILE instead of stdout\n");
+    printf("  -r, --rotated  Search the files, or one file and its rotations, as one rotated log\n");
+    printf("  -g, --grep PATTERN      Only write the lines matching PATTERN (extended regex), using -j threads\n");
+    printf("      --reverse           Write the entries newest first\n");
+    printf("      --limit N           Stop after N entries\n");
+    printf("      --disorder TOLERANCE  Timestamps may run up to TOLERANCE (500ms, 2s) behind earlier lines\n");
+    printf("      --serve SOCKET      Run as a daemon answering searches on a Unix socket, using -j threads\n");
+    printf("      --connect SOCKET    Have the daemon at SOCKET run the search\n");
+    printf("      --format FORMAT     Timestamp format: default, iso8601, syslog, nginx, epoch, epoch-ms, json\n");
+    printf("                          or auto to detect it from the first file (default: auto)\n");
+    printf("      --json-field KEY    JSON lines whose top-level KEY holds the timestamp (default: ts)\n");
+    printf("      --binary SPEC       Fixed-size binary records: record=BYTES[,ts_offset=BYTES][,ts=TYPE]\n");
+    printf("                          [,output=raw|text]; TYPE is u64ns, u64us, u64ms, u64s or u32s\n");
+    printf("      --histogram INTERVAL  Print bytes per bucket of INTERVAL (30s, 1m, 1h, 1d)\n");
+    printf("      --count-lines       Also count the lines of each histogram bucket\n");
+    printf("      --sample N          Write N entries spread evenly in time across the range\n");
+    printf("      --sample-bytes      Spread the --sample entries evenly in bytes instead\n");
+    printf("      --queries FILE      Answer the time ranges in FILE (- for stdin), one per line\n");
+    printf("      --offsets           Print the byte offsets of each query instead of its entries\n");
+    printf("      --stats             Print counters and phase timings as JSON to stderr\n");
+    printf("      --trace             Log every probe of the search to stderr\n");
+    printf("      --build-index       Write or extend the sidecar index <filename>%s\n", BSX_SUFFIX);
+    printf("      --index-interval KB Bytes between index checkpoints, in KB (default %d)\n", BSX_DEFAULT_INTERVAL / 1024);
 }
 
 void print_version() {
     printf("%s version %s\n", PROGRAM_NAME, VERSION);
 }
 
-int main(int argc, char *argv[]) {
-    if (regcomp(&regex_datetime, regex_pattern, REG_EXTENDED)) {
-        fprintf(stderr, "Could not compile regex\n");
-        return 0;
+// Long options without a short equivalent
+enum {
+    OPT_BUILD_INDEX = 256,
+    OPT_INDEX_INTERVAL,
+    OPT_HISTOGRAM,
+    OPT_COUNT_LINES,
+    OPT_QUERIES,
+    OPT_OFFSETS,
+    OPT_STATS,
+    OPT_TRACE,
+    OPT_DISORDER,
+    OPT_SERVE,
+    OPT_CONNECT,
+    OPT_FORMAT,
+    OPT_JSON_FIELD,
+    OPT_SAMPLE,
+    OPT_SAMPLE_BYTES,
+    OPT_REVERSE,
+    OPT_LIMIT,
+    OPT_BINARY,
+};
+
+// Bytes at the start of a log that --format auto looks at
+#define DETECT_SIZE (64 * 1024)
+
+// Runs at exit, so the counters are printed whether or not the search succeeded
+static void print_stats(void) {
+    log_stats_print(stderr);
+}
+
+static void resolve_filename(const char *filename, char *absolute_path) {
+    if (realpath(filename, absolute_path) == NULL) {
+        fprintf(stderr, "Error: could not resolve absolute path for '%s'\n", filename);
+        exit(EXIT_FAILURE);
     }
+    if (strlen(absolute_path) == 0) {
+        fprintf(stderr, "Error: filename cannot be empty\n");
+        exit(EXIT_FAILURE);
+    }
+    if (access(absolute_path, F_OK | R_OK) == -1) {
+        fprintf(stderr, "Error: file '%s' does not exist\n", absolute_path);
+        exit(EXIT_FAILURE);
+    }
+}
 
+// Selects the timestamp format the start of filename is written in. A file
+// that cannot be read, or is compressed, keeps the default.
+static void detect_format(const char *filename) {
+    if (detect_compression(filename) != COMPRESSION_NONE) {
+        return;
+    }
+    FILE *file = fopen(filename, "rb");
+    char *buf = malloc(DETECT_SIZE);
+    if (file != NULL && buf != NULL) {
+        size_t len = fread(buf, 1, DETECT_SIZE, file);
+        date_format_set(date_format_detect(buf, len));
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+    free(buf);
+}
+
+int main(int argc, char *argv[]) {
     int opt;
     int verbose = 0;
+    int build_index = 0;
+    int follow = 0;
+    int rotated = 0;
+    size_t index_interval = BSX_DEFAULT_INTERVAL;
+    int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
     char *time_range_str = NULL;
-    char *filename = NULL;
+    char *output_path = NULL;
+    char *grep_pattern = NULL;
+    int64_t histogram_ns = 0;
+    int64_t disorder_ns = 0;
+    int count_lines = 0;
+    int sample_count = 0;
+    int sample_bytes = 0;
+    int reverse = 0;
+    int limit = 0;
+    struct binary_format binary;
+    int binary_records = 0;
+    char *queries_path = NULL;
+    int offsets_only = 0;
+    char *serve_path = NULL;
+    char *connect_path = NULL;
+    int format = -1;    // detected when not given
     
     static struct option long_options[] = {
         {"help",    no_argument,       0, 'h'},
         {"version", no_argument,       0, 'v'},
         {"time",    required_argument, 0, 't'},
         {"verbose", no_argument,       0, 'V'},
+        {"jobs",    required_argument, 0, 'j'},
+        {"follow",  no_argument,       0, 'f'},
+        {"rotated", no_argument,       0, 'r'},
+        {"output",  required_argument, 0, 'o'},
+        {"grep",    required_argument, 0, 'g'},
+        {"build-index",    no_argument,       0, OPT_BUILD_INDEX},
+        {"index-interval", required_argument, 0, OPT_INDEX_INTERVAL},
+        {"histogram",      required_argument, 0, OPT_HISTOGRAM},
+        {"count-lines",    no_argument,       0, OPT_COUNT_LINES},
+        {"queries",        required_argument, 0, OPT_QUERIES},
+        {"offsets",        no_argument,       0, OPT_OFFSETS},
+        {"stats",          no_argument,       0, OPT_STATS},
+        {"trace",          no_argument,       0, OPT_TRACE},
+        {"disorder",       required_argument, 0, OPT_DISORDER},
+        {"serve",          required_argument, 0, OPT_SERVE},
+        {"connect",        required_argument, 0, OPT_CONNECT},
+        {"format",         required_argument, 0, OPT_FORMAT},
+        {"json-field",     required_argument, 0, OPT_JSON_FIELD},
+        {"sample",         required_argument, 0, OPT_SAMPLE},
+        {"sample-bytes",   no_argument,       0, OPT_SAMPLE_BYTES},
+        {"reverse",        no_argument,       0, OPT_REVERSE},
+        {"limit",          required_argument, 0, OPT_LIMIT},
+        {"binary",         required_argument, 0, OPT_BINARY},
         {0, 0, 0, 0}
     };
     
-    while ((opt = getopt_long(argc, argv, "hvt:V", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "hvt:Vj:fro:g:", long_options, NULL)) != -1) {
         switch (opt) {
             case 'h':
                 print_usage(argv[0]);
@@ -61,6 +192,112 @@ int main(int argc, char *argv[]) {
             case 'V':
                 verbose = 1;
                 break;
+            case 'j':
+                jobs = atoi(optarg);
+                if (jobs <= 0) {
+                    fprintf(stderr, "Error: invalid number of jobs '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'f':
+                follow = 1;
+                break;
+            case 'r':
+                rotated = 1;
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'g':
+                grep_pattern = optarg;
+                break;
+            case OPT_BUILD_INDEX:
+                build_index = 1;
+                break;
+            case OPT_INDEX_INTERVAL:
+                if (atoi(optarg) <= 0) {
+                    fprintf(stderr, "Error: invalid index interval '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                index_interval = (size_t)atoi(optarg) * 1024;
+                break;
+            case OPT_HISTOGRAM:
+                if (parse_duration(optarg, &histogram_ns) != 0) {
+                    fprintf(stderr, "Error: invalid histogram interval '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_COUNT_LINES:
+                count_lines = 1;
+                break;
+            case OPT_QUERIES:
+                queries_path = optarg;
+                break;
+            case OPT_OFFSETS:
+                offsets_only = 1;
+                break;
+            case OPT_STATS:
+                if (!log_stats_enabled) {
+                    log_stats_enabled = true;
+                    atexit(print_stats);
+                }
+                break;
+            case OPT_TRACE:
+                log_trace_enabled = true;
+                break;
+            case OPT_DISORDER:
+                if (parse_duration(optarg, &disorder_ns) != 0) {
+                    fprintf(stderr, "Error: invalid tolerance '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_SERVE:
+                serve_path = optarg;
+                break;
+            case OPT_CONNECT:
+                connect_path = optarg;
+                break;
+            case OPT_FORMAT:
+                format = strcmp(optarg, "auto") == 0 ? -1 : date_format_from_name(optarg);
+                if (format < 0 && strcmp(optarg, "auto") != 0) {
+                    fprintf(stderr, "Error: unknown timestamp format '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_JSON_FIELD:
+                if (date_format_set_json_field(optarg) < 0) {
+                    fprintf(stderr, "Error: invalid JSON field name '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                format = DATE_FORMAT_JSON;
+                break;
+            case OPT_SAMPLE:
+                sample_count = atoi(optarg);
+                if (sample_count <= 0) {
+                    fprintf(stderr, "Error: invalid sample size '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_SAMPLE_BYTES:
+                sample_bytes = 1;
+                break;
+            case OPT_REVERSE:
+                reverse = 1;
+                break;
+            case OPT_BINARY:
+                if (parse_binary_format(optarg, &binary) < 0) {
+                    fprintf(stderr, "Error: invalid binary record format '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                binary_records = 1;
+                break;
+            case OPT_LIMIT:
+                limit = atoi(optarg);
+                if (limit <= 0) {
+                    fprintf(stderr, "Error: invalid limit '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case '?':
                 fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
                 exit(EXIT_FAILURE);
@@ -69,7 +306,19 @@ int main(int argc, char *argv[]) {
         }
     }
     
-    if (time_range_str == NULL) {
+    if (format >= 0) {
+        date_format_set(format);
+    }
+
+    if (serve_path != NULL) {
+        if (bisect_serve(serve_path, jobs) != 0) {
+            fprintf(stderr, "Error: could not serve on '%s'\n", serve_path);
+            exit(EXIT_FAILURE);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (time_range_str == NULL && !build_index && queries_path == NULL) {
         fprintf(stderr, "Error: time argument required (-t or --time)\n");
         fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
         exit(EXIT_FAILURE);
@@ -81,36 +330,205 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
     
-    filename = argv[optind];
+    int file_count = argc - optind;
+    char (*absolute_paths)[PATH_MAX] = malloc(sizeof(*absolute_paths) * file_count);
+    const char **filenames = malloc(sizeof(*filenames) * file_count);
+    if (absolute_paths == NULL || filenames == NULL) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < file_count; i++) {
+        resolve_filename(argv[optind + i], absolute_paths[i]);
+        filenames[i] = absolute_paths[i];
+    }
 
-    char absolute_path[PATH_MAX];
-    if (realpath(filename, absolute_path) == NULL) {
-        fprintf(stderr, "Error: could not resolve absolute path for '%s'\n", filename);
+    if (format < 0 && !binary_records) {
+        detect_format(filenames[0]);
+    }
+
+    if (binary_records && (file_count > 1 || follow || histogram_ns > 0 || queries_path != NULL ||
+                           grep_pattern != NULL || sample_count > 0 || rotated || disorder_ns > 0 ||
+                           connect_path != NULL || build_index ||
+                           detect_compression(filenames[0]) != COMPRESSION_NONE)) {
+        fprintf(stderr, "Error: --binary only applies to a plain search of one uncompressed file\n");
         exit(EXIT_FAILURE);
     }
-    filename = absolute_path;
-    if (strlen(filename) == 0) {
-        fprintf(stderr, "Error: filename cannot be empty\n");
+
+    if (disorder_ns > 0 && (file_count > 1 || follow || histogram_ns > 0 || queries_path != NULL ||
+                            grep_pattern != NULL || sample_count > 0 || rotated ||
+                            detect_compression(filenames[0]) != COMPRESSION_NONE)) {
+        fprintf(stderr, "Error: --disorder only applies to a plain search of one uncompressed file\n");
         exit(EXIT_FAILURE);
     }
-    if (access(filename, F_OK | R_OK) == -1) {
-        fprintf(stderr, "Error: file '%s' does not exist\n", filename);
+
+    if ((reverse || limit > 0) && (file_count > 1 || follow || histogram_ns > 0 || queries_path != NULL ||
+                                   grep_pattern != NULL || sample_count > 0 || rotated || disorder_ns > 0 ||
+                                   connect_path != NULL)) {
+        fprintf(stderr, "Error: --reverse and --limit only apply to a plain search of one file\n");
+        exit(EXIT_FAILURE);
+    }
+    if (reverse && detect_compression(filenames[0]) != COMPRESSION_NONE) {
+        fprintf(stderr, "Error: --reverse needs an uncompressed file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (follow && grep_pattern != NULL) {
+        fprintf(stderr, "Error: --follow does not filter with --grep\n");
         exit(EXIT_FAILURE);
     }
 
+    // --queries runs plain searches of the ranges it reads
+    if (queries_path != NULL && (file_count > 1 || rotated)) {
+        fprintf(stderr, "Error: --queries takes a single file\n");
+        exit(EXIT_FAILURE);
+    }
+    if (queries_path != NULL && (follow || histogram_ns > 0 || grep_pattern != NULL || sample_count > 0)) {
+        fprintf(stderr, "Error: --queries only runs plain searches\n");
+        exit(EXIT_FAILURE);
+    }
+    if (rotated && (follow || histogram_ns > 0 || grep_pattern != NULL || sample_count > 0)) {
+        fprintf(stderr, "Error: --rotated only runs a plain search\n");
+        exit(EXIT_FAILURE);
+    }
+    if (sample_count > 0 && (follow || histogram_ns > 0 || grep_pattern != NULL)) {
+        fprintf(stderr, "Error: --sample does not combine with --follow, --histogram or --grep\n");
+        exit(EXIT_FAILURE);
+    }
+    if (histogram_ns > 0 && follow) {
+        fprintf(stderr, "Error: --histogram does not combine with --follow\n");
+        exit(EXIT_FAILURE);
+    }
+    if (histogram_ns > 0 && grep_pattern != NULL) {
+        fprintf(stderr, "Error: --histogram does not filter with --grep\n");
+        exit(EXIT_FAILURE);
+    }
+    const char *single_file_mode = sample_count > 0 ? "--sample" : histogram_ns > 0 ? "--histogram" :
+                                   follow ? "--follow" : grep_pattern != NULL ? "--grep" : NULL;
+    if (single_file_mode != NULL && file_count > 1) {
+        fprintf(stderr, "Error: %s takes a single file\n", single_file_mode);
+        exit(EXIT_FAILURE);
+    }
+
+    // Several files are merged from their mappings
+    for (int i = 0; file_count > 1 && !rotated && !build_index && i < file_count; i++) {
+        if (detect_compression(filenames[i]) != COMPRESSION_NONE) {
+            fprintf(stderr, "Error: '%s' is compressed; only uncompressed files can be merged\n", filenames[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (connect_path != NULL && (file_count > 1 || follow || histogram_ns > 0 || queries_path != NULL ||
+                                 grep_pattern != NULL || disorder_ns > 0 || sample_count > 0 || rotated)) {
+        fprintf(stderr, "Error: --connect only runs a plain search of one file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // --queries reads its ranges from the file
+    struct search_range_t range = {0};
+    if (queries_path == NULL && !build_index && parse_search_range(time_range_str, &range) != 0) {
+        fprintf(stderr, "Error: invalid time format '%s'. Expected format: YYYY-MM-DD HH:MM:SS[+|-|~]<number><unit>\n", time_range_str);
+        exit(EXIT_FAILURE);
+    }
+    range.disorder_ns = disorder_ns;
+    range.limit = limit;
+    range.reverse = reverse;
+
+    FILE *queries = NULL;
+    if (queries_path != NULL && !build_index) {
+        queries = strcmp(queries_path, "-") == 0 ? stdin : fopen(queries_path, "r");
+        if (queries == NULL) {
+            fprintf(stderr, "Error: could not open queries '%s'\n", queries_path);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Everything writes to STDOUT_FILENO, so the output file takes its place
+    // before any mode runs
+    if (output_path != NULL) {
+        int out_fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out_fd < 0 || dup2(out_fd, STDOUT_FILENO) < 0) {
+            fprintf(stderr, "Error: could not open output file '%s'\n", output_path);
+            exit(EXIT_FAILURE);
+        }
+        close(out_fd);
+    }
+
+    if (build_index) {
+        for (int i = 0; i < file_count; i++) {
+            if (bsx_build(filenames[i], index_interval) != 0) {
+                fprintf(stderr, "Error: could not write index for '%s'\n", filenames[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        return EXIT_SUCCESS;
+    }
+
     if (verbose) {
         printf("Verbose mode enabled\n");
-        printf("Target time: %s\n", time_range_str);
-        printf("Processing file: %s\n", filename);
+        if (time_range_str != NULL) {
+            printf("Target time: %s\n", time_range_str);
+        }
+        printf("Timestamp format: %s\n", date_format_name(date_format_get()));
+        for (int i = 0; i < file_count; i++) {
+            printf("Processing file: %s\n", filenames[i]);
+        }
     }
 
-    struct search_range_t range;
-    if (parse_search_range(time_range_str, &range) != 0) {
-        fprintf(stderr, "Error: invalid time format '%s'. Expected format: YYYY-MM-DD HH:MM:SS[+|-|~]<number><unit>\n", time_range_str);
+    if (queries != NULL) {
+        int status = bisect_queries(filenames[0], queries, offsets_only);
+        if (queries != stdin) {
+            fclose(queries);
+        }
+        if (status != 0) {
+            fprintf(stderr, "Error: could not search '%s'\n", filenames[0]);
+            exit(EXIT_FAILURE);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (connect_path != NULL) {
+        if (bisect_request(connect_path, time_range_str, filenames[0], STDOUT_FILENO) != 0) {
+            exit(EXIT_FAILURE);
+        }
+    } else if (binary_records) {
+        if (bisect_binary(filenames[0], range, &binary) != 0) {
+            fprintf(stderr, "Error: could not search '%s'\n", filenames[0]);
+            exit(EXIT_FAILURE);
+        }
+    } else if (rotated) {
+        if (bisect_chain(filenames, file_count, range, jobs) != 0) {
+            fprintf(stderr, "Error: could not search the rotated log '%s'\n", filenames[0]);
+            exit(EXIT_FAILURE);
+        }
+    } else if (sample_count > 0) {
+        if (bisect_sample(filenames[0], range, sample_count, sample_bytes) != 0) {
+            fprintf(stderr, "Error: could not sample '%s'\n", filenames[0]);
+            exit(EXIT_FAILURE);
+        }
+    } else if (histogram_ns > 0) {
+        if (bisect_histogram(filenames[0], range, histogram_ns, count_lines) != 0) {
+            fprintf(stderr, "Error: could not search '%s'\n", filenames[0]);
+            exit(EXIT_FAILURE);
+        }
+    } else if (follow) {
+        if (bisect_follow(filenames[0], range) != 0) {
+            fprintf(stderr, "Error: could not follow '%s'\n", filenames[0]);
+            exit(EXIT_FAILURE);
+        }
+    } else if (grep_pattern != NULL) {
+        if (bisect_grep(filenames[0], range, grep_pattern, jobs) != 0) {
+            fprintf(stderr, "Error: could not search '%s' for '%s'\n", filenames[0], grep_pattern);
+            exit(EXIT_FAILURE);
+        }
+    } else if (file_count > 1) {
+        if (bisect_merge(filenames, file_count, range, jobs) != 0) {
+            fprintf(stderr, "Error: some files could not be searched\n");
+            exit(EXIT_FAILURE);
+        }
+    } else if (bisect(filenames[0], range) != 0) {
+        fprintf(stderr, "Error: could not search '%s'\n", filenames[0]);
         exit(EXIT_FAILURE);
     }
-    bisect(filename, range);
     
     return EXIT_SUCCESS;
 }
-
@@ -0,0 +1,238 @@
+// madvise(MADV_DONTNEED) is not part of POSIX
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include "win.h"
+#else
+#include <sys/mman.h>
+#endif
+
+#include "bisect.h"
+#include "stats.h"
+#include "precise_time.h"
+#include "compressed.h"
+
+// Merged output is gathered into a buffer of this size before each write()
+#define MERGE_OUTPUT_SIZE (256 * 1024)
+// Pages a source has already been merged past are dropped from its mapping
+// in steps of this size, which bounds the memory held per file.
+#define MERGE_RELEASE_STEP (4 * 1024 * 1024)
+
+struct merge_source {
+    struct log_file log;
+    struct log_entry entry;
+    size_t released;
+    int status;  // log_seek() result, -1 when the log could not be read
+};
+
+struct merge_pool {
+    const char **filenames;
+    struct merge_source *sources;
+    size_t count;
+    int64_t start_ns;
+    atomic_size_t next;
+};
+
+struct merge_output {
+    char *buf;
+    size_t len;
+    int failed;
+};
+
+
+static void *merge_worker(void *arg) {
+    struct merge_pool *pool = arg;
+    for (;;) {
+        size_t i = atomic_fetch_add(&pool->next, 1);
+        if (i >= pool->count) {
+            break;
+        }
+        struct merge_source *source = &pool->sources[i];
+        if (log_open(pool->filenames[i], &source->log) < 0) {
+            source->status = -1;
+            continue;
+        }
+        source->status = log_seek(&source->log, pool->start_ns, &source->entry);
+    }
+    log_stats_collect();
+    return NULL;
+}
+
+// Bisects every file on a pool of `jobs` threads
+static void seek_all(struct merge_pool *pool, int jobs) {
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    if ((size_t)jobs > pool->count) {
+        jobs = (int)pool->count;
+    }
+
+    pthread_t *threads = malloc(sizeof(pthread_t) * jobs);
+    int started = 0;
+    // The calling thread takes part as well
+    for (int i = 1; threads && i < jobs; i++) {
+        if (pthread_create(&threads[started], NULL, merge_worker, pool) != 0) {
+            break;
+        }
+        started++;
+    }
+    merge_worker(pool);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
+
+static void output_flush(struct merge_output *out) {
+    if (out->len > 0 && !out->failed && write_all(STDOUT_FILENO, out->buf, out->len) < 0) {
+        out->failed = 1;
+    }
+    out->len = 0;
+}
+
+static void output_append(struct merge_output *out, const char *p, size_t len) {
+    if (out->len + len > MERGE_OUTPUT_SIZE) {
+        output_flush(out);
+    }
+    if (len >= MERGE_OUTPUT_SIZE) {
+        if (!out->failed && write_all(STDOUT_FILENO, p, len) < 0) {
+            out->failed = 1;
+        }
+        return;
+    }
+    memcpy(out->buf + out->len, p, len);
+    out->len += len;
+}
+
+static void release_consumed(struct merge_source *source, size_t page_size) {
+#ifdef MADV_DONTNEED
+    size_t consumed = source->entry.offset - source->entry.offset % page_size;
+    if (consumed - source->released >= MERGE_RELEASE_STEP) {
+        madvise((void *)(source->log.data + source->released), consumed - source->released, MADV_DONTNEED);
+        source->released = consumed;
+    }
+#else
+    (void)source;
+    (void)page_size;
+#endif
+}
+
+// Ties go to the file given first, so the merge is stable
+static bool source_less(const struct merge_source *sources, size_t a, size_t b) {
+    if (sources[a].entry.ns != sources[b].entry.ns) {
+        return sources[a].entry.ns < sources[b].entry.ns;
+    }
+    return a < b;
+}
+
+static void sift_down(size_t *heap, size_t heap_size, const struct merge_source *sources, size_t i) {
+    for (;;) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < heap_size && source_less(sources, heap[left], heap[smallest])) {
+            smallest = left;
+        }
+        if (right < heap_size && source_less(sources, heap[right], heap[smallest])) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        size_t tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+// Bisects every file concurrently, then streams the entries of all of them
+// within range as a single time-ordered output through a k-way heap merge.
+// Compressed logs are only searched one at a time, so they fail the merge
+// before anything is written.
+int bisect_merge(const char **filenames, size_t count, struct search_range_t range, int jobs) {
+    int64_t start_ns = precise_time_to_ns(range.start);
+    int64_t end_ns = precise_time_to_ns(range.end);
+
+    for (size_t i = 0; i < count; i++) {
+        if (detect_compression(filenames[i]) != COMPRESSION_NONE) {
+            return -1;
+        }
+    }
+
+    struct merge_pool pool = {
+        .filenames = filenames,
+        .sources = calloc(count, sizeof(struct merge_source)),
+        .count = count,
+        .start_ns = start_ns,
+    };
+    atomic_init(&pool.next, 0);
+    size_t *heap = malloc(sizeof(size_t) * count);
+    struct merge_output out = {.buf = malloc(MERGE_OUTPUT_SIZE)};
+    if (pool.sources == NULL || heap == NULL || out.buf == NULL) {
+        free(pool.sources);
+        free(heap);
+        free(out.buf);
+        return -1;
+    }
+    // Sources that are never opened still go through log_close()
+    for (size_t i = 0; i < count; i++) {
+        pool.sources[i].log.fd = -1;
+    }
+
+    seek_all(&pool, jobs);
+
+    int result = 0;
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t heap_size = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct merge_source *source = &pool.sources[i];
+        if (source->status < 0) {
+            result = -1;
+        }
+        if (source->status <= 0 || source->entry.ns > end_ns) {
+            continue;
+        }
+        source->released = source->entry.offset - source->entry.offset % page_size;
+        posix_madvise((void *)(source->log.data + source->released), source->log.size - source->released,
+                      POSIX_MADV_SEQUENTIAL);
+        heap[heap_size++] = i;
+    }
+    for (size_t i = heap_size / 2; i-- > 0;) {
+        sift_down(heap, heap_size, pool.sources, i);
+    }
+
+    while (heap_size > 0 && !out.failed) {
+        struct merge_source *source = &pool.sources[heap[0]];
+        size_t entry_start = line_start(source->log.data, source->entry.offset);
+        bool more = log_next_entry(&source->log, &source->entry);
+        size_t entry_end = more ? line_start(source->log.data, source->entry.offset) : source->log.size;
+        output_append(&out, source->log.data + entry_start, entry_end - entry_start);
+        // Keep the last line of a file from running into the next entry
+        if (!more && source->log.data[entry_end - 1] != '\n') {
+            output_append(&out, "\n", 1);
+        }
+
+        if (more && source->entry.ns <= end_ns) {
+            release_consumed(source, page_size);
+        } else {
+            heap[0] = heap[--heap_size];
+        }
+        sift_down(heap, heap_size, pool.sources, 0);
+    }
+    output_flush(&out);
+
+    for (size_t i = 0; i < count; i++) {
+        log_close(&pool.sources[i].log);
+    }
+    free(pool.sources);
+    free(heap);
+    free(out.buf);
+    return out.failed ? -1 : result;
+}
@@ -0,0 +1,224 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include "win.h"
+#else
+#include <sys/mman.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#include "bisect.h"
+#include "stats.h"
+
+// The fallback hands the kernel up to OUTPUT_IOV_COUNT slices of the mapping
+// of OUTPUT_IOV_SIZE bytes each per writev()
+#define OUTPUT_IOV_SIZE (1024 * 1024)
+#define OUTPUT_IOV_COUNT 16
+
+size_t count_newlines(const char *p, size_t len) {
+    size_t count = 0;
+    const char *end = p + len;
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+        count++;
+        p++;
+    }
+    return count;
+}
+
+// Offset of the start of the line holding byte pos. Timestamps need not
+// open their line, so ranges are cut here rather than at the entry's date.
+size_t line_start(const char *data, size_t pos) {
+    while (pos > 0 && data[pos - 1] != '\n') {
+        pos--;
+    }
+    return pos;
+}
+
+int write_all(int fd, const char *p, size_t len) {
+    int64_t started = stats_clock();
+    if (log_stats_enabled) {
+        log_stats.lines_written += count_newlines(p, len);
+    }
+    while (len > 0) {
+        log_stats.syscalls++;
+        ssize_t written = write(fd, p, len);
+        if (written < 0) {
+            return -1;
+        }
+        log_stats.bytes_written += written;
+        p += written;
+        len -= written;
+    }
+    stats_elapsed(&log_stats.output_ns, started);
+    return 0;
+}
+
+// posix_madvise() wants a page-aligned address
+static void advise_range(const char *data, size_t file_size, size_t from, size_t len, int advice) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t aligned = from - from % page_size;
+    if (aligned >= file_size) {
+        return;
+    }
+    if (len > file_size - aligned) {
+        len = file_size - aligned;
+    }
+    posix_madvise((void *)(data + aligned), len + (from - aligned), advice);
+}
+
+// Turns read-ahead back on for [from, to) of the mapping, which is opened
+// for random access, before a front-to-back pass over it
+void advise_sequential(const struct log_file *log, size_t from, size_t to) {
+    advise_range(log->data, log->size, from, to - from, POSIX_MADV_SEQUENTIAL);
+    advise_range(log->data, log->size, from, OUTPUT_IOV_SIZE, POSIX_MADV_WILLNEED);
+}
+
+// Has [from, to) of the mapping read in ahead of a pass over it that does not
+// run front to back, which read-ahead would not follow
+void advise_willneed(const struct log_file *log, size_t from, size_t to) {
+    advise_range(log->data, log->size, from, to - from, POSIX_MADV_WILLNEED);
+}
+
+static int output_writev(const struct log_file *log, size_t from, size_t to, int out_fd) {
+    advise_sequential(log, from, to);
+
+#if defined(_WIN32) || defined(_WIN64)
+    // No writev() on Windows
+    return write_all(out_fd, log->data + from, to - from);
+#else
+    while (from < to) {
+        struct iovec iov[OUTPUT_IOV_COUNT];
+        int count = 0;
+        for (size_t pos = from; count < OUTPUT_IOV_COUNT && pos < to; count++) {
+            size_t len = to - pos < OUTPUT_IOV_SIZE ? to - pos : OUTPUT_IOV_SIZE;
+            iov[count].iov_base = (void *)(log->data + pos);
+            iov[count].iov_len = len;
+            pos += len;
+        }
+        log_stats.syscalls++;
+        ssize_t written = writev(out_fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        from += written;
+    }
+    return 0;
+#endif
+}
+
+#ifdef __linux__
+
+// The errors with which the zero-copy calls turn down a pair of descriptors;
+// the next method is tried instead
+static bool zero_copy_unsupported(int err) {
+    return err == EINVAL || err == ENOSYS || err == EXDEV || err == EOPNOTSUPP || err == EBADF;
+}
+
+enum zero_copy_method {
+    ZERO_COPY_FILE_RANGE,
+    ZERO_COPY_SPLICE,
+    ZERO_COPY_SENDFILE,
+};
+
+// Copies [*offset, to) with one method. Returns 0 when done, 1 when the
+// method does not apply to these descriptors, and -1 on error. *offset is
+// left after the bytes that were copied.
+static int zero_copy(enum zero_copy_method method, int in_fd, off_t *offset, size_t to, int out_fd) {
+    while ((size_t)*offset < to) {
+        // Stay below the 2 GB the kernel moves per call at most
+        size_t len = to - *offset < (size_t)INT_MAX ? to - *offset : (size_t)INT_MAX;
+        ssize_t copied;
+        log_stats.syscalls++;
+        switch (method) {
+            case ZERO_COPY_FILE_RANGE:
+                copied = copy_file_range(in_fd, offset, out_fd, NULL, len, 0);
+                break;
+            case ZERO_COPY_SPLICE:
+                copied = splice(in_fd, offset, out_fd, NULL, len, SPLICE_F_MORE);
+                break;
+            default:
+                copied = sendfile(out_fd, in_fd, offset, len);
+                break;
+        }
+        if (copied < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return zero_copy_unsupported(errno) ? 1 : -1;
+        }
+        if (copied == 0) {
+            // The log shrank underneath us; let the mapping tell
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#endif // __linux__
+
+// Writes bytes [from, to) of the log to out_fd. The kernel copies them
+// straight from the page cache where it can: copy_file_range() into a
+// regular file, splice() into a pipe and sendfile() into anything else.
+// Other targets are written from the mapping with writev().
+static int write_range(const struct log_file *log, size_t from, size_t to, int out_fd) {
+#ifdef __linux__
+    log_stats.syscalls += 2;
+    posix_fadvise(log->fd, from, to - from, POSIX_FADV_SEQUENTIAL);
+
+    struct stat st;
+    bool regular = false;
+    bool pipe = false;
+    if (fstat(out_fd, &st) == 0) {
+        regular = S_ISREG(st.st_mode);
+        pipe = S_ISFIFO(st.st_mode);
+    }
+
+    off_t offset = from;
+    int status = 1;
+    if (regular) {
+        status = zero_copy(ZERO_COPY_FILE_RANGE, log->fd, &offset, to, out_fd);
+    }
+    if (status > 0 && pipe) {
+        status = zero_copy(ZERO_COPY_SPLICE, log->fd, &offset, to, out_fd);
+    }
+    if (status > 0) {
+        status = zero_copy(ZERO_COPY_SENDFILE, log->fd, &offset, to, out_fd);
+    }
+    if (status <= 0) {
+        return status;
+    }
+    from = offset;
+#endif
+
+    return output_writev(log, from, to, out_fd);
+}
+
+int output_range(const struct log_file *log, size_t from, size_t to, int out_fd) {
+    if (from >= to) {
+        return 0;
+    }
+    int64_t started = stats_clock();
+    int result = write_range(log, from, to, out_fd);
+    if (result == 0) {
+        log_stats.bytes_written += to - from;
+        if (log_stats_enabled) {
+            log_stats.lines_written += count_newlines(log->data + from, to - from);
+        }
+    }
+    stats_elapsed(&log_stats.output_ns, started);
+    return result;
+}
@@ -1,5 +1,6 @@
 #include "precise_time.h"
-#include <regex.h>
+#include "date_scan.h"
+#include "stats.h"
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -9,15 +10,16 @@
 #include "win.h"
 #endif
 
-regex_t regex_datetime;
-char *regex_pattern = "[0-9]{4}-[0-9]{2}-[0-9]{2} [0-9]{2}:[0-9]{2}:[0-9]{2}([\\.,][0-9]{1,9})?";
-
 
 char *precise_time_to_string(precise_time_t t) {
-    struct tm *tm_info = localtime(&t.seconds);
+    struct tm tm_info;
     char *buffer = malloc(40);  // enough for timestamp + up to 9 digits of fractional seconds
+    if (buffer && localtime_r(&t.seconds, &tm_info) == NULL) {
+        free(buffer);
+        return NULL;
+    }
     if (buffer) {
-        size_t len = strftime(buffer, 40, "%Y-%m-%d %H:%M:%S", tm_info);
+        size_t len = strftime(buffer, 40, "%Y-%m-%d %H:%M:%S", &tm_info);
         if (t.nanoseconds > 0) {
             // Format nanoseconds, removing trailing zeros
             long ns = t.nanoseconds;
@@ -32,89 +34,334 @@ char *precise_time_to_string(precise_time_t t) {
     return buffer;
 }
 
-precise_time_t string_to_precise_time(const char *str) {
-    precise_time_t result = {0, 0};
+// Per-thread cache of local-time-to-UTC offsets, one slot per wall-clock hour.
+// mktime() consults the timezone rules, so it runs once per hour of log
+// instead of once per line.
+#define TZ_TABLE_SIZE 64
+
+struct tz_slot {
+    int64_t local_hour;
+    int64_t offset;
+    bool valid;
+};
+
+static _Thread_local struct tz_slot tz_table[TZ_TABLE_SIZE];
+
+// Consecutive lines almost always share the "YYYY-MM-DD HH:MM" prefix
+struct minute_memo {
+    char prefix[16];
+    int64_t seconds;
+    bool valid;
+};
+
+static _Thread_local struct minute_memo minute_memo;
+
+static inline int two_digits(const char *p) {
+    return (p[0] - '0') * 10 + (p[1] - '0');
+}
+
+// Days since 1970-01-01 in the proleptic Gregorian calendar
+static int64_t days_from_civil(int64_t y, int m, int d) {
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static int64_t local_offset(int64_t local_seconds, int year, int month, int day, int hour) {
+    int64_t local_hour = local_seconds >= 0 ? local_seconds / 3600 : (local_seconds - 3599) / 3600;
+    struct tz_slot *slot = &tz_table[(uint64_t)local_hour % TZ_TABLE_SIZE];
+    if (slot->valid && slot->local_hour == local_hour) {
+        return slot->offset;
+    }
+
     struct tm tms = {0};
+    tms.tm_year = year - 1900;
+    tms.tm_mon = month - 1;
+    tms.tm_mday = day;
+    tms.tm_hour = hour;
     tms.tm_isdst = -1; // Let mktime determine if DST is in effect
-    char *end_ptr;
-    
-    // Parse the base date/time
-    end_ptr = strptime(str, "%Y-%m-%d %H:%M:%S", &tms);
-    if (end_ptr == NULL) {
-        fprintf(stderr, "Error parsing date string: %s\n", str);
-        result.seconds = -1;
-        return result;
+    time_t utc = mktime(&tms);
+
+    slot->local_hour = local_hour;
+    slot->offset = local_hour * 3600 - (int64_t)utc;
+    slot->valid = true;
+    return slot->offset;
+}
+
+// Describes the rules local timestamps are converted with, so that what was
+// derived from them under other rules can be told apart: TZ, the zone names
+// and the offsets in January and July
+void local_zone_describe(char *buffer, size_t len) {
+    tzset();
+    const char *tz = getenv("TZ");
+    int64_t offsets[2];
+    for (int i = 0; i < 2; i++) {
+        // Not from tz_table, which outlives a change of TZ
+        struct tm tms = {.tm_year = 125, .tm_mon = i * 6, .tm_mday = 1, .tm_isdst = -1};
+        offsets[i] = days_from_civil(2025, i * 6 + 1, 1) * 86400 - (int64_t)mktime(&tms);
+    }
+    snprintf(buffer, len, "%s %s/%s %lld/%lld", tz != NULL ? tz : "-", tzname[0], tzname[1], (long long)offsets[0],
+             (long long)offsets[1]);
+}
+
+// Converts a timestamp matched by match_date_at() at p to nanoseconds since
+// the epoch, treating it as local time. Returns PRECISE_NS_INVALID when a
+// field is out of range.
+static int64_t parse_default_ns(const char *p, size_t len) {
+    if (len < 19) {
+        return PRECISE_NS_INVALID;
     }
-    
-    result.seconds = mktime(&tms);
 
-    // Check for fractional seconds
-    if (*end_ptr == '.' || *end_ptr == ',') {
-        end_ptr++;
-        char frac_str[10] = {0};  // max 9 digits for nanoseconds
-        int i = 0;
-        while (*end_ptr >= '0' && *end_ptr <= '9' && i < 9) {
-            frac_str[i++] = *end_ptr++;
+    int64_t minute_seconds;
+    if (minute_memo.valid && memcmp(minute_memo.prefix, p, sizeof(minute_memo.prefix)) == 0) {
+        minute_seconds = minute_memo.seconds;
+    } else {
+        int year = two_digits(p) * 100 + two_digits(p + 2);
+        int month = two_digits(p + 5);
+        int day = two_digits(p + 8);
+        int hour = two_digits(p + 11);
+        int minute = two_digits(p + 14);
+        if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59) {
+            return PRECISE_NS_INVALID;
         }
-        
-        if (i > 0) {
-            long frac = atol(frac_str);
-            // Convert to nanoseconds
-            while (i < 9) {
-                frac *= 10;
-                i++;
-            }
-            result.nanoseconds = frac;
+
+        int64_t local = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60;
+        minute_seconds = local - local_offset(local, year, month, day, hour);
+
+        memcpy(minute_memo.prefix, p, sizeof(minute_memo.prefix));
+        minute_memo.seconds = minute_seconds;
+        minute_memo.valid = true;
+    }
+
+    int second = two_digits(p + 17);
+    if (second > 60) {
+        return PRECISE_NS_INVALID;
+    }
+
+    int64_t frac = 0;
+    size_t digits = 0;
+    for (size_t i = 20; i < len && digits < 9; i++, digits++) {
+        frac = frac * 10 + (p[i] - '0');
+    }
+    for (; digits < 9; digits++) {
+        frac *= 10;
+    }
+
+    return (minute_seconds + second) * NS_PER_SECOND + frac;
+}
+
+// Up to 9 fraction digits from p to end, scaled to nanoseconds
+static int64_t parse_fraction(const char *p, const char *end) {
+    int64_t frac = 0;
+    int digits = 0;
+    for (; p < end && digits < 9 && *p >= '0' && *p <= '9'; p++, digits++) {
+        frac = frac * 10 + (*p - '0');
+    }
+    for (; digits < 9; digits++) {
+        frac *= 10;
+    }
+    return frac;
+}
+
+// Seconds from UTC of a "+hh:mm", "+hhmm" or "Z" zone, none for a missing one
+static int64_t zone_offset(const char *p, const char *end) {
+    if (end - p < 5 || (*p != '+' && *p != '-') || (p[3] == ':' && end - p < 6)) {
+        return 0;
+    }
+    int minutes = two_digits(p + 1) * 60 + two_digits(p[3] == ':' ? p + 4 : p + 3);
+    return (*p == '-' ? -minutes : minutes) * 60;
+}
+
+// ISO-8601. A timestamp with a zone is converted with plain arithmetic, one
+// without it is local time like the default format.
+static int64_t parse_iso_ns(const char *p, size_t len) {
+    if (len < 19) {
+        return PRECISE_NS_INVALID;
+    }
+    const char *end = p + len;
+    const char *zone = p + 19;
+    if (zone < end && (*zone == '.' || *zone == ',')) {
+        zone++;
+        while (zone < end && *zone >= '0' && *zone <= '9') {
+            zone++;
         }
     }
-    
+    if (zone == end) {
+        return parse_default_ns(p, len);
+    }
+
+    int year = two_digits(p) * 100 + two_digits(p + 2);
+    int month = two_digits(p + 5);
+    int day = two_digits(p + 8);
+    int hour = two_digits(p + 11);
+    int minute = two_digits(p + 14);
+    int second = two_digits(p + 17);
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) {
+        return PRECISE_NS_INVALID;
+    }
+    int64_t seconds = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+    int64_t frac = zone > p + 20 ? parse_fraction(p + 20, zone) : 0;
+    return (seconds - zone_offset(zone, end)) * NS_PER_SECOND + frac;
+}
+
+// The year syslog leaves out is taken to be the current one
+static int current_year(void) {
+    static _Thread_local int year;
+    if (year == 0) {
+        time_t now = time(NULL);
+        struct tm tm_now;
+        year = localtime_r(&now, &tm_now) != NULL ? tm_now.tm_year + 1900 : 1970;
+    }
+    return year;
+}
+
+static int64_t parse_syslog_ns(const char *p, size_t len) {
+    if (len < 15) {
+        return PRECISE_NS_INVALID;
+    }
+    int month = month_index(p) + 1;
+    int day = (p[4] == ' ' ? 0 : p[4] - '0') * 10 + (p[5] - '0');
+    int hour = two_digits(p + 7);
+    int minute = two_digits(p + 10);
+    int second = two_digits(p + 13);
+    if (month < 1 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) {
+        return PRECISE_NS_INVALID;
+    }
+    int year = current_year();
+    int64_t local = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60;
+    return (local - local_offset(local, year, month, day, hour) + second) * NS_PER_SECOND;
+}
+
+// dd/Mmm/YYYY:HH:MM:SS +hhmm, converted with plain arithmetic
+static int64_t parse_clf_ns(const char *p, size_t len) {
+    if (len < 26) {
+        return PRECISE_NS_INVALID;
+    }
+    int day = two_digits(p);
+    int month = month_index(p + 3) + 1;
+    int year = two_digits(p + 7) * 100 + two_digits(p + 9);
+    int hour = two_digits(p + 12);
+    int minute = two_digits(p + 15);
+    int second = two_digits(p + 18);
+    if (month < 1 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) {
+        return PRECISE_NS_INVALID;
+    }
+    int64_t seconds = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+    return (seconds - zone_offset(p + 21, p + len)) * NS_PER_SECOND;
+}
+
+// Seconds, with an optional fraction, or milliseconds since the epoch
+static int64_t parse_epoch_ns(const char *p, size_t len, int64_t unit_ns) {
+    int64_t value = 0;
+    size_t i = 0;
+    for (; i < len && p[i] >= '0' && p[i] <= '9'; i++) {
+        value = value * 10 + (p[i] - '0');
+    }
+    int64_t frac = i + 1 < len && p[i] == '.' ? parse_fraction(p + i + 1, p + len) : 0;
+    return value * unit_ns + frac;
+}
+
+// A timestamp matched in a JSON value: a string in the ISO-8601 or default
+// format, or a number whose digits tell seconds, milliseconds, microseconds
+// or nanoseconds apart
+static int64_t parse_json_ns(const char *p, size_t len) {
+    if (len >= 19 && p[4] == '-') {
+        return parse_iso_ns(p, len);
+    }
+    size_t digits = 0;
+    while (digits < len && p[digits] >= '0' && p[digits] <= '9') {
+        digits++;
+    }
+    int64_t unit_ns = digits <= 11 ? NS_PER_SECOND : digits <= 14 ? 1000000 : digits <= 17 ? 1000 : 1;
+    return parse_epoch_ns(p, len, unit_ns);
+}
+
+// Converts a timestamp found by scan_date() at p to nanoseconds since the
+// epoch, with the parser of the current format. Returns PRECISE_NS_INVALID
+// when a field is out of range.
+int64_t parse_date_ns(const char *p, size_t len) {
+    log_stats.date_parses++;
+    switch (date_format_get()) {
+        case DATE_FORMAT_ISO8601:
+            return parse_iso_ns(p, len);
+        case DATE_FORMAT_SYSLOG:
+            return parse_syslog_ns(p, len);
+        case DATE_FORMAT_CLF:
+            return parse_clf_ns(p, len);
+        case DATE_FORMAT_EPOCH:
+            return parse_epoch_ns(p, len, NS_PER_SECOND);
+        case DATE_FORMAT_EPOCH_MS:
+            return parse_epoch_ns(p, len, NS_PER_SECOND / 1000);
+        case DATE_FORMAT_JSON:
+            return parse_json_ns(p, len);
+        default:
+            return parse_default_ns(p, len);
+    }
+}
+
+int64_t precise_time_to_ns(precise_time_t t) {
+    return (int64_t)t.seconds * NS_PER_SECOND + t.nanoseconds;
+}
+
+precise_time_t ns_to_precise_time(int64_t ns) {
+    int64_t seconds = ns / NS_PER_SECOND;
+    int64_t nanoseconds = ns % NS_PER_SECOND;
+    if (nanoseconds < 0) {
+        seconds--;
+        nanoseconds += NS_PER_SECOND;
+    }
+    precise_time_t result = {(time_t)seconds, (long)nanoseconds};
     return result;
 }
 
+precise_time_t string_to_precise_time(const char *str) {
+    precise_time_t result = {-1, 0};
+    size_t len = match_date_at(str, strnlen(str, MAX_DATE_LENGTH));
+    int64_t ns = len > 0 ? parse_default_ns(str, len) : PRECISE_NS_INVALID;
+    if (ns == PRECISE_NS_INVALID) {
+        fprintf(stderr, "Error parsing date string: %s\n", str);
+        return result;
+    }
+    return ns_to_precise_time(ns);
+}
+
 time_t string_to_time_t(const char *str) {
     precise_time_t pt = string_to_precise_time(str);
     return pt.seconds;
 }
 
 int find_date_in_buffer(const char *buffer) {
-    int reti;
-    regmatch_t pmatch[1];
-
-    reti = regexec(&regex_datetime, buffer, 1, pmatch, 0);
-    if (reti == 0) {
-        return pmatch[0].rm_so;
+    size_t offset, date_len;
+    if (scan_date(buffer, strlen(buffer), &offset, &date_len)) {
+        return (int)offset;
     }
     return -1;
 }
 
 // Extract date string from buffer and return its length
 int extract_date_string(const char *buffer, int offset, char *date_str, size_t max_len) {
-    regmatch_t pmatch[1];
-    int reti = regexec(&regex_datetime, buffer + offset, 1, pmatch, 0);
-    if (reti == 0 && pmatch[0].rm_so == 0) {
-        int len = pmatch[0].rm_eo - pmatch[0].rm_so;
-        if (len >= (int)max_len) len = (int)max_len - 1;
-        strncpy(date_str, buffer + offset, len);
-        date_str[len] = '\0';
-        return len;
+    const char *p = buffer + offset;
+    int len = (int)match_date_at(p, strnlen(p, MAX_DATE_LENGTH));
+    if (len == 0) {
+        return -1;
     }
-    return -1;
+    if (len >= (int)max_len) len = (int)max_len - 1;
+    memcpy(date_str, p, len);
+    date_str[len] = '\0';
+    return len;
 }
 
 bool precise_less(precise_time_t a, precise_time_t b) {
-    if (a.seconds < b.seconds) return true;
-    if (a.seconds > b.seconds) return false;
-    return a.nanoseconds < b.nanoseconds;
+    return precise_time_to_ns(a) < precise_time_to_ns(b);
 }
 
 bool precise_less_equal(precise_time_t a, precise_time_t b) {
-    if (a.seconds < b.seconds) return true;
-    if (a.seconds > b.seconds) return false;
-    return a.nanoseconds <= b.nanoseconds;
+    return precise_time_to_ns(a) <= precise_time_to_ns(b);
 }
 
 bool precise_greater(precise_time_t a, precise_time_t b) {
-    if (a.seconds > b.seconds) return true;
-    if (a.seconds < b.seconds) return false;
-    return a.nanoseconds > b.nanoseconds;
+    return precise_time_to_ns(a) > precise_time_to_ns(b);
 }
@@ -2,6 +2,7 @@
 #define TIME_TYPES_H
 
 #include <time.h>
+#include <stdint.h>
 #include <stdbool.h>
 
 typedef struct {
@@ -9,9 +10,17 @@ typedef struct {
     long nanoseconds;  // fractional seconds in nanoseconds (0-999999999)
 } precise_time_t;
 
+// Timestamps are compared as a single count of nanoseconds since the epoch
+#define PRECISE_NS_INVALID INT64_MIN
+#define NS_PER_SECOND 1000000000LL
+
 char *precise_time_to_string(precise_time_t t);
 precise_time_t string_to_precise_time(const char *str);
 time_t string_to_time_t(const char *str);
+int64_t parse_date_ns(const char *p, size_t len);
+int64_t precise_time_to_ns(precise_time_t t);
+void local_zone_describe(char *buffer, size_t len);
+precise_time_t ns_to_precise_time(int64_t ns);
 int find_date_in_buffer(const char *buffer);
 int extract_date_string(const char *buffer, int offset, char *date_str, size_t max_len);
 bool precise_less(precise_time_t a, precise_time_t b);
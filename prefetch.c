@@ -0,0 +1,248 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "prefetch.h"
+#include "stats.h"
+
+#define PREFETCH_RING_ENTRIES 32
+// Room for the completions of the last search and the current one, which
+// are only drained when reads are submitted
+#define PREFETCH_CQ_ENTRIES (4 * PREFETCH_MAX)
+#define PREFETCH_READ_SIZE 8192
+
+// Set once probes have waited long enough for storage that reading ahead
+// pays off. Shared by all threads: they read the same storage.
+static atomic_bool storage_slow;
+
+// Notes how long a probe took; *slow_probes counts the slow ones of the
+// current search. More than one is needed, so that a thread being preempted
+// once does not pass for slow storage. Returns true once probes have shown
+// the storage to be slow.
+bool prefetch_observe(int64_t probe_ns, int *slow_probes) {
+    if (probe_ns >= PREFETCH_MIN_LATENCY_NS && ++*slow_probes >= PREFETCH_SLOW_PROBES) {
+        atomic_store_explicit(&storage_slow, true, memory_order_relaxed);
+    }
+    return prefetch_worthwhile();
+}
+
+bool prefetch_worthwhile(void) {
+    return atomic_load_explicit(&storage_slow, memory_order_relaxed);
+}
+
+#ifdef __linux__
+
+struct prefetch_ring {
+    int fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;              // the same mapping as sq_ring on recent kernels
+    size_t cq_ring_size;
+    void *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned entries;
+    unsigned queued;            // entries not taken by the kernel yet
+};
+
+// Reads only warm the page cache; every one of them lands here and is never
+// looked at, so no read ever has to be waited for
+static char prefetch_sink[PREFETCH_READ_SIZE];
+
+// Each thread sets up its ring on first use and closes it when it exits
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static _Thread_local struct prefetch_ring *thread_ring;
+static _Thread_local bool thread_ring_failed;
+
+// True when the page holding offset has to come from storage
+bool prefetch_wanted(const struct log_file *log, size_t offset) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    unsigned char resident;
+    log_stats.syscalls++;
+    return mincore((void *)(log->data + offset - offset % page_size), 1, &resident) == 0 && !(resident & 1);
+}
+
+static void ring_close(void *arg) {
+    struct prefetch_ring *ring = arg;
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != NULL) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    close(ring->fd);
+    free(ring);
+}
+
+static void ring_key_create(void) {
+    pthread_key_create(&ring_key, ring_close);
+}
+
+static void *ring_map(struct prefetch_ring *ring, size_t size, off_t offset) {
+    log_stats.syscalls++;
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, offset);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+// Sets up an io_uring without liburing. Returns NULL when the kernel does
+// not offer one.
+static struct prefetch_ring *ring_open(void) {
+    struct prefetch_ring *ring = calloc(1, sizeof(*ring));
+    if (ring == NULL) {
+        return NULL;
+    }
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = PREFETCH_CQ_ENTRIES;
+    log_stats.syscalls++;
+    ring->fd = (int)syscall(__NR_io_uring_setup, PREFETCH_RING_ENTRIES, &params);
+    if (ring->fd < 0) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && ring->cq_ring_size > ring->sq_ring_size) {
+        ring->sq_ring_size = ring->cq_ring_size;
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq_ring = ring_map(ring, ring->sq_ring_size, IORING_OFF_SQ_RING);
+    ring->cq_ring = single ? ring->sq_ring : ring_map(ring, ring->cq_ring_size, IORING_OFF_CQ_RING);
+    ring->sqes = ring_map(ring, ring->sqes_size, IORING_OFF_SQES);
+    if (ring->sq_ring == NULL || ring->cq_ring == NULL || ring->sqes == NULL) {
+        ring_close(ring);
+        return NULL;
+    }
+
+    char *sq = ring->sq_ring;
+    char *cq = ring->cq_ring;
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->entries = params.sq_entries;
+    return ring;
+}
+
+static struct prefetch_ring *thread_ring_get(void) {
+    if (thread_ring == NULL && !thread_ring_failed) {
+        pthread_once(&ring_key_once, ring_key_create);
+        thread_ring = ring_open();
+        thread_ring_failed = thread_ring == NULL || pthread_setspecific(ring_key, thread_ring) != 0;
+        if (thread_ring_failed && thread_ring != NULL) {
+            ring_close(thread_ring);
+            thread_ring = NULL;
+        }
+    }
+    return thread_ring;
+}
+
+void prefetch_start(const struct log_file *log, struct prefetcher *p) {
+    p->fd = log->fd;
+    p->ring = thread_ring_get();
+    p->issued_count = 0;
+}
+
+// Queues a read of [offset, offset + len) unless this search already asked
+// for it
+void prefetch_add(struct prefetcher *p, size_t offset, size_t len) {
+    if (p->issued_count == PREFETCH_MAX) {
+        return;
+    }
+    for (size_t i = 0; i < p->issued_count; i++) {
+        if (p->issued[i] == offset) {
+            return;
+        }
+    }
+    p->issued[p->issued_count++] = offset;
+    log_stats.prefetches++;
+    len = len < PREFETCH_READ_SIZE ? len : PREFETCH_READ_SIZE;
+
+    struct prefetch_ring *ring = p->ring;
+    if (ring != NULL && ring->queued == ring->entries) {
+        prefetch_submit(p);
+    }
+    if (ring == NULL || ring->queued == ring->entries) {
+        log_stats.syscalls++;
+        posix_fadvise(p->fd, (off_t)offset, (off_t)len, POSIX_FADV_WILLNEED);
+        return;
+    }
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &((struct io_uring_sqe *)ring->sqes)[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = p->fd;
+    sqe->off = offset;
+    sqe->addr = (uintptr_t)prefetch_sink;
+    sqe->len = (unsigned)len;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+}
+
+// Starts the queued reads without waiting for them. Their completions are
+// dropped: a probe that needs the data faults it in from the page cache, or
+// waits on the read still in flight.
+void prefetch_submit(struct prefetcher *p) {
+    struct prefetch_ring *ring = p->ring;
+    if (ring == NULL || ring->queued == 0) {
+        return;
+    }
+    log_stats.syscalls++;
+    // Entries the kernel does not take stay queued for the next call
+    long submitted = syscall(__NR_io_uring_enter, ring->fd, ring->queued, 0, 0, NULL, 0);
+    if (submitted > 0) {
+        ring->queued -= (unsigned)submitted;
+    }
+    __atomic_store_n(ring->cq_head, __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
+
+#else
+
+bool prefetch_wanted(const struct log_file *log, size_t offset) {
+    (void)log;
+    (void)offset;
+    return false;
+}
+
+void prefetch_start(const struct log_file *log, struct prefetcher *p) {
+    p->fd = log->fd;
+    p->ring = NULL;
+    p->issued_count = 0;
+}
+
+void prefetch_add(struct prefetcher *p, size_t offset, size_t len) {
+    (void)p;
+    (void)offset;
+    (void)len;
+}
+
+void prefetch_submit(struct prefetcher *p) {
+    (void)p;
+}
+
+#endif // __linux__
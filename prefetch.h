@@ -0,0 +1,39 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bisect.h"
+
+// Blocks read ahead during one search at most
+#define PREFETCH_MAX 64
+
+// Storage slower than this per read is worth reading ahead of: well above
+// local flash, below network block devices and disks
+#define PREFETCH_MIN_LATENCY_NS 250000
+// Probes of one search that must take that long
+#define PREFETCH_SLOW_PROBES 2
+
+struct prefetch_ring;
+
+// Reads blocks of a log into the page cache ahead of the probes that may
+// touch them, so that a search on slow storage waits for several reads at
+// once rather than for one after the other. Reads go through an io_uring
+// when the kernel offers one and through posix_fadvise() otherwise.
+struct prefetcher {
+    int fd;
+    struct prefetch_ring *ring;     // the calling thread's, NULL without io_uring
+    size_t issued[PREFETCH_MAX];    // offsets already asked for
+    size_t issued_count;
+};
+
+bool prefetch_wanted(const struct log_file *log, size_t offset);
+bool prefetch_observe(int64_t probe_ns, int *slow_probes);
+bool prefetch_worthwhile(void);
+void prefetch_start(const struct log_file *log, struct prefetcher *p);
+void prefetch_add(struct prefetcher *p, size_t offset, size_t len);
+void prefetch_submit(struct prefetcher *p);
+
+#endif // PREFETCH_H
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bisect.h"
+#include "compressed.h"
+#include "date_scan.h"
+#include "precise_time.h"
+
+// The offset of the line of the first entry starting at or after pos, or the
+// size of the log when there is none
+static size_t entry_at_or_after(const struct log_file *log, size_t pos) {
+    if (pos > 0 && pos < log->size && log->data[pos - 1] != '\n') {
+        const char *newline = memchr(log->data + pos, '\n', log->size - pos);
+        pos = newline != NULL ? (size_t)(newline - log->data) + 1 : log->size;
+    }
+    size_t date_offset, date_len;
+    if (pos >= log->size || !scan_date(log->data + pos, log->size - pos, &date_offset, &date_len)) {
+        return log->size;
+    }
+    return line_start(log->data, pos + date_offset);
+}
+
+// The end of the entry whose line starts at from: the line of the next
+// timestamp, or the end of the log
+static size_t entry_end(const struct log_file *log, size_t from) {
+    size_t date_offset, date_len;
+    if (!scan_date(log->data + from, log->size - from, &date_offset, &date_len)) {
+        return log->size;
+    }
+    struct log_entry entry = {.offset = from + date_offset, .date_len = date_len};
+    return log_next_entry(log, &entry) ? line_start(log->data, entry.offset) : log->size;
+}
+
+// Finds the lines of the count sample entries, followed by the end of the
+// range. In time, sample i is the first entry at or after start + i * (end -
+// start) / count: the samples and the end are searched together, so the
+// probes near the top of the search are made once. In bytes, it is the first
+// entry after the same fraction of the range's bytes, a scan of a line or so
+// once both ends are found.
+static int locate_samples(const struct log_file *log, int64_t start_ns, int64_t end_ns, size_t count,
+                          bool by_bytes, size_t *samples) {
+    if (by_bytes) {
+        int64_t bounds[2] = {start_ns, end_ns + 1};
+        size_t range[2];
+        if (log_seek_many(log, bounds, 2, range) < 0) {
+            return -1;
+        }
+        size_t span = range[1] > range[0] ? range[1] - range[0] : 0;
+        for (size_t i = 0; i < count; i++) {
+            size_t pos = range[0] + span / count * i + span % count * i / count;
+            samples[i] = i > 0 ? entry_at_or_after(log, pos) : range[0];
+        }
+        samples[count] = range[1];
+        return 0;
+    }
+
+    int64_t *keys = malloc(sizeof(int64_t) * (count + 1));
+    if (keys == NULL) {
+        return -1;
+    }
+    // The keys rise with i, all below end_ns + 1; splitting the step keeps
+    // every product small
+    uint64_t span = (uint64_t)end_ns - (uint64_t)start_ns;
+    size_t distinct = 0;
+    for (size_t i = 0; i <= count; i++) {
+        int64_t key = i < count ? (int64_t)((uint64_t)start_ns + span / count * i + span % count * i / count)
+                                : end_ns + 1;
+        if (distinct == 0 || keys[distinct - 1] != key) {
+            keys[distinct++] = key;
+        }
+    }
+    int result = log_seek_many(log, keys, distinct, samples);
+    // Keys dropped as duplicates leave their samples at the end of the range
+    for (size_t i = distinct; result == 0 && i <= count; i++) {
+        samples[i] = samples[distinct - 1];
+    }
+    free(keys);
+    return result;
+}
+
+// Writes count entries spread evenly across the range, in time or, with
+// by_bytes, in bytes, as a quick overview of a range too large to read. Each
+// entry is found by a search of its own; none of the range is read beyond
+// the sampled entries. Sparse ranges yield fewer entries, each written once.
+int bisect_sample(const char *filename, struct search_range_t range, size_t count, bool by_bytes) {
+    int64_t start_ns = precise_time_to_ns(range.start);
+    int64_t end_ns = precise_time_to_ns(range.end);
+
+    if (count == 0 || detect_compression(filename) != COMPRESSION_NONE) {
+        return -1;
+    }
+    size_t *samples = malloc(sizeof(size_t) * (count + 1));
+    if (samples == NULL) {
+        return -1;
+    }
+    struct log_file log;
+    if (log_open(filename, &log) < 0) {
+        free(samples);
+        return -1;
+    }
+
+    int result = end_ns < start_ns ? 0 : locate_samples(&log, start_ns, end_ns, count, by_bytes, samples);
+    size_t written = 0;
+    for (size_t i = 0; result == 0 && i < count && end_ns >= start_ns; i++) {
+        // The range ends at samples[count]; an entry already written is skipped
+        if (samples[i] >= samples[count] || samples[i] < written) {
+            continue;
+        }
+        size_t to = entry_end(&log, samples[i]);
+        to = to < samples[count] ? to : samples[count];
+        result = output_range(&log, samples[i], to, STDOUT_FILENO);
+        written = to;
+    }
+
+    log_close(&log);
+    free(samples);
+    return result;
+}
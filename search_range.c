@@ -16,6 +16,35 @@ bool is_valid_offset_unit(char unit) {
     return unit == 's' || unit == 'm' || unit == 'h' || unit == 'd';
 }
 
+// Parses a positive length of time such as 30s, 5m, 1h, 1d or 500ms
+int parse_duration(const char *str, int64_t *ns) {
+    char *unit;
+    long long value = strtoll(str, &unit, 10);
+    if (unit == str || value <= 0) {
+        return -1;
+    }
+
+    int64_t scale;
+    if (strcmp(unit, "ms") == 0) {
+        scale = NS_PER_SECOND / 1000;
+    } else if (strcmp(unit, "s") == 0) {
+        scale = NS_PER_SECOND;
+    } else if (strcmp(unit, "m") == 0) {
+        scale = 60 * NS_PER_SECOND;
+    } else if (strcmp(unit, "h") == 0) {
+        scale = 3600 * NS_PER_SECOND;
+    } else if (strcmp(unit, "d") == 0) {
+        scale = 86400 * NS_PER_SECOND;
+    } else {
+        return -1;
+    }
+    if (value > INT64_MAX / scale) {
+        return -1;
+    }
+    *ns = value * scale;
+    return 0;
+}
+
 int parse_search_range(const char *time_str, struct search_range_t *range) {
     if (time_str == NULL || range == NULL) {
         return -1;
@@ -37,6 +66,9 @@ int parse_search_range(const char *time_str, struct search_range_t *range) {
     range->start.nanoseconds = 0;
     range->end.seconds = base_time;
     range->end.nanoseconds = 0;
+    range->disorder_ns = 0;
+    range->limit = 0;
+    range->reverse = false;
     
     // Check for fractional seconds
     if (*end_ptr == '.') {
@@ -1,14 +1,23 @@
 #ifndef SEARCH_RANGE_H
 #define SEARCH_RANGE_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <time.h>
 #include "precise_time.h"
 
 struct search_range_t {
     precise_time_t start;
     precise_time_t end;
+    // How far timestamps may run behind earlier lines; 0 for sorted logs
+    int64_t disorder_ns;
+    // Entries written at most, 0 for all of them
+    size_t limit;
+    // Newest entries first
+    bool reverse;
 };
 
 int parse_search_range(const char *time_str, struct search_range_t *range);
+int parse_duration(const char *str, int64_t *ns);
 
 #endif // SEARCH_RANGE_H
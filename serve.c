@@ -0,0 +1,496 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#endif
+
+#include "bisect.h"
+#include "date_scan.h"
+#include "precise_time.h"
+
+// A request is "<time range>\n<format> <JSON field>\n<absolute path>\n",
+// sent together with the descriptor the entries go to. The daemon searches
+// with the client's timestamp format, writes the entries there itself and
+// answers "ok\n" or "error: <reason>\n" on the socket.
+#define SERVE_REQUEST_LINES 3
+#define SERVE_REQUEST_SIZE (MAX_BUFFER_SIZE + JSON_FIELD_MAX + PATH_MAX + 20)
+#define SERVE_REPLY_SIZE 256
+// Files kept open at most; the least recently used idle one makes room
+#define SERVE_MAX_FILES 256
+// Seconds a client gets to send its request, and the daemon to send
+// anything to a socket, before the request is dropped
+#define SERVE_TIMEOUT 10
+
+#ifndef _WIN32
+
+struct serve_file {
+    char *path;
+    struct log_format format;   // the handle's, part of the key with the path
+    struct bisect_handle *handle;
+    int users;          // requests using the handle right now
+    uint64_t last_used;
+    bool cached;        // still in the table; otherwise freed by its last user
+};
+
+struct serve_state {
+    int listen_fd;
+    pthread_mutex_t lock;
+    struct serve_file *files[SERVE_MAX_FILES];
+    size_t file_count;
+    uint64_t clock;     // counts lookups, to order them by recency
+};
+
+static void serve_file_free(struct serve_file *file) {
+    bisect_close(file->handle);
+    free(file->path);
+    free(file);
+}
+
+// Removes entry i from the table; it is freed now or when its last user
+// releases it
+static void serve_file_evict(struct serve_state *state, size_t i) {
+    struct serve_file *file = state->files[i];
+    state->files[i] = state->files[--state->file_count];
+    file->cached = false;
+    if (file->users == 0) {
+        serve_file_free(file);
+    }
+}
+
+static bool same_format(const struct log_format *a, const struct log_format *b) {
+    return a->format == b->format && (a->format != DATE_FORMAT_JSON || strcmp(a->json_field, b->json_field) == 0);
+}
+
+// Takes a use of the current cached handle of path searched with format and
+// evicts a stale one. Called with the lock held; NULL when there is none.
+static struct serve_file *serve_file_lookup(struct serve_state *state, const char *path,
+                                            const struct log_format *format, const struct stat *st) {
+    state->clock++;
+    for (size_t i = 0; i < state->file_count; i++) {
+        struct serve_file *file = state->files[i];
+        if (strcmp(file->path, path) != 0 || !same_format(&file->format, format)) {
+            continue;
+        }
+        if (bisect_is_current(file->handle, st)) {
+            file->users++;
+            file->last_used = state->clock;
+            return file;
+        }
+        serve_file_evict(state, i);
+        break;
+    }
+    return NULL;
+}
+
+// Returns the warm handle of path searched with format, reopening it when the
+// file was replaced, grew or was modified since it was mapped. NULL when it
+// cannot be opened.
+static struct serve_file *serve_file_acquire(struct serve_state *state, const char *path,
+                                             const struct log_format *format) {
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&state->lock);
+    struct serve_file *cached = serve_file_lookup(state, path, format, &st);
+    pthread_mutex_unlock(&state->lock);
+    if (cached != NULL) {
+        return cached;
+    }
+
+    // Opening a cold file can take long; requests for other files go on
+    // meanwhile
+    struct serve_file *file = calloc(1, sizeof(*file));
+    const struct log_format *previous = date_format_use(format);
+    int opened = file != NULL && (file->path = strdup(path)) != NULL ? bisect_open(path, &file->handle) : -1;
+    date_format_use(previous);
+    if (opened < 0) {
+        if (file != NULL) {
+            free(file->path);
+        }
+        free(file);
+        return NULL;
+    }
+    file->format = *format;
+    file->users = 1;
+
+    // Another request may have opened the same file in the meantime; its
+    // handle is kept and this one dropped
+    pthread_mutex_lock(&state->lock);
+    cached = serve_file_lookup(state, path, format, &st);
+    if (cached != NULL) {
+        pthread_mutex_unlock(&state->lock);
+        serve_file_free(file);
+        return cached;
+    }
+    file->last_used = state->clock;
+
+    if (state->file_count == SERVE_MAX_FILES) {
+        size_t oldest = SERVE_MAX_FILES;
+        for (size_t i = 0; i < state->file_count; i++) {
+            if (state->files[i]->users == 0 &&
+                (oldest == SERVE_MAX_FILES || state->files[i]->last_used < state->files[oldest]->last_used)) {
+                oldest = i;
+            }
+        }
+        if (oldest < SERVE_MAX_FILES) {
+            serve_file_evict(state, oldest);
+        }
+    }
+    if (state->file_count < SERVE_MAX_FILES) {
+        file->cached = true;
+        state->files[state->file_count++] = file;
+    }
+    pthread_mutex_unlock(&state->lock);
+    return file;
+}
+
+static void serve_file_release(struct serve_state *state, struct serve_file *file) {
+    pthread_mutex_lock(&state->lock);
+    file->users--;
+    bool unused = !file->cached && file->users == 0;
+    pthread_mutex_unlock(&state->lock);
+    if (unused) {
+        serve_file_free(file);
+    }
+}
+
+// Keeps the first descriptor passed in msg as *out_fd and closes every
+// other one, so that a client cannot leave descriptors open in the daemon
+static void take_descriptors(struct msghdr *msg, int *out_fd) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (*out_fd < 0) {
+                *out_fd = fd;
+            } else {
+                close(fd);
+            }
+        }
+    }
+}
+
+// Reads a request and the descriptor sent along with it. Returns -1 on a
+// malformed request, or when more descriptors came than fit in the control
+// buffer.
+static int receive_request(int conn, char *request, int *out_fd) {
+    *out_fd = -1;
+    size_t len = 0;
+    int newlines = 0;
+    while (newlines < SERVE_REQUEST_LINES) {
+        union {
+            struct cmsghdr header;
+            char space[CMSG_SPACE(sizeof(int))];
+        } control;
+        struct iovec iov = {request + len, SERVE_REQUEST_SIZE - 1 - len};
+        struct msghdr msg = {0};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.space;
+        msg.msg_controllen = sizeof(control.space);
+
+        if (len == SERVE_REQUEST_SIZE - 1) {
+            return -1;
+        }
+        ssize_t received = recvmsg(conn, &msg, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return -1;
+        }
+        take_descriptors(&msg, out_fd);
+        if (msg.msg_flags & MSG_CTRUNC) {
+            return -1;
+        }
+        for (ssize_t i = 0; i < received; i++) {
+            newlines += request[len + i] == '\n';
+        }
+        len += received;
+    }
+    request[len] = '\0';
+    return *out_fd >= 0 ? 0 : -1;
+}
+
+// Tells whether the peer on conn runs as the daemon's user. The daemon opens
+// files with its own permissions, so it serves no one else; where the peer
+// cannot be told, the socket's mode is the only check.
+static bool peer_allowed(int conn) {
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == geteuid();
+#else
+    (void)conn;
+    return true;
+#endif
+}
+
+// Reads the "<format> <JSON field>" line of a request into format
+static int parse_format_line(const char *line, struct log_format *format) {
+    const char *space = strchr(line, ' ');
+    char name[32];
+    if (space == NULL || (size_t)(space - line) >= sizeof(name)) {
+        return -1;
+    }
+    memcpy(name, line, space - line);
+    name[space - line] = '\0';
+    int date_format = date_format_from_name(name);
+    return date_format < 0 ? -1 : log_format_init(format, date_format, space + 1);
+}
+
+// Bounds how long sends to the socket fd block, first saving its previous
+// bound in old unless that is NULL. Returns whether the bound was set.
+static bool set_send_timeout(int fd, const struct timeval *timeout, struct timeval *old) {
+    socklen_t len = sizeof(*old);
+    if (old != NULL && getsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, old, &len) < 0) {
+        return false;
+    }
+    return setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, timeout, sizeof(*timeout)) == 0;
+}
+
+// Answers one request: the same search as bisect(), against a warm handle
+static void serve_request(struct serve_state *state, int conn) {
+    char *request = malloc(SERVE_REQUEST_SIZE);
+    char reply[SERVE_REPLY_SIZE] = "ok\n";
+    int out_fd = -1;
+    struct search_range_t range;
+
+    if (!peer_allowed(conn)) {
+        snprintf(reply, sizeof(reply), "error: permission denied\n");
+    } else if (request == NULL || receive_request(conn, request, &out_fd) < 0) {
+        snprintf(reply, sizeof(reply), "error: malformed request\n");
+    } else {
+        char *format_line = strchr(request, '\n');
+        *format_line++ = '\0';
+        char *path = strchr(format_line, '\n');
+        *path++ = '\0';
+        path[strcspn(path, "\n")] = '\0';
+
+        struct serve_file *file;
+        struct log_format format;
+        if (parse_search_range(request, &range) != 0) {
+            snprintf(reply, sizeof(reply), "error: invalid time range\n");
+        } else if (parse_format_line(format_line, &format) < 0) {
+            snprintf(reply, sizeof(reply), "error: invalid timestamp format\n");
+        } else if (path[0] != '/' || (file = serve_file_acquire(state, path, &format)) == NULL) {
+            snprintf(reply, sizeof(reply), "error: could not open the file\n");
+        } else {
+            size_t from = bisect_find_lower(file->handle, precise_time_to_ns(range.start));
+            size_t to = bisect_find_upper(file->handle, precise_time_to_ns(range.end));
+            // A reader that stops draining a socket gives up the worker after
+            // the timeout. Pipes and files get none: a pager may hold them.
+            struct stat out_st;
+            struct timeval timeout = {SERVE_TIMEOUT, 0};
+            struct timeval old_timeout;
+            bool out_socket = fstat(out_fd, &out_st) == 0 && S_ISSOCK(out_st.st_mode) &&
+                              set_send_timeout(out_fd, &timeout, &old_timeout);
+            if (from < to && bisect_write_range(file->handle, from, to, out_fd) < 0) {
+                snprintf(reply, sizeof(reply), "error: %s\n", strerror(errno));
+            }
+            if (out_socket) {
+                set_send_timeout(out_fd, &old_timeout, NULL);
+            }
+            serve_file_release(state, file);
+        }
+    }
+
+    send(conn, reply, strlen(reply), MSG_NOSIGNAL);
+    if (out_fd >= 0) {
+        close(out_fd);
+    }
+    free(request);
+}
+
+static void *serve_worker(void *arg) {
+    struct serve_state *state = arg;
+    for (;;) {
+        int conn = accept(state->listen_fd, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE) {
+                continue;
+            }
+            return NULL;
+        }
+        // A client that sends nothing, or never reads its reply, does not
+        // hold the worker
+        struct timeval timeout = {SERVE_TIMEOUT, 0};
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        set_send_timeout(conn, &timeout, NULL);
+        serve_request(state, conn);
+        close(conn);
+    }
+}
+
+// Listens on a Unix socket at socket_path and answers requests from
+// bisect_request() on `jobs` threads, keeping the logs mapped between them.
+// Runs until accepting connections fails.
+int bisect_serve(const char *socket_path, int jobs) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    struct serve_state *state = calloc(1, sizeof(*state));
+    if (state == NULL) {
+        return -1;
+    }
+    state->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    // The socket is created 0600: only the daemon's user may connect
+    mode_t mask = umask(0177);
+    int bound = state->listen_fd >= 0 ? bind(state->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) : -1;
+    umask(mask);
+    if (bound < 0 || listen(state->listen_fd, SOMAXCONN) < 0) {
+        if (state->listen_fd >= 0) {
+            close(state->listen_fd);
+        }
+        free(state);
+        return -1;
+    }
+    pthread_mutex_init(&state->lock, NULL);
+
+    // A client that goes away must not take the daemon with it
+    signal(SIGPIPE, SIG_IGN);
+
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    pthread_t *threads = malloc(sizeof(pthread_t) * jobs);
+    int started = 0;
+    for (int i = 0; threads && i < jobs; i++) {
+        if (pthread_create(&threads[started], NULL, serve_worker, state) != 0) {
+            break;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    close(state->listen_fd);
+    unlink(socket_path);
+    for (size_t i = 0; i < state->file_count; i++) {
+        serve_file_free(state->files[i]);
+    }
+    pthread_mutex_destroy(&state->lock);
+    free(threads);
+    free(state);
+    return -1;
+}
+
+// Asks the daemon at socket_path for the entries of time_range in filename,
+// an absolute path, to be written to out_fd. The daemon searches with the
+// timestamp format of the calling thread. Returns -1 with the reason on
+// stderr when the daemon cannot be reached or fails.
+int bisect_request(const char *socket_path, const char *time_range, const char *filename, int out_fd) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (conn < 0 || connect(conn, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Error: could not connect to '%s'\n", socket_path);
+        if (conn >= 0) {
+            close(conn);
+        }
+        return -1;
+    }
+
+    struct log_format format;
+    date_format_current(&format);
+    char *request = malloc(SERVE_REQUEST_SIZE);
+    int len = request ? snprintf(request, SERVE_REQUEST_SIZE, "%s\n%s %s\n%s\n", time_range,
+                                 date_format_name(format.format), format.json_field, filename)
+                      : -1;
+    if (len < 0 || len >= SERVE_REQUEST_SIZE || strchr(time_range, '\n') != NULL) {
+        free(request);
+        close(conn);
+        return -1;
+    }
+
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = {request, (size_t)len};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &out_fd, sizeof(int));
+
+    char reply[SERVE_REPLY_SIZE];
+    size_t reply_len = 0;
+    ssize_t sent = sendmsg(conn, &msg, MSG_NOSIGNAL);
+    // The rest of a request too long for one message goes without the descriptor
+    for (size_t done = sent > 0 ? (size_t)sent : 0; sent > 0 && done < (size_t)len; done += sent) {
+        sent = send(conn, request + done, len - done, MSG_NOSIGNAL);
+    }
+    while (sent > 0 && reply_len < sizeof(reply) - 1) {
+        ssize_t received = recv(conn, reply + reply_len, sizeof(reply) - 1 - reply_len, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            break;
+        }
+        reply_len += received;
+    }
+    reply[reply_len] = '\0';
+    free(request);
+    close(conn);
+
+    if (strcmp(reply, "ok\n") != 0) {
+        const char *reason = strncmp(reply, "error: ", 7) == 0 ? reply + 7 : "no answer from the daemon\n";
+        fprintf(stderr, "Error: %s", reason);
+        return -1;
+    }
+    return 0;
+}
+
+#else
+
+int bisect_serve(const char *socket_path, int jobs) {
+    (void)socket_path;
+    (void)jobs;
+    return -1;
+}
+
+int bisect_request(const char *socket_path, const char *time_range, const char *filename, int out_fd) {
+    (void)socket_path;
+    (void)time_range;
+    (void)filename;
+    (void)out_fd;
+    return -1;
+}
+
+#endif // _WIN32
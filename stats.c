@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <sys/resource.h>
+#endif
+
+#include "precise_time.h"
+#include "stats.h"
+
+_Thread_local struct log_stats log_stats;
+bool log_stats_enabled = false;
+bool log_trace_enabled = false;
+
+// Counters of the threads that have finished
+static struct log_stats collected;
+static pthread_mutex_t collected_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int64_t stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * NS_PER_SECOND + ts.tv_nsec;
+}
+
+// Adds the counters of the calling thread to the totals and clears them.
+// Worker threads call this before they exit.
+void log_stats_collect(void) {
+    pthread_mutex_lock(&collected_lock);
+    collected.probes += log_stats.probes;
+    collected.prefetches += log_stats.prefetches;
+    collected.bytes_scanned += log_stats.bytes_scanned;
+    collected.bytes_written += log_stats.bytes_written;
+    collected.lines_written += log_stats.lines_written;
+    collected.syscalls += log_stats.syscalls;
+    collected.date_parses += log_stats.date_parses;
+    collected.search_ns += log_stats.search_ns;
+    collected.align_ns += log_stats.align_ns;
+    collected.output_ns += log_stats.output_ns;
+    pthread_mutex_unlock(&collected_lock);
+    memset(&log_stats, 0, sizeof(log_stats));
+}
+
+// Prints the totals of all threads as one line of JSON. Page faults stand
+// for the reads done through the mapping.
+void log_stats_print(FILE *out) {
+    log_stats_collect();
+    long major_faults = 0;
+    long minor_faults = 0;
+#if !defined(_WIN32) && !defined(_WIN64)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        major_faults = usage.ru_majflt;
+        minor_faults = usage.ru_minflt;
+    }
+#endif
+    fprintf(out,
+            "{\"probes\": %zu, \"prefetches\": %zu, \"bytes_scanned\": %zu, \"bytes_written\": %zu, "
+            "\"lines_written\": %zu, \"syscalls\": %zu, \"date_parses\": %zu, \"search_ns\": %lld, "
+            "\"align_ns\": %lld, \"output_ns\": %lld, \"major_faults\": %ld, \"minor_faults\": %ld}\n",
+            collected.probes, collected.prefetches, collected.bytes_scanned, collected.bytes_written,
+            collected.lines_written, collected.syscalls, collected.date_parses, (long long)collected.search_ns,
+            (long long)collected.align_ns, (long long)collected.output_ns, major_faults, minor_faults);
+}
+
+// One line per probe: where it read, the date found there, and what the
+// search did with it. INT64_MAX stands for a probe that found no date.
+void log_trace_probe(size_t offset, int64_t found_ns, int64_t target_ns, const char *decision) {
+    char *found = found_ns == INT64_MAX ? NULL : precise_time_to_string(ns_to_precise_time(found_ns));
+    char *target = precise_time_to_string(ns_to_precise_time(target_ns));
+    fprintf(stderr, "probe offset=%zu found=\"%s\" target=\"%s\" %s\n", offset,
+            found ? found : "?", target ? target : "?", decision);
+    free(found);
+    free(target);
+}
@@ -0,0 +1,44 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Work done by the calling thread. The counters are plain increments; the
+// clock is only read, and probes only traced, when enabled.
+struct log_stats {
+    size_t probes;          // blocks read by a bisection step
+    size_t prefetches;      // blocks read ahead of the probes that may need them
+    size_t bytes_scanned;   // bytes examined for timestamps
+    size_t bytes_written;
+    size_t lines_written;   // only counted with stats enabled
+    size_t syscalls;        // open, mmap and output calls
+    size_t date_parses;
+    int64_t search_ns;      // bisection and index lookups
+    int64_t align_ns;       // scanning forward to the first matching entry
+    int64_t output_ns;
+};
+
+extern _Thread_local struct log_stats log_stats;
+extern bool log_stats_enabled;
+extern bool log_trace_enabled;
+
+int64_t stats_now_ns(void);
+void log_stats_collect(void);
+void log_stats_print(FILE *out);
+void log_trace_probe(size_t offset, int64_t found_ns, int64_t target_ns, const char *decision);
+
+// Start of a timed phase; 0 when stats are disabled
+static inline int64_t stats_clock(void) {
+    return log_stats_enabled ? stats_now_ns() : 0;
+}
+
+static inline void stats_elapsed(int64_t *phase_ns, int64_t started) {
+    if (log_stats_enabled) {
+        *phase_ns += stats_now_ns() - started;
+    }
+}
+
+#endif // STATS_H
@@ -5,10 +5,25 @@
 #include <assert.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
 
 #include "precise_time.h"
 #include "bisect.h"
+#include "stats.h"
 #include "search_range.h"
+#include "date_scan.h"
+#include "bsx_index.h"
+#include "compressed.h"
+#include "prefetch.h"
+#include "binary.h"
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 int test_count = 0;
 int test_passed = 0;
@@ -40,12 +55,58 @@ precise_time_t precise_time_sub_seconds(precise_time_t t, time_t seconds) {
     return result;
 }
 
-void test_find_date_in_buffer() {
-    if (regcomp(&regex_datetime, regex_pattern, REG_EXTENDED)) {
-        printf("Could not compile regex for tests\n");
-        return;
+// Redirects stdout into a temporary file until capture_stdout_end()
+int capture_stdout_begin(const char *path) {
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    return saved;
+}
+
+// Restores stdout and returns what was written, which the caller frees
+char *capture_stdout_end(const char *path, int saved) {
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+
+    FILE *file = fopen(path, "r");
+    char *content = calloc(1, 65536);
+    if (file && content) {
+        fread(content, 1, 65535, file);
     }
-    
+    if (file) {
+        fclose(file);
+    }
+    unlink(path);
+    return content;
+}
+
+void write_test_file(const char *filename, const char *content) {
+    FILE *file = fopen(filename, "w");
+    if (file) {
+        fputs(content, file);
+        fclose(file);
+    }
+}
+
+// Returns the whole of a binary file and its size, which the caller frees
+char *read_test_file(const char *filename, size_t *size) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *content = malloc(len > 0 ? len : 1);
+    *size = content ? fread(content, 1, len, file) : 0;
+    fclose(file);
+    return content;
+}
+
+void test_find_date_in_buffer() {
     // Test with valid date
     const char *buffer1 = "2025-06-02 11:55:34 Some log message";
     int result1 = find_date_in_buffer(buffer1);
@@ -66,7 +127,34 @@ void test_find_date_in_buffer() {
     int result4 = find_date_in_buffer(buffer4);
     test_assert(result4 == 10, "find_date_in_buffer finds date at correct position");
     
-    regfree(&regex_datetime);
+    // Test length-bounded search does not look past the given length
+    const char *buffer5 = "Some text 2025-06-02 11:55:34.250 Some log message";
+    size_t offset = 0, date_len = 0;
+    test_assert(scan_date(buffer5, strlen(buffer5), &offset, &date_len) && offset == 10 && date_len == 23,
+                "scan_date returns offset and length");
+    test_assert(!scan_date(buffer5, 20, &offset, &date_len), "scan_date stops at the given length");
+}
+
+void test_scan_date() {
+    size_t offset = 0, date_len = 0;
+
+    // Long buffers go through the vectorized path, the tail through the scalar one
+    char buffer[300];
+    memset(buffer, 'x', sizeof(buffer));
+    memcpy(buffer + 10, "2025-06-02 11:55", 16);
+    memcpy(buffer + 100, "2025-06-02-11:55:34", 19);
+    memcpy(buffer + 200, "12025-06-02 11:55:34,5", 22);
+    test_assert(scan_date(buffer, sizeof(buffer), &offset, &date_len) && offset == 201 && date_len == 21,
+                "scan_date skips near-misses and finds the leftmost match");
+
+    memcpy(buffer + 270, "2025-06-02 11:55:34", 19);
+    test_assert(scan_date(buffer + 220, 80, &offset, &date_len) && offset == 50 && date_len == 19,
+                "scan_date finds a date at the end of the buffer");
+    test_assert(!scan_date(buffer + 220, 68, &offset, &date_len), "scan_date ignores a truncated date");
+
+    test_assert(match_date_at("2025-06-02 11:55:34.1234567891", 30) == 29, "match_date_at stops after 9 fractional digits");
+    test_assert(match_date_at("2025-06-02 11:55:34.x", 21) == 19, "match_date_at ignores a separator without digits");
+    test_assert(match_date_at("2025-0a-02 11:55:34", 19) == 0, "match_date_at rejects non-digits");
 }
 
 void test_create_sample_file() {
@@ -206,11 +294,6 @@ void test_fractional_search_range() {
 }
 
 void test_date_regex_with_fractional() {
-    if (regcomp(&regex_datetime, regex_pattern, REG_EXTENDED)) {
-        printf("Could not compile regex for fractional tests\n");
-        return;
-    }
-    
     // Test various fractional formats
     const char *valid_dates[] = {
         "2025-06-02 11:55:34",
@@ -283,16 +366,1452 @@ void test_edge_cases() {
     free(str);
 }
 
+void test_parse_date_ns() {
+    const char *test_cases[] = {
+        "2025-06-02 11:55:34",
+        "2025-06-02 11:55:59.5",
+        "2025-06-02 11:56:00,25",
+        "2024-02-29 23:59:59.999999999",
+        "2000-01-01 00:00:00",
+        "1999-12-31 23:59:59.000000001"
+    };
+
+    for (int i = 0; i < 6; i++) {
+        struct tm tms = {0};
+        tms.tm_isdst = -1;
+        strptime(test_cases[i], "%Y-%m-%d %H:%M:%S", &tms);
+        int64_t expected_seconds = (int64_t)mktime(&tms);
+
+        int64_t ns = parse_date_ns(test_cases[i], strlen(test_cases[i]));
+        char msg[100];
+        snprintf(msg, sizeof(msg), "parse_date_ns agrees with mktime for '%s'", test_cases[i]);
+        test_assert(ns != PRECISE_NS_INVALID && ns / NS_PER_SECOND == expected_seconds, msg);
+    }
+
+    // Lines in the same minute reuse the memoized prefix
+    int64_t a = parse_date_ns("2025-06-02 11:55:01.1", 21);
+    int64_t b = parse_date_ns("2025-06-02 11:55:02.2", 21);
+    test_assert(b - a == 1100000000LL, "parse_date_ns keeps seconds and fraction outside the memoized prefix");
+
+    test_assert(parse_date_ns("2025-13-02 11:55:34", 19) == PRECISE_NS_INVALID, "parse_date_ns rejects month 13");
+    test_assert(parse_date_ns("2025-06-02 24:00:00", 19) == PRECISE_NS_INVALID, "parse_date_ns rejects hour 24");
+
+    precise_time_t pt = {1622641534, 123456789};
+    test_assert(precise_time_equal(ns_to_precise_time(precise_time_to_ns(pt)), pt), "ns_to_precise_time round-trips");
+    precise_time_t before_epoch = ns_to_precise_time(-1);
+    test_assert(before_epoch.seconds == -1 && before_epoch.nanoseconds == 999999999, "ns_to_precise_time floors negative keys");
+}
+
+void test_bsx_index() {
+    const char *filename = "test_index.log";
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        printf("Could not create test file\n");
+        return;
+    }
+    for (int i = 0; i < 100; i++) {
+        fprintf(file, "2025-06-02 11:%02d:%02d Entry %d\n", i / 60, i % 60, i);
+    }
+    fclose(file);
+
+    test_assert(bsx_build(filename, 256) == 0, "bsx_build writes an index");
+
+    struct stat st;
+    stat(filename, &st);
+    struct bsx_index index;
+    test_assert(bsx_open(filename, NULL, &st, &index) == 0, "bsx_open accepts a fresh index");
+    if (index.header) {
+        test_assert(index.header->count > 1, "bsx_build records several checkpoints");
+
+        // Locate the target line by hand and check that the checkpoints bracket it
+        int64_t target = parse_date_ns("2025-06-02 11:00:50", 19);
+        size_t lo, hi;
+        bsx_find(&index, target, st.st_size, &lo, &hi);
+        char line[64];
+        FILE *in = fopen(filename, "r");
+        size_t target_offset = 0;
+        while (fgets(line, sizeof(line), in) && strncmp(line, "2025-06-02 11:00:50", 19) != 0) {
+            target_offset += strlen(line);
+        }
+        fclose(in);
+        test_assert(lo <= target_offset && target_offset <= hi && hi < (size_t)st.st_size,
+                    "bsx_find brackets the target between two checkpoints");
+        bsx_close(&index);
+    }
+
+    // A different inode or a shrunk log invalidates the index
+    struct stat shrunk = st;
+    shrunk.st_size = 10;
+    test_assert(bsx_open(filename, NULL, &shrunk, &index) == -1, "bsx_open rejects an index for a shrunk log");
+
+    // The checkpoints only hold for the format and time zone they were parsed with
+    date_format_set(DATE_FORMAT_ISO8601);
+    bool other_format = bsx_open(filename, NULL, &st, &index) == -1;
+    date_format_set(DATE_FORMAT_DEFAULT);
+    date_format_set_json_field("time");
+    bool other_field = bsx_open(filename, NULL, &st, &index) == -1;
+    date_format_set_json_field("ts");
+    char *tz = getenv("TZ") != NULL ? strdup(getenv("TZ")) : NULL;
+    setenv("TZ", "XYZ-5", 1);
+    bool other_zone = bsx_open(filename, NULL, &st, &index) == -1;
+    if (tz != NULL) {
+        setenv("TZ", tz, 1);
+    } else {
+        unsetenv("TZ");
+    }
+    free(tz);
+    tzset();
+    test_assert(other_format && other_field && other_zone,
+                "bsx_open rejects an index built with another format, JSON field or time zone");
+    test_assert(bsx_open(filename, NULL, &st, &index) == 0, "bsx_open accepts the index again as it was built");
+    bsx_close(&index);
+
+    char index_path[64];
+    snprintf(index_path, sizeof(index_path), "%s%s", filename, BSX_SUFFIX);
+    unlink(index_path);
+    unlink(filename);
+
+    // Enough checkpoints for several restart points, indexed in two steps as
+    // the log grows and then from scratch
+    size_t size = 0;
+    char *content = malloc(6000 * 40);
+    size_t *offsets = malloc(sizeof(size_t) * 6000);
+    for (int i = 0; i < 6000; i++) {
+        offsets[i] = size;
+        size += sprintf(content + size, "2025-06-02 %02d:%02d:%02d Entry %d\n", 10 + i / 3600, i / 60 % 60, i % 60, i);
+    }
+    char saved_char = content[offsets[4000]];
+    content[offsets[4000]] = '\0';
+    write_test_file(filename, content);
+    bsx_build(filename, 256);
+    content[offsets[4000]] = saved_char;
+    write_test_file(filename, content);
+    bsx_build(filename, 256);
+
+    size_t extended_size = 0;
+    char *extended = read_test_file(index_path, &extended_size);
+    unlink(index_path);
+    bsx_build(filename, 256);
+    size_t fresh_size = 0;
+    char *fresh = read_test_file(index_path, &fresh_size);
+    test_assert(extended && fresh && extended_size == fresh_size && memcmp(extended, fresh, fresh_size) == 0,
+                "an extended index is the index built from scratch");
+    free(extended);
+    free(fresh);
+
+    stat(filename, &st);
+    bool brackets = false;
+    if (bsx_open(filename, content, &st, &index) == 0) {
+        brackets = index.header->count > 4 * 64;
+        for (int i = 0; brackets && i < 6000; i += 7) {
+            size_t lo, hi;
+            bsx_find(&index, parse_date_ns(content + offsets[i], 19), size, &lo, &hi);
+            brackets = lo <= offsets[i] && offsets[i] <= hi && (i == 0 || lo < offsets[i]) &&
+                       hi - lo <= 2 * 256 + 40;
+        }
+        bsx_close(&index);
+    }
+    test_assert(brackets, "bsx_find brackets every target through the restart points");
+
+    truncate(index_path, fresh_size - 1);
+    test_assert(bsx_open(filename, content, &st, &index) == -1, "bsx_open rejects a truncated index");
+
+    free(content);
+    free(offsets);
+    unlink(index_path);
+    unlink(filename);
+}
+
+void test_bisect_merge() {
+    write_test_file("test_merge_a.log",
+                    "2025-06-02 10:00:00 a1\n"
+                    "2025-06-02 10:00:02 a2\n"
+                    "  continuation of a2\n"
+                    "2025-06-02 10:00:04 a3\n");
+    write_test_file("test_merge_b.log",
+                    "2025-06-02 10:00:01 b1\n"
+                    "2025-06-02 10:00:02 b2\n"
+                    "2025-06-02 10:00:03 b3");
+
+    const char *filenames[] = {"test_merge_a.log", "test_merge_b.log"};
+    struct search_range_t range;
+    parse_search_range("2025-06-02 10:00:01+2s", &range);
+
+    int saved = capture_stdout_begin("test_merge_out.txt");
+    int result = bisect_merge(filenames, 2, range, 2);
+    char *output = capture_stdout_end("test_merge_out.txt", saved);
+
+    test_assert(result == 0, "bisect_merge succeeds");
+    test_assert(output && strcmp(output,
+                                 "2025-06-02 10:00:01 b1\n"
+                                 "2025-06-02 10:00:02 a2\n"
+                                 "  continuation of a2\n"
+                                 "2025-06-02 10:00:02 b2\n"
+                                 "2025-06-02 10:00:03 b3\n") == 0,
+                "bisect_merge interleaves entries by time and keeps continuation lines");
+    free(output);
+
+    const char *missing[] = {"test_merge_a.log", "test_merge_missing.log"};
+    saved = capture_stdout_begin("test_merge_out.txt");
+    result = bisect_merge(missing, 2, range, 1);
+    free(capture_stdout_end("test_merge_out.txt", saved));
+    test_assert(result == -1, "bisect_merge reports a file that cannot be opened");
+
+    write_test_file("test_merge_c.log.gz", "\x1f\x8b\x08");
+    const char *compressed[] = {"test_merge_a.log", "test_merge_c.log.gz"};
+    saved = capture_stdout_begin("test_merge_out.txt");
+    result = bisect_merge(compressed, 2, range, 1);
+    output = capture_stdout_end("test_merge_out.txt", saved);
+    test_assert(result == -1 && output && output[0] == '\0', "bisect_merge refuses a compressed file before writing");
+    free(output);
+    unlink("test_merge_c.log.gz");
+
+    unlink("test_merge_a.log");
+    unlink("test_merge_b.log");
+}
+
+void test_bisect_range() {
+    // Enough entries to span several blocks, one second apart
+    size_t size = 0;
+    char *content = malloc(4000 * 32);
+    for (int i = 0; i < 4000; i++) {
+        size += sprintf(content + size, "2025-06-02 10:%02d:%02d line %d\n", i / 60 % 60, i % 60, i);
+    }
+    write_test_file("test_range.log", content);
+
+    struct log_file log;
+    test_assert(log_open("test_range.log", &log) == 0, "log_open maps the log");
+    const char *first = strstr(content, "2025-06-02 10:20:00");
+    const char *after = strstr(content, "2025-06-02 10:30:01");
+    int64_t end_ns = parse_date_ns("2025-06-02 10:30:00", 19);
+    test_assert(log_upper_bound(&log, first - content, end_ns) == (size_t)(after - content),
+                "log_upper_bound finds the first entry past the end");
+    test_assert(log_upper_bound(&log, 0, parse_date_ns("2025-06-02 11:59:59", 19)) == log.size,
+                "log_upper_bound returns the log size when no entry is past the end");
+    log_close(&log);
+
+    struct search_range_t range;
+    parse_search_range("2025-06-02 10:20:00+10m", &range);
+    int saved = capture_stdout_begin("test_range_out.txt");
+    int result = bisect("test_range.log", range);
+    char *output = capture_stdout_end("test_range_out.txt", saved);
+    test_assert(result == 0, "bisect succeeds on a multi-block log");
+    test_assert(output && strlen(output) == (size_t)(after - first) &&
+                strncmp(output, first, after - first) == 0,
+                "bisect writes exactly the bytes between both boundaries");
+    free(output);
+
+    free(content);
+    unlink("test_range.log");
+}
+
+void test_bisect_skewed() {
+    // Bursts of entries a second apart separated by gaps of hours, so
+    // estimates from the write rate are far off
+    size_t size = 0;
+    char *content = malloc(3000 * 40);
+    int64_t *times = malloc(sizeof(int64_t) * 3000);
+    size_t *offsets = malloc(sizeof(size_t) * 3000);
+    int64_t t = parse_date_ns("2025-06-02 00:00:00", 19) / NS_PER_SECOND;
+    for (int i = 0; i < 3000; i++) {
+        t += i % 500 == 0 ? 7 * 3600 : 1;
+        time_t seconds = (time_t)t;
+        struct tm tm;
+        localtime_r(&seconds, &tm);
+        offsets[i] = size;
+        times[i] = t * NS_PER_SECOND;
+        size += strftime(content + size, 40, "%Y-%m-%d %H:%M:%S", &tm);
+        size += sprintf(content + size, " line %d\n", i);
+    }
+    write_test_file("test_skewed.log", content);
+
+    struct log_file log;
+    log_open("test_skewed.log", &log);
+    bool all_found = true;
+    for (int i = 0; i < 3000; i += 37) {
+        struct log_entry entry;
+        if (log_seek(&log, times[i], &entry) != 1 || entry.offset != offsets[i] ||
+            log_upper_bound(&log, 0, times[i]) != (i + 1 < 3000 ? offsets[i + 1] : size)) {
+            all_found = false;
+        }
+    }
+    test_assert(all_found, "log_seek and log_upper_bound find entries despite an uneven write rate");
+    log_close(&log);
+
+    free(content);
+    free(times);
+    free(offsets);
+    unlink("test_skewed.log");
+}
+
+void test_stats() {
+    write_test_file("test_stats.log",
+                    "2025-06-02 10:00:00 a\n"
+                    "2025-06-02 10:00:01 b\n"
+                    "  continuation of b\n"
+                    "2025-06-02 10:00:02 c\n");
+
+    struct search_range_t range;
+    parse_search_range("2025-06-02 10:00:01+0s", &range);
+    log_stats = (struct log_stats){0};
+    log_stats_enabled = true;
+    int saved = capture_stdout_begin("test_stats_out.txt");
+    int result = bisect("test_stats.log", range);
+    free(capture_stdout_end("test_stats_out.txt", saved));
+    log_stats_enabled = false;
+
+    test_assert(result == 0, "bisect succeeds with stats enabled");
+    test_assert(log_stats.bytes_written == 42 && log_stats.lines_written == 2,
+                "stats count the bytes and lines written");
+    test_assert(log_stats.date_parses > 0 && log_stats.syscalls > 0, "stats count parses and syscalls");
+    test_assert(log_stats.output_ns > 0, "stats time the output");
+    log_stats = (struct log_stats){0};
+
+    unlink("test_stats.log");
+}
+
+void test_histogram() {
+    int64_t ns = 0;
+    test_assert(parse_duration("90s", &ns) == 0 && ns == 90 * NS_PER_SECOND, "parse_duration reads seconds");
+    test_assert(parse_duration("1d", &ns) == 0 && ns == 86400 * NS_PER_SECOND, "parse_duration reads days");
+    test_assert(parse_duration("500ms", &ns) == 0 && ns == 500000000, "parse_duration reads milliseconds");
+    test_assert(parse_duration("5", &ns) == -1, "parse_duration rejects a missing unit");
+    test_assert(parse_duration("0m", &ns) == -1, "parse_duration rejects zero");
+    test_assert(parse_duration("1w", &ns) == -1, "parse_duration rejects an unknown unit");
+
+    write_test_file("test_histogram.log",
+                    "2025-06-02 09:59:59 before\n"
+                    "2025-06-02 10:00:00 a\n"
+                    "2025-06-02 10:00:59.5 b\n"
+                    "  continuation of b\n"
+                    "2025-06-02 10:02:10 c\n"
+                    "2025-06-02 10:03:00 after\n");
+
+    struct search_range_t range;
+    parse_search_range("2025-06-02 10:00:00+179s", &range);
+    int saved = capture_stdout_begin("test_histogram_out.txt");
+    int result = bisect_histogram("test_histogram.log", range, 60 * NS_PER_SECOND, true);
+    char *output = capture_stdout_end("test_histogram_out.txt", saved);
+    test_assert(result == 0, "bisect_histogram succeeds");
+    test_assert(output && strcmp(output,
+                                 "2025-06-02 10:00:00 66 3\n"
+                                 "2025-06-02 10:01:00 0 0\n"
+                                 "2025-06-02 10:02:00 22 1\n") == 0,
+                "bisect_histogram reports bytes and lines per bucket");
+    free(output);
+
+    unlink("test_histogram.log");
+}
+
+void test_sample() {
+    size_t size = 0;
+    char *content = malloc(60 * 64);
+    for (int i = 0; i < 60; i++) {
+        size += sprintf(content + size, "2025-06-02 10:%02d:00 line %d\n", i, i);
+        if (i == 20) {
+            size += sprintf(content + size, "  continuation of line 20\n");
+        }
+    }
+    write_test_file("test_sample.log", content);
+
+    struct search_range_t range;
+    parse_search_range("2025-06-02 10:00:00+39m", &range);
+    int saved = capture_stdout_begin("test_sample_out.txt");
+    int result = bisect_sample("test_sample.log", range, 4, false);
+    char *output = capture_stdout_end("test_sample_out.txt", saved);
+    test_assert(result == 0, "bisect_sample succeeds");
+    test_assert(output && strcmp(output,
+                                 "2025-06-02 10:00:00 line 0\n"
+                                 "2025-06-02 10:10:00 line 10\n"
+                                 "2025-06-02 10:20:00 line 20\n"
+                                 "  continuation of line 20\n"
+                                 "2025-06-02 10:30:00 line 30\n") == 0,
+                "bisect_sample writes whole entries spread evenly in time");
+    free(output);
+
+    saved = capture_stdout_begin("test_sample_out.txt");
+    result = bisect_sample("test_sample.log", range, 2, true);
+    output = capture_stdout_end("test_sample_out.txt", saved);
+    test_assert(result == 0 && output && strcmp(output,
+                                                "2025-06-02 10:00:00 line 0\n"
+                                                "2025-06-02 10:21:00 line 21\n") == 0,
+                "bisect_sample spreads entries evenly in bytes, from an entry's start on");
+    free(output);
+
+    parse_search_range("2025-06-02 10:05:00~30s", &range);
+    saved = capture_stdout_begin("test_sample_out.txt");
+    result = bisect_sample("test_sample.log", range, 10, false);
+    output = capture_stdout_end("test_sample_out.txt", saved);
+    test_assert(result == 0 && output && strcmp(output, "2025-06-02 10:05:00 line 5\n") == 0,
+                "bisect_sample writes each entry of a sparse range once");
+    free(output);
+
+    parse_search_range("2025-06-02 12:00:00+1h", &range);
+    saved = capture_stdout_begin("test_sample_out.txt");
+    result = bisect_sample("test_sample.log", range, 10, false);
+    output = capture_stdout_end("test_sample_out.txt", saved);
+    test_assert(result == 0 && output && output[0] == '\0', "bisect_sample writes nothing past the log");
+    free(output);
+
+    free(content);
+    unlink("test_sample.log");
+}
+
+void test_rotated_chain() {
+    // Rotated the usual way: the oldest entries in the highest number
+    write_test_file("test_chain.log.2",
+                    "2025-06-02 10:00:00 a\n"
+                    "2025-06-02 10:01:00 b\n");
+    write_test_file("test_chain.log.1",
+                    "2025-06-02 10:02:00 c\n"
+                    "  continuation of c\n"
+                    "2025-06-02 10:03:00 d\n");
+    write_test_file("test_chain.log",
+                    "2025-06-02 10:04:00 e\n"
+                    "2025-06-02 10:05:00 f\n");
+    write_test_file("test_chain.log.old", "2025-06-02 10:02:30 not a rotation\n");
+
+    const char *base[] = {"test_chain.log"};
+    struct search_range_t range;
+    parse_search_range("2025-06-02 10:01:00+3m", &range);
+    int saved = capture_stdout_begin("test_chain_out.txt");
+    int result = bisect_chain(base, 1, range, 1);
+    char *output = capture_stdout_end("test_chain_out.txt", saved);
+    const char *expected = "2025-06-02 10:01:00 b\n"
+                           "2025-06-02 10:02:00 c\n"
+                           "  continuation of c\n"
+                           "2025-06-02 10:03:00 d\n"
+                           "2025-06-02 10:04:00 e\n";
+    test_assert(result == 0, "bisect_chain succeeds");
+    test_assert(output && strcmp(output, expected) == 0, "bisect_chain streams a range across rotated files in order");
+    free(output);
+    test_assert(access("test_chain.log.bsc", F_OK) == 0, "bisect_chain caches the bounds of the files");
+
+    // The second search takes the bounds from the cache
+    saved = capture_stdout_begin("test_chain_out.txt");
+    result = bisect_chain(base, 1, range, 1);
+    output = capture_stdout_end("test_chain_out.txt", saved);
+    test_assert(result == 0 && output && strcmp(output, expected) == 0, "bisect_chain searches again from its cache");
+    free(output);
+
+    // Listed files, as from a glob, with a sidecar among them
+    const char *listed[] = {"test_chain.log", "test_chain.log.1", "test_chain.log.2", "test_chain.log.bsc"};
+    parse_search_range("2025-06-02 10:05:00+1h", &range);
+    saved = capture_stdout_begin("test_chain_out.txt");
+    result = bisect_chain(listed, 4, range, 1);
+    output = capture_stdout_end("test_chain_out.txt", saved);
+    test_assert(result == 0 && output && strcmp(output, "2025-06-02 10:05:00 f\n") == 0,
+                "bisect_chain searches listed files and skips sidecars");
+    free(output);
+
+    // Files overlapping in time are merged
+    write_test_file("test_chain.log", "2025-06-02 10:00:30 g\n");
+    parse_search_range("2025-06-02 10:00:00+1m", &range);
+    saved = capture_stdout_begin("test_chain_out.txt");
+    result = bisect_chain(base, 1, range, 1);
+    output = capture_stdout_end("test_chain_out.txt", saved);
+    test_assert(result == 0 && output && strcmp(output,
+                                                "2025-06-02 10:00:00 a\n"
+                                                "2025-06-02 10:00:30 g\n"
+                                                "2025-06-02 10:01:00 b\n") == 0,
+                "bisect_chain merges files that overlap in time");
+    free(output);
+
+    unlink("test_chain.log");
+    unlink("test_chain.log.1");
+    unlink("test_chain.log.2");
+    unlink("test_chain.log.old");
+    unlink("test_chain.log.bsc");
+}
+
+void test_reverse_limit() {
+    write_test_file("test_reverse.log",
+                    "2025-06-02 09:59:59 before\n"
+                    "2025-06-02 10:00:00 a\n"
+                    "2025-06-02 10:00:01 b\n"
+                    "  continuation of b\n"
+                    "2025-06-02 10:00:02 c\n"
+                    "2025-06-02 10:00:03 after\n");
+
+    struct search_range_t range;
+    parse_search_range("2025-06-02 10:00:00+2s", &range);
+    range.reverse = true;
+    int saved = capture_stdout_begin("test_reverse_out.txt");
+    int result = bisect("test_reverse.log", range);
+    char *output = capture_stdout_end("test_reverse_out.txt", saved);
+    test_assert(result == 0 && output && strcmp(output,
+                                                "2025-06-02 10:00:02 c\n"
+                                                "2025-06-02 10:00:01 b\n"
+                                                "  continuation of b\n"
+                                                "2025-06-02 10:00:00 a\n") == 0,
+                "--reverse writes entries newest first, their lines in order");
+    free(output);
+
+    range.limit = 2;
+    saved = capture_stdout_begin("test_reverse_out.txt");
+    result = bisect("test_reverse.log", range);
+    output = capture_stdout_end("test_reverse_out.txt", saved);
+    test_assert(result == 0 && output && strcmp(output,
+                                                "2025-06-02 10:00:02 c\n"
+                                                "2025-06-02 10:00:01 b\n"
+                                                "  continuation of b\n") == 0,
+                "--reverse --limit writes the last entries of the range");
+    free(output);
+
+    range.reverse = false;
+    saved = capture_stdout_begin("test_reverse_out.txt");
+    result = bisect("test_reverse.log", range);
+    output = capture_stdout_end("test_reverse_out.txt", saved);
+    test_assert(result == 0 && output && strcmp(output,
+                                                "2025-06-02 10:00:00 a\n"
+                                                "2025-06-02 10:00:01 b\n"
+                                                "  continuation of b\n") == 0,
+                "--limit stops after whole entries");
+    free(output);
+
+    range.limit = 10;
+    saved = capture_stdout_begin("test_reverse_out.txt");
+    result = bisect("test_reverse.log", range);
+    output = capture_stdout_end("test_reverse_out.txt", saved);
+    test_assert(result == 0 && output && strstr(output, "10:00:02 c\n") != NULL && strstr(output, "after") == NULL,
+                "--limit past the range ends with the range");
+    free(output);
+
+    parse_search_range("2025-06-02 11:00:00+1m", &range);
+    range.reverse = true;
+    saved = capture_stdout_begin("test_reverse_out.txt");
+    result = bisect("test_reverse.log", range);
+    output = capture_stdout_end("test_reverse_out.txt", saved);
+    test_assert(result == 0 && output && output[0] == '\0', "--reverse writes nothing past the log");
+    free(output);
+
+    unlink("test_reverse.log");
+
+    write_test_file("test_reverse.log",
+                    "2025-06-02 10:00:00 a ref 2025-01-01 00:00:00\n"
+                    "2025-06-02 10:00:01 b ref 2025-01-01 00:00:00\n"
+                    "2025-06-02 10:00:02 c ref 2025-01-01 00:00:00\n");
+    parse_search_range("2025-06-02 10:00:00+2s", &range);
+    range.limit = 1;
+    saved = capture_stdout_begin("test_reverse_out.txt");
+    result = bisect("test_reverse.log", range);
+    output = capture_stdout_end("test_reverse_out.txt", saved);
+    test_assert(result == 0 && output && strcmp(output, "2025-06-02 10:00:00 a ref 2025-01-01 00:00:00\n") == 0,
+                "--limit counts a line with a second date as one entry");
+    free(output);
+
+    range.limit = 2;
+    saved = capture_stdout_begin("test_reverse_out.txt");
+    result = bisect("test_reverse.log", range);
+    output = capture_stdout_end("test_reverse_out.txt", saved);
+    test_assert(result == 0 && output && strcmp(output,
+                                                "2025-06-02 10:00:00 a ref 2025-01-01 00:00:00\n"
+                                                "2025-06-02 10:00:01 b ref 2025-01-01 00:00:00\n") == 0,
+                "--limit 2 writes two lines with a second date");
+    free(output);
+
+    unlink("test_reverse.log");
+}
+
+void test_binary_records() {
+    struct binary_format format;
+    test_assert(parse_binary_format("record=16,ts_offset=8,ts=u64ms", &format) == 0 && format.record == 16 &&
+                    format.ts_offset == 8 && format.ts == BINARY_TS_U64MS && !format.text,
+                "--binary parses record, ts_offset and ts");
+    test_assert(parse_binary_format("record=16,ts_offset=12", &format) < 0,
+                "--binary rejects a timestamp past the end of the record");
+    test_assert(parse_binary_format("ts=u64ns", &format) < 0 && parse_binary_format("record=8,ts=u16", &format) < 0 &&
+                    parse_binary_format("record=8,colour=red", &format) < 0,
+                "--binary rejects a missing size, unknown types and unknown keys");
+
+    // Records of an 8-byte id and a millisecond timestamp, one every 500ms,
+    // followed by half a record still being written
+    struct search_range_t range;
+    parse_search_range("2025-06-02 10:00:00", &range);
+    uint64_t base_ms = (uint64_t)(precise_time_to_ns(range.start) / 1000000);
+    unsigned char data[10 * 16 + 8] = {0};
+    for (int i = 0; i < 10; i++) {
+        uint64_t ms = base_ms + (uint64_t)i * 500;
+        data[i * 16] = (unsigned char)i;
+        for (int j = 0; j < 8; j++) {
+            data[i * 16 + 8 + j] = (unsigned char)(ms >> (8 * j));
+        }
+    }
+    FILE *f = fopen("test_binary.bin", "wb");
+    fwrite(data, 1, sizeof(data), f);
+    fclose(f);
+
+    parse_binary_format("record=16,ts_offset=8,ts=u64ms", &format);
+    parse_search_range("2025-06-02 10:00:01+1s", &range);
+    int saved = capture_stdout_begin("test_binary_out.bin");
+    int result = bisect_binary("test_binary.bin", range, &format);
+    char *output = capture_stdout_end("test_binary_out.bin", saved);
+    static const unsigned char zeros[16];
+    test_assert(result == 0 && output && memcmp(output, data + 2 * 16, 3 * 16) == 0 &&
+                    memcmp(output + 3 * 16, zeros, 16) == 0,
+                "--binary writes the records of the range raw");
+    free(output);
+
+    range.limit = 2;
+    range.reverse = true;
+    format.text = true;
+    saved = capture_stdout_begin("test_binary_out.bin");
+    result = bisect_binary("test_binary.bin", range, &format);
+    output = capture_stdout_end("test_binary_out.bin", saved);
+    // Each line is the time, a space and the 16 bytes in hex
+    test_assert(result == 0 && output && strlen(output) == 2 * (30 + 32 + 1) &&
+                    strncmp(output, "2025-06-02 10:00:02.000000000 0400000000000000", 46) == 0 &&
+                    strncmp(output + 63, "2025-06-02 10:00:01.500000000 0300000000000000", 46) == 0,
+                "--binary output=text --reverse --limit renders the last records newest first");
+    free(output);
+
+    parse_search_range("2025-06-02 10:00:04+1m", &range);
+    saved = capture_stdout_begin("test_binary_out.bin");
+    result = bisect_binary("test_binary.bin", range, &format);
+    output = capture_stdout_end("test_binary_out.bin", saved);
+    test_assert(result == 0 && output && strlen(output) == 2 * (30 + 32 + 1) &&
+                    strncmp(output + 63, "2025-06-02 10:00:04.500000000 09", 32) == 0,
+                "--binary leaves out a partial record at the end");
+    free(output);
+
+    unlink("test_binary.bin");
+}
+
+void test_log_open_fd() {
+    write_test_file("test_open_fd.log", "2025-06-02 10:00:00 first file\n");
+    int fd = open("test_open_fd.log", O_RDONLY);
+    write_test_file("test_open_fd.new", "2025-06-02 10:00:00 second\n");
+    rename("test_open_fd.new", "test_open_fd.log");
+    struct log_file log;
+    test_assert(log_open_fd("test_open_fd.log", fd, &log) == 0 && log.size == 31 &&
+                    memcmp(log.data, "2025-06-02 10:00:00 first file\n", 31) == 0,
+                "log_open_fd maps the open file, not the one now under its path");
+    log_close(&log);
+    test_assert(log_open_fd("test_open_fd.log", -1, &log) == -1, "log_open_fd fails without a descriptor");
+
+    int result = system("./bisect --follow --grep x -t '2025-06-02 10:00:00' test_open_fd.log 2>/dev/null");
+    test_assert(result != 0, "--follow refuses --grep");
+    unlink("test_open_fd.log");
+}
+
+void test_bisect_queries() {
+    size_t size = 0;
+    char *content = malloc(4000 * 32);
+    for (int i = 0; i < 4000; i++) {
+        size += sprintf(content + size, "2025-06-02 10:%02d:%02d line %d\n", i / 60 % 60, i % 60, i);
+    }
+    write_test_file("test_queries.log", content);
+    size_t at_0500 = strstr(content, "2025-06-02 10:05:00") - content;
+    size_t at_0509 = strstr(content, "2025-06-02 10:05:09") - content;
+    size_t at_0512 = strstr(content, "2025-06-02 10:05:12") - content;
+    size_t at_0601 = strstr(content, "2025-06-02 10:06:01") - content;
+    size_t at_4000 = strstr(content, "2025-06-02 10:40:00") - content;
+    size_t at_4001 = strstr(content, "2025-06-02 10:40:01") - content;
+
+    const char *specs = "# comment\n"
+                        "2025-06-02 10:40:00\n"
+                        "\n"
+                        "2025-06-02 10:05:00+1m\n"
+                        "2025-06-02 10:05:10~1s\n"
+                        "2025-06-02 12:00:00+1m\n";
+    FILE *queries = fmemopen((void *)specs, strlen(specs), "r");
+    int saved = capture_stdout_begin("test_queries_out.txt");
+    int result = bisect_queries("test_queries.log", queries, true);
+    char *output = capture_stdout_end("test_queries_out.txt", saved);
+    fclose(queries);
+
+    char expected[256];
+    snprintf(expected, sizeof(expected), "%zu %zu\n%zu %zu\n%zu %zu\n%zu %zu\n",
+             at_4000, at_4001, at_0500, at_0601, at_0509, at_0512,
+             size, size);
+    test_assert(result == 0, "bisect_queries succeeds");
+    test_assert(output && strcmp(output, expected) == 0, "bisect_queries prints the offsets of each query in input order");
+    free(output);
+
+    queries = fmemopen((void *)specs, strlen(specs), "r");
+    saved = capture_stdout_begin("test_queries_out.txt");
+    result = bisect_queries("test_queries.log", queries, false);
+    output = capture_stdout_end("test_queries_out.txt", saved);
+    fclose(queries);
+    test_assert(result == 0 && output && strlen(output) == (at_0601 - at_0500) + (at_4001 - at_4000) &&
+                strncmp(output, content + at_0500, at_0601 - at_0500) == 0 &&
+                strncmp(output + (at_0601 - at_0500), content + at_4000, at_4001 - at_4000) == 0,
+                "bisect_queries writes overlapping ranges once, in file order");
+    free(output);
+
+    const char *bad = "2025-06-02 10:05:00+1m\nnot a time\n";
+    queries = fmemopen((void *)bad, strlen(bad), "r");
+    saved = capture_stdout_begin("test_queries_out.txt");
+    result = bisect_queries("test_queries.log", queries, true);
+    free(capture_stdout_end("test_queries_out.txt", saved));
+    fclose(queries);
+    test_assert(result == -1, "bisect_queries rejects an invalid query");
+
+    // The command line applies -o to every mode, --queries included
+    write_test_file("test_queries.txt", "2025-06-02 10:05:00+1m\n");
+    unlink("test_queries_cli.txt");
+    saved = capture_stdout_begin("test_queries_out.txt");
+    result = system("./bisect --queries test_queries.txt -o test_queries_cli.txt test_queries.log");
+    output = capture_stdout_end("test_queries_out.txt", saved);
+    FILE *file = fopen("test_queries_cli.txt", "r");
+    char *written = calloc(1, 65536);
+    if (file) {
+        fread(written, 1, 65535, file);
+        fclose(file);
+    }
+    test_assert(result == 0 && output && output[0] == '\0' && file != NULL &&
+                strlen(written) == at_0601 - at_0500 && strncmp(written, content + at_0500, at_0601 - at_0500) == 0,
+                "--queries -o writes the ranges to the output file");
+    free(output);
+    free(written);
+
+    // Conflicting options fail before -o truncates the file
+    const char *conflicts[] = {
+        "./bisect -o test_queries_cli.txt --queries test_queries.txt test_queries.log test_queries.log",
+        "./bisect -o test_queries_cli.txt --histogram 1m -t '2025-06-02 10:00:00+1m' test_queries.log test_queries.log",
+        "./bisect -o test_queries_cli.txt --sample 5 --follow -t '2025-06-02 10:00:00+1m' test_queries.log",
+        "./bisect -o test_queries_cli.txt --queries test_queries.txt --grep line test_queries.log",
+        "./bisect -o test_queries_cli.txt --queries test_queries.txt --histogram 1m test_queries.log",
+        "./bisect -o test_queries_cli.txt --histogram 1m --grep line -t '2025-06-02 10:00:00+1m' test_queries.log",
+    };
+    bool refused = true;
+    for (size_t i = 0; i < sizeof(conflicts) / sizeof(conflicts[0]); i++) {
+        write_test_file("test_queries_cli.txt", "kept\n");
+        char command[256];
+        snprintf(command, sizeof(command), "%s 2>/dev/null", conflicts[i]);
+        result = system(command);
+        file = fopen("test_queries_cli.txt", "r");
+        char kept[8] = "";
+        if (file) {
+            fread(kept, 1, sizeof(kept) - 1, file);
+            fclose(file);
+        }
+        refused &= result != 0 && strcmp(kept, "kept\n") == 0;
+    }
+    test_assert(refused, "conflicting options are refused before -o truncates the file");
+    unlink("test_queries.txt");
+    unlink("test_queries_cli.txt");
+
+    free(content);
+    unlink("test_queries.log");
+}
+
+void test_bisect_disorder() {
+    // Lines 100 ms apart, each stamped up to 200 ms early or late, so a
+    // timestamp runs at most 300 ms behind an earlier line's
+    size_t size = 0;
+    char *content = malloc(3000 * 64);
+    int64_t *times = malloc(sizeof(int64_t) * 3000);
+    size_t *offsets = malloc(sizeof(size_t) * 3001);
+    for (int i = 0; i < 3000; i++) {
+        int ms = i * 100 + (int)(((long long)i * i * 7919 + i * 31) % 401) - 200 + 1000;
+        offsets[i] = size;
+        size += sprintf(content + size, "2025-06-02 10:%02d:%02d.%03d line %d\n",
+                        ms / 60000, ms / 1000 % 60, ms % 1000, i);
+        times[i] = parse_date_ns(content + offsets[i], 23);
+    }
+    offsets[3000] = size;
+    write_test_file("test_disorder.log", content);
+
+    // Windows of 2.5 s starting every 7.3 s; with the tolerance each must
+    // hold exactly the lines stamped within it
+    bool all_exact = true;
+    int plain_wrong = 0;
+    for (int k = 0; k < 30; k++) {
+        struct search_range_t range;
+        parse_search_range("2025-06-02 10:00:05", &range);
+        range.start.seconds += k * 7 + (k * 300 + 300) / 1000;
+        range.start.nanoseconds = (k * 300 + 300) % 1000 * 1000000L;
+        range.end = range.start;
+        range.end.seconds += 2;
+        range.end.nanoseconds += 500000000L;
+        if (range.end.nanoseconds >= NS_PER_SECOND) {
+            range.end.seconds++;
+            range.end.nanoseconds -= NS_PER_SECOND;
+        }
+        int64_t start_ns = precise_time_to_ns(range.start);
+        int64_t end_ns = precise_time_to_ns(range.end);
+        char expected[4096];
+        size_t expected_len = 0;
+        for (int i = 0; i < 3000; i++) {
+            if (times[i] >= start_ns && times[i] <= end_ns) {
+                memcpy(expected + expected_len, content + offsets[i], offsets[i + 1] - offsets[i]);
+                expected_len += offsets[i + 1] - offsets[i];
+            }
+        }
+        expected[expected_len] = '\0';
+
+        range.disorder_ns = 300 * (NS_PER_SECOND / 1000);
+        int saved = capture_stdout_begin("test_disorder_out.txt");
+        int result = bisect("test_disorder.log", range);
+        char *output = capture_stdout_end("test_disorder_out.txt", saved);
+        all_exact &= result == 0 && output && expected_len > 0 && strcmp(output, expected) == 0;
+        free(output);
+
+        range.disorder_ns = 0;
+        saved = capture_stdout_begin("test_disorder_out.txt");
+        bisect("test_disorder.log", range);
+        output = capture_stdout_end("test_disorder_out.txt", saved);
+        plain_wrong += output && strcmp(output, expected) != 0;
+        free(output);
+    }
+    test_assert(all_exact, "bisect with a tolerance writes exactly the entries stamped within the range");
+    test_assert(plain_wrong > 0, "bisect without a tolerance gets the edges of such a log wrong");
+
+    free(content);
+    free(times);
+    free(offsets);
+    unlink("test_disorder.log");
+}
+
+struct handle_sink {
+    char *buf;
+    size_t len;
+};
+
+static int collect(void *context, const char *data, size_t len) {
+    struct handle_sink *sink = context;
+    memcpy(sink->buf + sink->len, data, len);
+    sink->len += len;
+    return 0;
+}
+
+static int refuse(void *context, const char *data, size_t len) {
+    (void)context;
+    (void)data;
+    (void)len;
+    return 1;
+}
+
+struct handle_thread {
+    const struct bisect_handle *handle;
+    const int64_t *times;
+    const size_t *offsets;
+    int first;
+    bool ok;
+};
+
+static void *search_handle(void *arg) {
+    struct handle_thread *t = arg;
+    t->ok = true;
+    for (int round = 0; round < 20; round++) {
+        for (int i = t->first; i < 5000; i += 7) {
+            t->ok &= bisect_find_lower(t->handle, t->times[i]) == t->offsets[i] &&
+                     bisect_find_upper(t->handle, t->times[i]) == t->offsets[i + 1];
+        }
+    }
+    return NULL;
+}
+
+void test_bisect_handle() {
+    size_t size = 0;
+    char *content = malloc(5000 * 48);
+    int64_t *times = malloc(sizeof(int64_t) * 5000);
+    size_t *offsets = malloc(sizeof(size_t) * 5001);
+    for (int i = 0; i < 5000; i++) {
+        offsets[i] = size;
+        size += sprintf(content + size, "2025-06-02 %02d:%02d:%02d.%03d line %d\n",
+                        10 + i / 3600, i / 60 % 60, i % 60, i % 1000, i);
+        times[i] = parse_date_ns(content + offsets[i], 23);
+    }
+    offsets[5000] = size;
+    write_test_file("test_handle.log", content);
+
+    struct bisect_handle *handle;
+    test_assert(bisect_open("test_handle.log", &handle) == 0, "bisect_open opens a log");
+    struct bisect_handle *missing;
+    test_assert(bisect_open("test_handle_missing.log", &missing) == -1 && missing == NULL,
+                "bisect_open fails on a missing log");
+    test_assert(bisect_size(handle) == size, "bisect_size is the size of the log");
+    struct stat st;
+    stat("test_handle.log", &st);
+    bool current = bisect_is_current(handle, &st);
+    st.st_mtim.tv_nsec = (st.st_mtim.tv_nsec + 1) % 1000000000;
+    test_assert(current && !bisect_is_current(handle, &st),
+                "bisect_is_current notices a rewrite within the same second");
+    test_assert(bisect_find_lower(handle, times[1234]) == offsets[1234] &&
+                bisect_find_lower(handle, times[1234] + 1) == offsets[1235] &&
+                bisect_find_upper(handle, times[1234]) == offsets[1235],
+                "bisect_find_lower and bisect_find_upper return entry offsets");
+    test_assert(bisect_find_lower(handle, times[4999] + 1) == size && bisect_find_upper(handle, times[0] - 1) == 0,
+                "bisect_find_lower and bisect_find_upper handle the ends of the log");
+
+    struct handle_sink sink = {malloc(size), 0};
+    size_t from = bisect_find_lower(handle, times[100]);
+    size_t to = bisect_find_upper(handle, times[102]);
+    test_assert(bisect_read_range(handle, from, to, collect, &sink) == 0 && sink.len == offsets[103] - offsets[100] &&
+                memcmp(sink.buf, content + offsets[100], sink.len) == 0,
+                "bisect_read_range passes the range to the sink");
+    test_assert(bisect_read_range(handle, from, to, refuse, NULL) == -1, "bisect_read_range stops when the sink does");
+    test_assert(bisect_read_range(handle, to, size + 1, collect, &sink) == -1, "bisect_read_range rejects a range past the end");
+
+    // The same answers from several threads sharing the handle and its cache
+    pthread_t threads[4];
+    struct handle_thread work[4];
+    for (int i = 0; i < 4; i++) {
+        work[i] = (struct handle_thread){handle, times, offsets, i, false};
+        pthread_create(&threads[i], NULL, search_handle, &work[i]);
+    }
+    bool all_ok = true;
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+        all_ok &= work[i].ok;
+    }
+    test_assert(all_ok, "concurrent searches of one handle agree with the log");
+    bisect_close(handle);
+
+    // A handle keeps the format it was opened with
+    write_test_file("test_handle.log", "2025-06-02T10:00:00 a\n2025-06-02T10:00:01 b\n");
+    struct log_format iso;
+    log_format_init(&iso, DATE_FORMAT_ISO8601, "ts");
+    const struct log_format *previous = date_format_use(&iso);
+    bisect_open("test_handle.log", &handle);
+    date_format_use(previous);
+    test_assert(handle != NULL && bisect_find_lower(handle, parse_date_ns("2025-06-02 10:00:01", 19)) == 22,
+                "a handle searches with the format it was opened with");
+    bisect_close(handle);
+
+    free(sink.buf);
+    free(content);
+    free(times);
+    free(offsets);
+    unlink("test_handle.log");
+}
+
+static void *run_server(void *arg) {
+    bisect_serve(arg, 2);
+    return NULL;
+}
+
+// Runs a request through the daemon and returns what it wrote, which the
+// caller frees
+static char *serve_query(const char *range, const char *path, int *result) {
+    int fd = open("test_serve_out.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    *result = bisect_request("test_serve.sock", range, path, fd);
+    close(fd);
+    FILE *file = fopen("test_serve_out.txt", "r");
+    char *content = calloc(1, 65536);
+    if (file && content) {
+        fread(content, 1, 65535, file);
+    }
+    if (file) {
+        fclose(file);
+    }
+    unlink("test_serve_out.txt");
+    return content;
+}
+
+void test_bisect_serve() {
+    write_test_file("test_serve.log",
+                    "2025-06-02 10:00:00 a\n"
+                    "2025-06-02 10:00:01 b\n"
+                    "2025-06-02 10:00:02 c\n");
+    char path[PATH_MAX];
+    realpath("test_serve.log", path);
+
+    // The daemon runs until the tests exit
+    pthread_t server;
+    pthread_create(&server, NULL, run_server, "test_serve.sock");
+    pthread_detach(server);
+    for (int i = 0; i < 100 && access("test_serve.sock", F_OK) != 0; i++) {
+        nanosleep(&(struct timespec){0, 10000000}, NULL);
+    }
+
+    int result;
+    char *output = serve_query("2025-06-02 10:00:01+1s", path, &result);
+    test_assert(result == 0 && output && strcmp(output, "2025-06-02 10:00:01 b\n2025-06-02 10:00:02 c\n") == 0,
+                "the daemon writes the range to the descriptor passed with the request");
+    free(output);
+
+    // Appending changes the size, so the daemon maps the file again
+    FILE *log = fopen("test_serve.log", "a");
+    fputs("2025-06-02 10:00:03 d\n", log);
+    fclose(log);
+    output = serve_query("2025-06-02 10:00:02+1s", path, &result);
+    test_assert(result == 0 && output && strcmp(output, "2025-06-02 10:00:02 c\n2025-06-02 10:00:03 d\n") == 0,
+                "the daemon notices a file that changed since it was mapped");
+    free(output);
+
+    free(serve_query("2025-06-02 10:00:02+1s", "/nonexistent/test_serve.log", &result));
+    test_assert(result == -1, "the daemon reports a file it cannot open");
+
+    struct stat st;
+    test_assert(stat("test_serve.sock", &st) == 0 && (st.st_mode & 0777) == 0600,
+                "the daemon's socket is only open to its user");
+
+    // A descriptor beyond the first is closed by the daemon: the pipe reads
+    // EOF once the daemon has dropped its copy of the write end
+    int pipe_fds[2];
+    pipe(pipe_fds);
+    fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+    int fds[2] = {open("test_serve_out.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644), pipe_fds[1]};
+    int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strcpy(addr.sun_path, "test_serve.sock");
+    connect(conn, (struct sockaddr *)&addr, sizeof(addr));
+    char request[PATH_MAX + 64];
+    int len = snprintf(request, sizeof(request), "2025-06-02 10:00:00+0s\ndefault ts\n%s\n", path);
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = {request, (size_t)len};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.space,
+                         .msg_controllen = sizeof(control.space)};
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, 2 * sizeof(int));
+    sendmsg(conn, &msg, MSG_NOSIGNAL);
+    close(fds[0]);
+    close(fds[1]);
+    char reply[64] = "";
+    recv(conn, reply, sizeof(reply) - 1, 0);
+    close(conn);
+    char byte;
+    test_assert(strcmp(reply, "ok\n") == 0 && read(pipe_fds[0], &byte, 1) == 0,
+                "the daemon closes descriptors beyond the first");
+    close(pipe_fds[0]);
+    unlink("test_serve_out.txt");
+
+    // The daemon searches with the client's format, not its own
+    write_test_file("test_serve.log",
+                    "2025-06-02T10:00:00 a\n"
+                    "2025-06-02T10:00:01 b\n"
+                    "2025-06-02T10:00:02 c\n");
+    struct log_format iso;
+    log_format_init(&iso, DATE_FORMAT_ISO8601, "ts");
+    const struct log_format *previous = date_format_use(&iso);
+    output = serve_query("2025-06-02 10:00:01+1s", path, &result);
+    date_format_use(previous);
+    test_assert(result == 0 && output && strcmp(output, "2025-06-02T10:00:01 b\n2025-06-02T10:00:02 c\n") == 0,
+                "the daemon searches with the format the client uses");
+    free(output);
+
+    // The daemon bounds its sends to a socket only while it answers
+    int pair[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+    previous = date_format_use(&iso);
+    result = bisect_request("test_serve.sock", "2025-06-02 10:00:02+0s", path, pair[1]);
+    date_format_use(previous);
+    // Nothing more is coming should the answer be empty
+    shutdown(pair[1], SHUT_WR);
+    struct timeval timeout = {1, 0};
+    socklen_t timeout_len = sizeof(timeout);
+    getsockopt(pair[1], SOL_SOCKET, SO_SNDTIMEO, &timeout, &timeout_len);
+    char entry[64] = "";
+    recv(pair[0], entry, sizeof(entry) - 1, 0);
+    test_assert(result == 0 && strcmp(entry, "2025-06-02T10:00:02 c\n") == 0 && timeout.tv_sec == 0 && timeout.tv_usec == 0,
+                "the daemon restores the send timeout of a socket it writes to");
+    close(pair[0]);
+    close(pair[1]);
+
+    unlink("test_serve.sock");
+    unlink("test_serve.log");
+}
+
+// The timestamp in str found with format, in nanoseconds, or -1
+static int64_t parse_as(enum date_format format, const char *str) {
+    size_t offset, len;
+    if (!scan_date_as(format, str, strlen(str), &offset, &len)) {
+        return -1;
+    }
+    date_format_set(format);
+    int64_t ns = parse_date_ns(str + offset, len);
+    date_format_set(DATE_FORMAT_DEFAULT);
+    return ns;
+}
+
+void test_date_formats() {
+    int64_t second = 1748865334LL * NS_PER_SECOND;  // 2025-06-02 11:55:34 UTC
+    test_assert(parse_as(DATE_FORMAT_ISO8601, "x 2025-06-02T11:55:34.5Z y") == second + NS_PER_SECOND / 2 &&
+                parse_as(DATE_FORMAT_ISO8601, "2025-06-02T13:55:34+02:00") == second &&
+                parse_as(DATE_FORMAT_ISO8601, "2025-06-02T06:25:34.000-0530") == second,
+                "ISO-8601 timestamps with a zone are parsed as UTC plus the offset");
+    test_assert(parse_as(DATE_FORMAT_ISO8601, "2025-06-02T11:55:34.25") == parse_as(DATE_FORMAT_DEFAULT, "2025-06-02 11:55:34.25"),
+                "ISO-8601 timestamps without a zone are local time");
+    test_assert(parse_as(DATE_FORMAT_CLF, "1.2.3.4 - - [02/Jun/2025:11:55:34 +0000] \"GET /\"") == second &&
+                parse_as(DATE_FORMAT_CLF, "[02/Jun/2025:04:55:34 -0700]") == second,
+                "nginx timestamps are parsed with their offset");
+    test_assert(parse_as(DATE_FORMAT_EPOCH, "1748865334.25 GET /") == second + NS_PER_SECOND / 4 &&
+                parse_as(DATE_FORMAT_EPOCH, "1748865334 GET /") == second &&
+                parse_as(DATE_FORMAT_EPOCH_MS, "1748865334123 GET /") == second + 123000000,
+                "epoch timestamps are parsed in seconds and milliseconds");
+    test_assert(parse_as(DATE_FORMAT_EPOCH, "id 1748865334 GET /") == -1 && parse_as(DATE_FORMAT_EPOCH_MS, "17488653341234 x") == -1,
+                "epoch timestamps are only found at the start of a line, at their exact length");
+
+    // Cut short, as at the end of a mapping: rejected before any field is read
+    date_format_set(DATE_FORMAT_SYSLOG);
+    bool short_syslog = parse_date_ns("Jun  2 01:02", 12) == PRECISE_NS_INVALID;
+    date_format_set(DATE_FORMAT_CLF);
+    bool short_clf = parse_date_ns("02/Jun/2025:11:55:34 +02", 24) == PRECISE_NS_INVALID;
+    date_format_set(DATE_FORMAT_DEFAULT);
+    test_assert(short_syslog && short_clf, "syslog and nginx timestamps shorter than their format are rejected");
+
+    char local[32];
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    sprintf(local, "%d-06-02 01:02:03", tm.tm_year + 1900);
+    test_assert(parse_as(DATE_FORMAT_SYSLOG, "Jun  2 01:02:03 host sshd[1]: x") == parse_as(DATE_FORMAT_DEFAULT, local),
+                "syslog timestamps are local time in the current year");
+
+    const char *samples[] = {
+        "2025-06-02 11:55:34 a\n2025-06-02 11:55:35 b\n",
+        "2025-06-02T11:55:34.123Z a\n",
+        "Jun  2 11:55:34 host a\n",
+        "1.2.3.4 - - [02/Jun/2025:11:55:34 +0000] \"GET / HTTP/1.1\" 200\n",
+        "1748865334.123 a\n",
+        "1748865334123 a\n",
+        "{\"msg\": \"a\", \"ts\": \"2025-06-02T11:55:34.123Z\"}\n",
+    };
+    bool detected = true;
+    for (int format = 0; format < DATE_FORMAT_COUNT; format++) {
+        detected &= date_format_detect(samples[format], strlen(samples[format])) == (enum date_format)format;
+        detected &= date_format_from_name(date_format_name(format)) == format;
+    }
+    test_assert(detected && date_format_from_name("strftime") == -1, "the format of a log is detected from its start");
+
+    // A whole search in a log with another format
+    size_t size = 0;
+    char *content = malloc(3000 * 64);
+    for (int i = 0; i < 3000; i++) {
+        size += sprintf(content + size, "10.0.0.1 - - [02/Jun/2025:%02d:%02d:%02d +0200] \"GET /%d\"\n",
+                        10 + i / 3600, i / 60 % 60, i % 60, i);
+    }
+    write_test_file("test_formats.log", content);
+    struct search_range_t range;
+    parse_search_range("2025-06-02 08:20:00+1s", &range);
+    date_format_set(DATE_FORMAT_CLF);
+    int saved = capture_stdout_begin("test_formats_out.txt");
+    int result = bisect("test_formats.log", range);
+    char *output = capture_stdout_end("test_formats_out.txt", saved);
+    date_format_set(DATE_FORMAT_DEFAULT);
+    test_assert(result == 0 && output &&
+                strcmp(output, "10.0.0.1 - - [02/Jun/2025:10:20:00 +0200] \"GET /1200\"\n"
+                               "10.0.0.1 - - [02/Jun/2025:10:20:01 +0200] \"GET /1201\"\n") == 0,
+                "bisect searches a log by its nginx timestamps");
+    free(output);
+    free(content);
+    unlink("test_formats.log");
+    unlink("test_formats_out.txt");
+}
+
+void test_prefetch() {
+    int slow_probes = 0;
+    prefetch_observe(1000, &slow_probes);
+    prefetch_observe(PREFETCH_MIN_LATENCY_NS, &slow_probes);
+    test_assert(slow_probes == 1, "only probes slow enough for storage count");
+    test_assert(prefetch_observe(PREFETCH_MIN_LATENCY_NS, &slow_probes) && prefetch_worthwhile(),
+                "a second slow probe in a search turns on reading ahead");
+
+    size_t size = 0;
+    char *content = malloc(20000 * 48);
+    for (int i = 0; i < 20000; i++) {
+        size += sprintf(content + size, "2025-06-02 %02d:%02d:%02d.%03d line %d\n",
+                        10 + i / 3600, i / 60 % 60, i % 60, i % 1000, i);
+    }
+    write_test_file("test_prefetch.log", content);
+
+    struct log_file log;
+    log_open("test_prefetch.log", &log);
+    struct prefetcher prefetcher;
+    prefetch_start(&log, &prefetcher);
+    size_t before = log_stats.prefetches;
+    prefetch_add(&prefetcher, 0, 8192);
+    prefetch_add(&prefetcher, 8192, 8192);
+    prefetch_add(&prefetcher, 0, 8192);
+    prefetch_submit(&prefetcher);
+    test_assert(log_stats.prefetches - before == 2, "a block is read ahead once per search");
+
+    // Out of the page cache where the file system allows, so that the search
+    // reads ahead
+    int fd = open("test_prefetch.log", O_RDONLY);
+    fsync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    struct log_entry entry;
+    const char *line = strstr(content, "2025-06-02 13:25:47");
+    test_assert(log_seek(&log, parse_date_ns(line, 23), &entry) == 1 && entry.offset == (size_t)(line - content) &&
+                log_upper_bound(&log, entry.offset, entry.ns) == (size_t)(strchr(line, '\n') + 1 - content),
+                "a search reading ahead finds the same entries");
+
+    log_close(&log);
+    free(content);
+    unlink("test_prefetch.log");
+}
+
+void test_long_entries() {
+    // JSON payloads and stack traces spanning several blocks, an older date
+    // inside every payload and a trace without any date at the end
+    size_t size = 0;
+    char *content = malloc(4000000);
+    int64_t times[600];
+    size_t offsets[600];
+    for (int i = 0; i < 600; i++) {
+        offsets[i] = size;
+        times[i] = parse_date_ns("2025-06-02 10:00:00", 19) + (int64_t)i * NS_PER_SECOND;
+        size += sprintf(content + size, "2025-06-02 10:%02d:%02d entry %d {\"created\": \"2020-01-01 00:00:00\", \"body\": \"",
+                        i / 60, i % 60, i);
+        size_t body = i % 7 == 3 ? 20000 : 40;
+        memset(content + size, 'x', body);
+        size += body;
+        size += sprintf(content + size, "\"}\n");
+        for (int frame = 0; frame < (i % 5 == 1 ? 800 : 2); frame++) {
+            size += sprintf(content + size, "    at frame %d\n", frame);
+        }
+    }
+    for (int frame = 0; frame < 3000; frame++) {
+        size += sprintf(content + size, "    at tail %d\n", frame);
+    }
+    write_test_file("test_long.log", content);
+
+    struct log_file log;
+    log_open("test_long.log", &log);
+    bool all_found = true;
+    for (int i = 0; i < 600; i++) {
+        struct log_entry entry;
+        if (log_seek(&log, times[i], &entry) != 1 || entry.offset != offsets[i] ||
+            log_upper_bound(&log, 0, times[i]) != (i + 1 < 600 ? offsets[i + 1] : size)) {
+            all_found = false;
+        }
+    }
+    test_assert(all_found, "entries longer than several blocks are found");
+
+    size_t found[600];
+    test_assert(log_seek_many(&log, times, 600, found) == 0 && memcmp(found, offsets, sizeof(offsets)) == 0,
+                "log_seek_many finds entries longer than several blocks");
+
+    struct log_entry entry;
+    test_assert(log_seek(&log, times[599] + 1, &entry) == 0, "a search past the last entry of a long log finds none");
+    log_close(&log);
+
+    free(content);
+    unlink("test_long.log");
+}
+
+void test_json_field() {
+    int64_t second = 1748865334LL * NS_PER_SECOND;  // 2025-06-02 11:55:34 UTC
+    test_assert(parse_as(DATE_FORMAT_JSON, "{\"msg\": \"at 2020-01-01T00:00:00Z\", \"ts\": \"2025-06-02T11:55:34Z\"}") == second,
+                "a JSON line is dated by its field, not by a date in another value");
+    test_assert(parse_as(DATE_FORMAT_JSON, "{\"req\": {\"ts\": 1577836800}, \"m\": \"\\\"ts\\\": 1\", \"ts\": 1748865334}") == second,
+                "keys of nested objects and inside strings are not the field");
+    test_assert(parse_as(DATE_FORMAT_JSON, "{\"ts\": 1748865334123}") == second + 123000000 &&
+                parse_as(DATE_FORMAT_JSON, "{\"ts\":1748865334.5}") == second + NS_PER_SECOND / 2 &&
+                parse_as(DATE_FORMAT_JSON, "{\"ts\": 1748865334000000001}") == second + 1,
+                "numeric JSON timestamps are read in the unit their digits tell");
+    test_assert(parse_as(DATE_FORMAT_JSON, "{\"ts\": null}\n{\"ts\": \"soon\"}\n{\"x\": 1}") == -1,
+                "JSON lines without a timestamp in the field have none");
+    test_assert(date_format_set_json_field("") == -1 && date_format_set_json_field("time") == 0 &&
+                parse_as(DATE_FORMAT_JSON, "{\"ts\": 1, \"time\": 1748865334}") == second &&
+                date_format_set_json_field("ts") == 0,
+                "the field is chosen by name");
+
+    // Searched and written through the field, with older dates and a nested
+    // field in the payload
+    size_t size = 0;
+    char *content = malloc(3000 * 128);
+    for (int i = 0; i < 3000; i++) {
+        size += sprintf(content + size,
+                        "{\"level\": \"info\", \"ctx\": {\"ts\": 1}, \"msg\": \"since 2020-01-01T00:00:00Z\", "
+                        "\"ts\": \"2025-06-02T%02d:%02d:%02dZ\"}\n", 10 + i / 3600, i / 60 % 60, i % 60);
+    }
+    write_test_file("test_json.log", content);
+    struct search_range_t range;
+    parse_search_range("2025-06-02 10:20:00+1s", &range);
+    range.start = ns_to_precise_time(parse_as(DATE_FORMAT_ISO8601, "2025-06-02T10:20:00Z"));
+    range.end = ns_to_precise_time(parse_as(DATE_FORMAT_ISO8601, "2025-06-02T10:20:01Z"));
+    date_format_set(DATE_FORMAT_JSON);
+    int saved = capture_stdout_begin("test_json_out.txt");
+    int result = bisect("test_json.log", range);
+    char *output = capture_stdout_end("test_json_out.txt", saved);
+    date_format_set(DATE_FORMAT_DEFAULT);
+    const char *first = strstr(content, "\"ts\": \"2025-06-02T10:20:00Z");
+    while (first > content && first[-1] != '\n') {
+        first--;
+    }
+    test_assert(result == 0 && output && first && strlen(output) == 2 * (size / 3000) &&
+                strncmp(output, first, strlen(output)) == 0,
+                "bisect searches JSON lines by their field");
+    free(output);
+    free(content);
+    unlink("test_json.log");
+}
+
+void test_grep() {
+    // Several chunks' worth, so the threads finish out of order
+    size_t size = 0, matched = 0, literal = 0;
+    char *content = malloc(40000 * 80);
+    char *ends_in_77 = malloc(40000 * 80);
+    char *has_3999 = malloc(40000 * 80);
+    for (int i = 0; i < 40000; i++) {
+        char *line = content + size;
+        size += sprintf(line, "2025-06-02 %02d:%02d:%02d line %d padding padding padding\n",
+                        10 + i / 3600, i / 60 % 60, i % 60, i);
+        size_t len = content + size - line;
+        if (i % 100 == 77) {
+            memcpy(ends_in_77 + matched, line, len);
+            matched += len;
+        }
+        if (strstr(line, "line 3999") != NULL) {
+            memcpy(has_3999 + literal, line, len);
+            literal += len;
+        }
+    }
+    ends_in_77[matched] = '\0';
+    has_3999[literal] = '\0';
+    write_test_file("test_grep.log", content);
+
+    struct search_range_t range;
+    parse_search_range("2025-06-02 10:00:00+12h", &range);
+    int saved = capture_stdout_begin("test_grep_out.txt");
+    int result = bisect_grep("test_grep.log", range, "line [0-9]*77 pad", 4);
+    char *output = capture_stdout_end("test_grep_out.txt", saved);
+    test_assert(result == 0 && output && strcmp(output, ends_in_77) == 0,
+                "bisect_grep writes the lines matching a regex in file order");
+    free(output);
+
+    saved = capture_stdout_begin("test_grep_out.txt");
+    result = bisect_grep("test_grep.log", range, "line 3999", 3);
+    output = capture_stdout_end("test_grep_out.txt", saved);
+    test_assert(result == 0 && output && strcmp(output, has_3999) == 0,
+                "bisect_grep writes the lines containing a literal");
+    free(output);
+
+    parse_search_range("2025-06-02 10:00:05+2s", &range);
+    saved = capture_stdout_begin("test_grep_out.txt");
+    result = bisect_grep("test_grep.log", range, "^2025.*line", 2);
+    output = capture_stdout_end("test_grep_out.txt", saved);
+    test_assert(result == 0 && output &&
+                strcmp(output,
+                       "2025-06-02 10:00:05 line 5 padding padding padding\n"
+                       "2025-06-02 10:00:06 line 6 padding padding padding\n"
+                       "2025-06-02 10:00:07 line 7 padding padding padding\n") == 0,
+                "bisect_grep only searches the time range");
+    free(output);
+
+    saved = capture_stdout_begin("test_grep_out.txt");
+    result = bisect_grep("test_grep.log", range, "line (", 2);
+    free(capture_stdout_end("test_grep_out.txt", saved));
+    test_assert(result == -1, "bisect_grep rejects an invalid pattern");
+
+    free(content);
+    free(ends_in_77);
+    free(has_3999);
+    unlink("test_grep.log");
+}
+
+#ifdef HAVE_ZLIB
+void test_compressed_bisect() {
+    // Large enough for several access points
+    const char *filename = "test_compressed.log.gz";
+    gzFile gz = gzopen(filename, "wb");
+    if (!gz) {
+        printf("Could not create test file\n");
+        return;
+    }
+    for (int i = 0; i < 60000; i++) {
+        gzprintf(gz, "2025-06-02 %02d:%02d:%02d.%03d Entry %d with some padding to grow the file\n",
+                 i / 3600 % 24, i / 60 % 60, i % 60, i % 1000, i);
+    }
+    gzclose(gz);
+
+    test_assert(detect_compression(filename) == COMPRESSION_GZIP, "detect_compression recognizes gzip");
+    test_assert(detect_compression("test.c") == COMPRESSION_NONE, "detect_compression leaves plain files alone");
+
+    struct search_range_t range;
+    parse_search_range("2025-06-02 12:30:00+2s", &range);
+    int saved = capture_stdout_begin("test_compressed_out.txt");
+    int result = bisect(filename, range);
+    char *output = capture_stdout_end("test_compressed_out.txt", saved);
+
+    test_assert(result == 0, "bisect searches a gzip log");
+    test_assert(output && strcmp(output,
+                                 "2025-06-02 12:30:00.000 Entry 45000 with some padding to grow the file\n"
+                                 "2025-06-02 12:30:01.001 Entry 45001 with some padding to grow the file\n") == 0,
+                "bisect extracts the range from a gzip log");
+    free(output);
+
+    char index_path[64];
+    snprintf(index_path, sizeof(index_path), "%s%s", filename, GZX_SUFFIX);
+    test_assert(access(index_path, F_OK) == 0, "bisect keeps the gzip access points next to the log");
+
+    unlink(index_path);
+    unlink(filename);
+
+    // An access point is mid-line, where the next date may be inside a message
+    gz = gzopen(filename, "wb");
+    if (!gz) {
+        printf("Could not create test file\n");
+        return;
+    }
+    for (int i = 0; i < 60000; i++) {
+        gzprintf(gz, "2025-06-02 %02d:%02d:%02d.%03d INFO line %d ref 2025-01-01 00:00:00\n",
+                 i / 3600 % 24, i / 60 % 60, i % 60, i % 1000, i);
+    }
+    gzclose(gz);
+
+    parse_search_range("2025-06-02 12:30:00+2s", &range);
+    saved = capture_stdout_begin("test_compressed_out.txt");
+    result = bisect(filename, range);
+    output = capture_stdout_end("test_compressed_out.txt", saved);
+    test_assert(result == 0 && output && strcmp(output,
+                                                "2025-06-02 12:30:00.000 INFO line 45000 ref 2025-01-01 00:00:00\n"
+                                                "2025-06-02 12:30:01.001 INFO line 45001 ref 2025-01-01 00:00:00\n") == 0,
+                "bisect ignores dates inside messages of a gzip log");
+    free(output);
+
+    range.limit = 1;
+    saved = capture_stdout_begin("test_compressed_out.txt");
+    result = bisect(filename, range);
+    output = capture_stdout_end("test_compressed_out.txt", saved);
+    test_assert(result == 0 && output &&
+                    strcmp(output, "2025-06-02 12:30:00.000 INFO line 45000 ref 2025-01-01 00:00:00\n") == 0,
+                "--limit counts a gzip line with a second date as one entry");
+    free(output);
+
+    unlink(index_path);
+    unlink(filename);
+}
+#endif
+
 int main() {
     printf("Running unit tests...\n\n");
     
     test_find_date_in_buffer();
+    test_scan_date();
     test_create_sample_file();
     test_parse_time_range();
     test_precise_time_parsing();
     test_fractional_search_range();
     test_date_regex_with_fractional();
     test_edge_cases();
+    test_parse_date_ns();
+    test_bsx_index();
+    test_bisect_merge();
+    test_bisect_range();
+    test_bisect_skewed();
+    test_histogram();
+    test_bisect_queries();
+    test_stats();
+    test_grep();
+    test_bisect_disorder();
+    test_bisect_handle();
+    test_bisect_serve();
+    test_date_formats();
+    test_prefetch();
+    test_long_entries();
+    test_json_field();
+    test_sample();
+    test_rotated_chain();
+    test_reverse_limit();
+    test_binary_records();
+    test_log_open_fd();
+#ifdef HAVE_ZLIB
+    test_compressed_bisect();
+#endif
     
     printf("\n=== Test Results ===\n");
     printf("Tests run: %d\n", test_count);
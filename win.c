@@ -1,8 +1,11 @@
 #ifdef _WIN32
 #include <windows.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
+#include <io.h>
 #include "bisect.h"
+#include "win.h"
 
 char* realpath(const char* path, char* resolved_path) {
 	if (GetFullPathNameA(path, MAX_PATH_LENGTH, resolved_path, NULL) == 0) {
@@ -51,4 +54,90 @@ char* strptime(const char* s, const char* format, struct tm* tm) {
 
 	return (char*)s + strlen(s);
 }
+void* mmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset) {
+	(void)addr;
+	(void)prot;
+	(void)flags;
+	HANDLE file = (HANDLE)_get_osfhandle(fd);
+	if (file == INVALID_HANDLE_VALUE) {
+		return MAP_FAILED;
+	}
+
+	unsigned long long end = (unsigned long long)offset + length;
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, (DWORD)(end >> 32), (DWORD)end, NULL);
+	if (mapping == NULL) {
+		return MAP_FAILED;
+	}
+
+	unsigned long long start = (unsigned long long)offset;
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(start >> 32), (DWORD)start, length);
+	// The view keeps the mapping object alive
+	CloseHandle(mapping);
+	return view ? view : MAP_FAILED;
+}
+
+int munmap(void* addr, size_t length) {
+	(void)length;
+	return UnmapViewOfFile(addr) ? 0 : -1;
+}
+
+int posix_madvise(void* addr, size_t len, int advice) {
+	(void)addr;
+	(void)len;
+	(void)advice;
+	return 0;
+}
+
+long sysconf(int name) {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	switch (name) {
+	case _SC_PAGESIZE:
+		return (long)info.dwAllocationGranularity;
+	case _SC_NPROCESSORS_ONLN:
+		return (long)info.dwNumberOfProcessors;
+	default:
+		return -1;
+	}
+}
+
+ssize_t pread(int fd, void* buf, size_t count, long long offset) {
+	HANDLE file = (HANDLE)_get_osfhandle(fd);
+	if (file == INVALID_HANDLE_VALUE) {
+		return -1;
+	}
+	OVERLAPPED at = {0};
+	at.Offset = (DWORD)offset;
+	at.OffsetHigh = (DWORD)((unsigned long long)offset >> 32);
+	DWORD read = 0;
+	DWORD len = count > 0x7fffffff ? 0x7fffffff : (DWORD)count;
+	if (!ReadFile(file, buf, len, &read, &at)) {
+		// Reading at or past the end is not an error on POSIX
+		return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+	}
+	return (ssize_t)read;
+}
+
+void* memmem(const void* haystack, size_t haystack_len, const void* needle, size_t needle_len) {
+	const char* p = haystack;
+	if (needle_len == 0) {
+		return (void*)p;
+	}
+	while (haystack_len >= needle_len) {
+		const char* first = memchr(p, *(const char*)needle, haystack_len - needle_len + 1);
+		if (first == NULL) {
+			return NULL;
+		}
+		if (memcmp(first, needle, needle_len) == 0) {
+			return (void*)first;
+		}
+		haystack_len -= first + 1 - p;
+		p = first + 1;
+	}
+	return NULL;
+}
+
+int win_rename(const char* from, const char* to) {
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+}
 #endif //_WIN32 || _WIN64
@@ -3,9 +3,43 @@
 #pragma once
 
 #ifdef _WIN32
+#include <stddef.h>
+#include <sys/types.h>
+
 char* realpath(const char* path, char* resolved_path);
 
 char* strptime(const char* s, const char* format, struct tm* tm);
+
+#define localtime_r(timep, result) (localtime_s((result), (timep)) == 0 ? (result) : NULL)
+
+// Read-only file mapping on top of CreateFileMapping/MapViewOfFile
+#define PROT_READ 0x1
+#define MAP_PRIVATE 0x2
+#define MAP_FAILED ((void *)-1)
+
+#define POSIX_MADV_NORMAL 0
+#define POSIX_MADV_RANDOM 1
+#define POSIX_MADV_SEQUENTIAL 2
+#define POSIX_MADV_WILLNEED 3
+#define POSIX_MADV_DONTNEED 4
+
+#define _SC_PAGESIZE 30
+#define _SC_NPROCESSORS_ONLN 84
+
+void* mmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset);
+int munmap(void* addr, size_t length);
+int posix_madvise(void* addr, size_t len, int advice);
+long sysconf(int name);
+
+// Positioned reads, which leave the file position alone as on POSIX
+ssize_t pread(int fd, void* buf, size_t count, long long offset);
+
+void* memmem(const void* haystack, size_t haystack_len, const void* needle, size_t needle_len);
+
+// Indexes are written aside and renamed over the old file, which the C
+// runtime's rename() refuses to replace
+int win_rename(const char* from, const char* to);
+#define rename(from, to) win_rename((from), (to))
 #endif // _WIN32 || _WIN64
 
 #endif // WIN_H